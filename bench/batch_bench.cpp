@@ -0,0 +1,143 @@
+// Measures generation throughput (tokens/s) against batch size.
+//
+// With --sessions <n>, instead loads n sessions from one SharedModel and
+// reports resident memory after each, to show what an extra session costs.
+//
+// Usage: batch_bench [--model <path>] [--vocab <path>] [--merges <path>]
+//                    [--max-length <n>] [--max-batch <n>] [--sessions <n>]
+
+#include "tokenizer.h"
+#include "inference_engine.h"
+#include "text_generator.h"
+#include "shared_model.h"
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+namespace {
+
+// Resident set size in MB, from /proc (0 where unavailable)
+double resident_mb() {
+    std::ifstream statm("/proc/self/statm");
+    size_t total_pages = 0, resident_pages = 0;
+    if (!(statm >> total_pages >> resident_pages)) return 0.0;
+    return static_cast<double>(resident_pages) * sysconf(_SC_PAGESIZE) / (1024.0 * 1024.0);
+}
+
+int run_sessions(const std::string& model_path, size_t sessions) {
+    double base_mb = resident_mb();
+    auto model = std::make_shared<SharedModel>();
+    if (!model->open(model_path)) return 1;
+
+    std::vector<std::unique_ptr<InferenceEngine>> engines;
+    std::vector<double> resident;
+    for (size_t i = 0; i < sessions; i++) {
+        auto engine = std::make_unique<InferenceEngine>();
+        if (!engine->load_model(model)) {
+            std::cerr << "Failed to load model" << std::endl;
+            return 1;
+        }
+        engines.push_back(std::move(engine));
+        resident.push_back(resident_mb());
+    }
+
+    std::cout << "\nsessions  resident MB  added MB" << std::endl;
+    double previous = base_mb;
+    for (size_t i = 0; i < resident.size(); i++) {
+        std::cout << std::setw(8) << i + 1 << "  "
+                  << std::fixed << std::setprecision(1)
+                  << std::setw(11) << resident[i] << "  "
+                  << std::setw(8) << resident[i] - previous << std::endl;
+        previous = resident[i];
+    }
+    return 0;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    std::string model_path = "models/gpt2/onnx/decoder_model_merged.onnx";
+    std::string vocab_path = "models/gpt2/vocab.json";
+    std::string merges_path = "models/gpt2/merges.txt";
+    int max_length = 32;
+    size_t max_batch = 16;
+    size_t sessions = 0;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--model" && i + 1 < argc) {
+            model_path = argv[++i];
+        } else if (arg == "--vocab" && i + 1 < argc) {
+            vocab_path = argv[++i];
+        } else if (arg == "--merges" && i + 1 < argc) {
+            merges_path = argv[++i];
+        } else if (arg == "--max-length" && i + 1 < argc) {
+            max_length = std::stoi(argv[++i]);
+        } else if (arg == "--max-batch" && i + 1 < argc) {
+            max_batch = static_cast<size_t>(std::stoul(argv[++i]));
+        } else if (arg == "--sessions" && i + 1 < argc) {
+            sessions = static_cast<size_t>(std::stoul(argv[++i]));
+        }
+    }
+
+    if (sessions > 0) {
+        return run_sessions(model_path, sessions);
+    }
+
+    Tokenizer tokenizer;
+    if (!tokenizer.load(vocab_path, merges_path)) {
+        std::cerr << "Failed to load tokenizer" << std::endl;
+        return 1;
+    }
+
+    InferenceEngine engine;
+    if (!engine.load_model(model_path)) {
+        std::cerr << "Failed to load model" << std::endl;
+        return 1;
+    }
+
+    TextGenerator generator(engine, tokenizer);
+
+    // Greedy decoding with EOS disabled so every row emits exactly max_length tokens
+    GenerationConfig config;
+    config.max_length = max_length;
+    config.temperature = 0.0f;
+    config.eos_token_id = -1;
+
+    // Prompts of different lengths so rows need real left padding
+    const std::vector<std::string> prompt_pool = {
+        "The quick brown fox",
+        "Once upon a time in a land far away, there lived",
+        "Machine learning is",
+        "In the beginning",
+    };
+
+    std::vector<std::pair<size_t, double>> results;
+    for (size_t batch_size = 1; batch_size <= max_batch; batch_size *= 2) {
+        std::vector<std::string> prompts;
+        for (size_t b = 0; b < batch_size; b++) {
+            prompts.push_back(prompt_pool[b % prompt_pool.size()]);
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        generator.generate_batch(prompts, config);
+        auto end = std::chrono::steady_clock::now();
+
+        double seconds = std::chrono::duration<double>(end - start).count();
+        double tokens = static_cast<double>(batch_size) * max_length;
+        results.push_back({batch_size, tokens / seconds});
+    }
+
+    std::cout << "\nbatch_size  tokens/s" << std::endl;
+    for (const auto& [batch_size, tokens_per_second] : results) {
+        std::cout << std::setw(10) << batch_size << "  "
+                  << std::fixed << std::setprecision(1) << tokens_per_second << std::endl;
+    }
+
+    return 0;
+}
@@ -0,0 +1,343 @@
+// Benchmark suite: tokenizer throughput, per-step sampling cost,
+// InferenceEngine::forward at several sequence lengths and end-to-end
+// time-to-first-token and tokens/s. Results are written as JSON so runs can
+// be diffed across builds; a summary goes to stdout.
+//
+// Runs offline against the random-weights model and tokenizer written by
+// tools/make_bench_model.py (`cmake --build . --target bench` does both), or
+// against real GPT-2 files with --model/--vocab/--merges.
+//
+// Usage: bench_suite [--model-dir <dir>] [--model <path>] [--vocab <path>]
+//                    [--merges <path>] [--json <file>] [--repeat <n>]
+//                    [--seq-lens <n,n,...>] [--prompt-tokens <n>]
+//                    [--gen-tokens <n>] [--sampler-vocab <n>]
+
+#include "inference_engine.h"
+#include "sampler.h"
+#include "text_generator.h"
+#include "tokenizer.h"
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <nlohmann/json.hpp>
+
+using Json = nlohmann::ordered_json;
+
+namespace {
+
+// Fixed corpus: prose, numbers, punctuation, code and non-ASCII text
+const char* kCorpus =
+    "The quick brown fox jumps over the lazy dog. It's 3:45pm and we've "
+    "already processed 1,234,567 requests today -- that's roughly 89% of "
+    "yesterday's load. Tokenizers split text like this into words, numbers "
+    "and punctuation before applying byte-pair merges to each piece.\n"
+    "for (int i = 0; i < n; ++i) { total += values[i] * weights[i]; }\n"
+    "Once upon a time, in a land far away, there lived a curious engineer who "
+    "measured everything twice. Caf\xc3\xa9, na\xc3\xafve, \xe6\x97\xa5\xe6\x9c\xac\xe8\xaa\x9e "
+    "and emoji \xf0\x9f\x9a\x80 all go through the byte-level fallback.\n";
+
+constexpr size_t kCorpusCopies = 2048;
+
+using Clock = std::chrono::steady_clock;
+
+double elapsed_ms(Clock::time_point start, Clock::time_point end) {
+    return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+double median(std::vector<double> values) {
+    if (values.empty()) return 0.0;
+    std::sort(values.begin(), values.end());
+    size_t mid = values.size() / 2;
+    return values.size() % 2 ? values[mid] : 0.5 * (values[mid - 1] + values[mid]);
+}
+
+// Median milliseconds of fn over repeat runs, after one untimed run
+double time_ms(int repeat, const std::function<void()>& fn) {
+    fn();
+    std::vector<double> samples;
+    for (int i = 0; i < repeat; i++) {
+        auto start = Clock::now();
+        fn();
+        samples.push_back(elapsed_ms(start, Clock::now()));
+    }
+    return median(samples);
+}
+
+std::vector<size_t> parse_list(const std::string& text) {
+    std::vector<size_t> values;
+    std::stringstream stream(text);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        if (!item.empty()) values.push_back(static_cast<size_t>(std::stoul(item)));
+    }
+    return values;
+}
+
+Json bench_tokenizer(Tokenizer& tokenizer, int repeat) {
+    std::string text;
+    for (size_t i = 0; i < kCorpusCopies; i++) text += kCorpus;
+
+    std::vector<int> tokens;
+    double encode_ms = time_ms(repeat, [&] { tokens = tokenizer.encode(text); });
+    std::string decoded;
+    double decode_ms = time_ms(repeat, [&] { decoded = tokenizer.decode(tokens); });
+
+    double megabytes = static_cast<double>(text.size()) / (1024.0 * 1024.0);
+    Json result;
+    result["corpus_bytes"] = text.size();
+    result["tokens"] = tokens.size();
+    result["round_trip"] = decoded == text;
+    result["encode_ms"] = encode_ms;
+    result["encode_mb_per_s"] = megabytes / (encode_ms / 1000.0);
+    result["encode_tokens_per_s"] = tokens.size() / (encode_ms / 1000.0);
+    result["decode_ms"] = decode_ms;
+    result["decode_tokens_per_s"] = tokens.size() / (decode_ms / 1000.0);
+
+    std::cout << std::fixed << std::setprecision(2)
+              << "tokenizer: encode " << result["encode_mb_per_s"].get<double>() << " MB/s, decode "
+              << result["decode_tokens_per_s"].get<double>() / 1e6 << " M tokens/s" << std::endl;
+    return result;
+}
+
+// Per-step cost of each TextGenerator sampling mode on synthetic logit rows
+// shaped like a language model's: a broad bulk and a few dozen peaks
+Json bench_sampler(TextGenerator& generator, size_t vocab_size, int repeat) {
+    std::mt19937 rng(1234);
+    std::normal_distribution<float> bulk(-2.0f, 2.5f);
+    std::uniform_int_distribution<size_t> pick(0, vocab_size - 1);
+    std::uniform_real_distribution<float> boost(4.0f, 12.0f);
+
+    std::vector<std::vector<float>> rows(64, std::vector<float>(vocab_size));
+    for (auto& row : rows) {
+        for (float& x : row) x = bulk(rng);
+        for (int i = 0; i < 40; i++) row[pick(rng)] += boost(rng);
+    }
+
+    struct Mode {
+        const char* name;
+        float temperature;
+        int top_k;
+        float top_p;
+    };
+    const Mode modes[] = {
+        {"greedy", 0.0f, 0, 1.0f},
+        {"temperature", 1.0f, 0, 1.0f},
+        {"top_k_50", 1.0f, 50, 1.0f},
+        {"top_p_0.9", 1.0f, 0, 0.9f},
+    };
+
+    Json result;
+    result["vocab_size"] = vocab_size;
+    result["isa"] = sampler_kernels::isa_name();
+    std::cout << "sampler (" << sampler_kernels::isa_name() << "):";
+    for (const Mode& mode : modes) {
+        GenerationConfig config;
+        config.temperature = mode.temperature;
+        config.top_k = mode.top_k;
+        config.top_p = mode.top_p;
+
+        // One timed run covers a pass over every row
+        volatile int sink = 0;
+        double ms = time_ms(repeat, [&] {
+            for (const auto& row : rows) {
+                sink = sink + generator.sample_next(LogitsView{row.data(), row.size()}, config);
+            }
+        });
+        double us_per_step = ms * 1000.0 / rows.size();
+        result[std::string(mode.name) + "_us"] = us_per_step;
+        std::cout << " " << mode.name << " " << us_per_step << " us";
+    }
+    std::cout << std::endl;
+    return result;
+}
+
+// Prefill of seq_len tokens without a cache, then single-token decode steps
+// on top of a seq_len cache
+Json bench_forward(InferenceEngine& engine, const std::vector<int>& corpus_tokens,
+                   const std::vector<size_t>& seq_lens, int repeat) {
+    Json result = Json::array();
+    for (size_t seq_len : seq_lens) {
+        std::vector<int64_t> ids(seq_len);
+        for (size_t i = 0; i < seq_len; i++) ids[i] = corpus_tokens[i % corpus_tokens.size()];
+
+        Json entry;
+        entry["seq_len"] = seq_len;
+        entry["prefill_ms"] = time_ms(repeat, [&] { engine.forward(ids); });
+
+        if (engine.supports_kv_cache()) {
+            KVCache cache;
+            if (!engine.forward(ids, cache)) {
+                std::cerr << "Forward pass failed at seq_len " << seq_len << std::endl;
+                continue;
+            }
+            std::vector<int64_t> step = {ids.back()};
+            entry["decode_ms"] = time_ms(repeat, [&] { engine.forward(step, cache); });
+        }
+
+        std::cout << "forward: seq_len " << seq_len << " prefill " << entry["prefill_ms"].get<double>() << " ms";
+        if (entry.contains("decode_ms")) {
+            std::cout << ", decode step " << entry["decode_ms"].get<double>() << " ms";
+        }
+        std::cout << std::endl;
+        result.push_back(entry);
+    }
+    return result;
+}
+
+// Greedy generation from a prompt of corpus tokens, EOS disabled so every
+// run emits gen_tokens tokens: time to first token and decode tokens/s
+Json bench_generation(InferenceEngine& engine, TextGenerator& generator, const std::vector<int>& corpus_tokens,
+                      size_t prompt_tokens, int gen_tokens, int repeat) {
+    std::vector<int64_t> prompt(prompt_tokens);
+    for (size_t i = 0; i < prompt_tokens; i++) prompt[i] = corpus_tokens[i % corpus_tokens.size()];
+
+    GenerationConfig config;
+    config.temperature = 0.0f;
+    config.eos_token_id = -1;
+
+    std::vector<double> ttft, tokens_per_second;
+    for (int run = 0; run <= repeat; run++) {
+        KVCache cache;
+        bool use_cache = engine.supports_kv_cache();
+        std::vector<int64_t> sequence = prompt;
+        std::vector<int64_t> step_ids = prompt;
+
+        auto start = Clock::now();
+        Clock::time_point first_token;
+        for (int i = 0; i < gen_tokens; i++) {
+            bool ok = use_cache ? engine.forward(step_ids, cache) : engine.forward(sequence);
+            if (!ok) {
+                std::cerr << "Forward pass failed during generation" << std::endl;
+                return Json();
+            }
+            int next_token = generator.sample_next(engine.last_logits(0), config);
+            sequence.push_back(next_token);
+            step_ids.assign(1, next_token);
+            if (i == 0) first_token = Clock::now();
+        }
+        auto end = Clock::now();
+
+        if (run == 0) continue;  // Warm-up
+        ttft.push_back(elapsed_ms(start, first_token));
+        if (gen_tokens > 1) {
+            tokens_per_second.push_back((gen_tokens - 1) / (elapsed_ms(first_token, end) / 1000.0));
+        }
+    }
+
+    Json result;
+    result["prompt_tokens"] = prompt_tokens;
+    result["generated_tokens"] = gen_tokens;
+    result["ttft_ms"] = median(ttft);
+    result["tokens_per_s"] = median(tokens_per_second);
+
+    std::cout << "generation: " << prompt_tokens << " prompt tokens, ttft " << result["ttft_ms"].get<double>()
+              << " ms, " << result["tokens_per_s"].get<double>() << " tokens/s" << std::endl;
+    return result;
+}
+
+// Compiler that built the suite, recorded so results can be compared
+// across builds
+std::string compiler_version() {
+#if defined(__VERSION__)
+    return __VERSION__;
+#elif defined(_MSC_VER)
+    return "MSVC " + std::to_string(_MSC_FULL_VER);
+#else
+    return "unknown";
+#endif
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    std::string model_dir = "bench_model";
+    std::string model_path, vocab_path, merges_path;
+    std::string json_path = "bench_results.json";
+    int repeat = 5;
+    std::vector<size_t> seq_lens = {16, 64, 256};
+    size_t prompt_tokens = 32;
+    int gen_tokens = 64;
+    size_t sampler_vocab = 50257;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--model-dir" && i + 1 < argc) {
+            model_dir = argv[++i];
+        } else if (arg == "--model" && i + 1 < argc) {
+            model_path = argv[++i];
+        } else if (arg == "--vocab" && i + 1 < argc) {
+            vocab_path = argv[++i];
+        } else if (arg == "--merges" && i + 1 < argc) {
+            merges_path = argv[++i];
+        } else if (arg == "--json" && i + 1 < argc) {
+            json_path = argv[++i];
+        } else if (arg == "--repeat" && i + 1 < argc) {
+            repeat = std::stoi(argv[++i]);
+        } else if (arg == "--seq-lens" && i + 1 < argc) {
+            seq_lens = parse_list(argv[++i]);
+        } else if (arg == "--prompt-tokens" && i + 1 < argc) {
+            prompt_tokens = static_cast<size_t>(std::stoul(argv[++i]));
+        } else if (arg == "--gen-tokens" && i + 1 < argc) {
+            gen_tokens = std::stoi(argv[++i]);
+        } else if (arg == "--sampler-vocab" && i + 1 < argc) {
+            sampler_vocab = static_cast<size_t>(std::stoul(argv[++i]));
+        }
+    }
+    if (model_path.empty()) model_path = model_dir + "/onnx/decoder_model_merged.onnx";
+    if (vocab_path.empty()) vocab_path = model_dir + "/vocab.json";
+    if (merges_path.empty()) merges_path = model_dir + "/merges.txt";
+    if (repeat <= 0 || gen_tokens <= 0 || prompt_tokens == 0 || sampler_vocab == 0) {
+        std::cerr << "--repeat, --gen-tokens, --prompt-tokens and --sampler-vocab must be positive" << std::endl;
+        return 1;
+    }
+
+    Tokenizer tokenizer;
+    if (!tokenizer.load(vocab_path, merges_path)) {
+        std::cerr << "Failed to load tokenizer (run tools/make_bench_model.py or pass --vocab/--merges)" << std::endl;
+        return 1;
+    }
+
+    InferenceEngine engine;
+    if (!engine.load_model(model_path)) {
+        std::cerr << "Failed to load model" << std::endl;
+        return 1;
+    }
+    TextGenerator generator(engine, tokenizer);
+    std::cout << std::endl;
+
+    std::vector<int> corpus_tokens = tokenizer.encode(kCorpus);
+
+    Json results;
+    results["config"] = {
+        {"model", model_path},
+        {"vocab", vocab_path},
+        {"repeat", repeat},
+        {"onnxruntime", Ort::GetVersionString()},
+        {"compiler", compiler_version()},
+#ifdef NDEBUG
+        {"assertions", false},
+#else
+        {"assertions", true},
+#endif
+    };
+    results["tokenizer"] = bench_tokenizer(tokenizer, repeat);
+    results["sampler"] = bench_sampler(generator, sampler_vocab, repeat);
+    results["forward"] = bench_forward(engine, corpus_tokens, seq_lens, repeat);
+    results["generation"] = bench_generation(engine, generator, corpus_tokens, prompt_tokens, gen_tokens, repeat);
+
+    std::ofstream out(json_path);
+    if (!out.is_open()) {
+        std::cerr << "Failed to write " << json_path << std::endl;
+        return 1;
+    }
+    out << results.dump(2) << std::endl;
+    std::cout << "Wrote " << json_path << std::endl;
+    return 0;
+}
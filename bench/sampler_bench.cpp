@@ -0,0 +1,268 @@
+// Measures per-step sampling cost of Sampler against the previous
+// sort-based implementation, on synthetic GPT-2 sized logit rows.
+//
+// Usage: sampler_bench [--vocab-size <n>] [--steps <n>] [--top-k <n>]
+//                      [--top-p <p>] [--temperature <t>]
+
+#include "logits_processor.h"
+#include "sampler.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <numeric>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+// The sampling code TextGenerator used before Sampler, kept for comparison
+class LegacySampler {
+public:
+    explicit LegacySampler(unsigned int seed) : rng_(seed) {}
+
+    int sample_greedy(const std::vector<float>& logits) {
+        auto max_it = std::max_element(logits.begin(), logits.end());
+        return static_cast<int>(std::distance(logits.begin(), max_it));
+    }
+
+    int sample_with_temperature(const std::vector<float>& logits, float temperature) {
+        auto probs = softmax(logits, temperature);
+        std::discrete_distribution<int> dist(probs.begin(), probs.end());
+        return dist(rng_);
+    }
+
+    int sample_top_k(const std::vector<float>& logits, int k, float temperature) {
+        std::vector<int> indices(logits.size());
+        std::iota(indices.begin(), indices.end(), 0);
+        std::partial_sort(indices.begin(), indices.begin() + k, indices.end(),
+            [&logits](int a, int b) { return logits[a] > logits[b]; });
+
+        std::vector<float> top_k_logits(k);
+        for (int i = 0; i < k; i++) {
+            top_k_logits[i] = logits[indices[i]];
+        }
+
+        auto probs = softmax(top_k_logits, temperature);
+        std::discrete_distribution<int> dist(probs.begin(), probs.end());
+        return indices[dist(rng_)];
+    }
+
+    int sample_top_p(const std::vector<float>& logits, float p, float temperature) {
+        auto probs = softmax(logits, temperature);
+
+        std::vector<int> indices(probs.size());
+        std::iota(indices.begin(), indices.end(), 0);
+        std::sort(indices.begin(), indices.end(),
+            [&probs](int a, int b) { return probs[a] > probs[b]; });
+
+        float cumsum = 0.0f;
+        size_t nucleus_size = 0;
+        for (size_t i = 0; i < indices.size(); i++) {
+            cumsum += probs[indices[i]];
+            nucleus_size++;
+            if (cumsum >= p) break;
+        }
+
+        std::vector<float> nucleus_probs(nucleus_size);
+        float nucleus_sum = 0.0f;
+        for (size_t i = 0; i < nucleus_size; i++) {
+            nucleus_probs[i] = probs[indices[i]];
+            nucleus_sum += nucleus_probs[i];
+        }
+        for (size_t i = 0; i < nucleus_size; i++) {
+            nucleus_probs[i] /= nucleus_sum;
+        }
+
+        std::discrete_distribution<int> dist(nucleus_probs.begin(), nucleus_probs.end());
+        return indices[dist(rng_)];
+    }
+
+private:
+    std::mt19937 rng_;
+
+    std::vector<float> softmax(const std::vector<float>& logits, float temperature) {
+        std::vector<float> probs(logits.size());
+        float max_logit = *std::max_element(logits.begin(), logits.end());
+        float sum = 0.0f;
+        for (size_t i = 0; i < logits.size(); i++) {
+            probs[i] = std::exp((logits[i] - max_logit) / temperature);
+            sum += probs[i];
+        }
+        for (size_t i = 0; i < probs.size(); i++) {
+            probs[i] /= sum;
+        }
+        return probs;
+    }
+};
+
+// Logit rows shaped roughly like a language model's: a broad normal bulk and
+// a few dozen tokens well above it
+std::vector<std::vector<float>> make_rows(size_t num_rows, size_t vocab_size) {
+    std::mt19937 rng(1234);
+    std::normal_distribution<float> bulk(-2.0f, 2.5f);
+    std::uniform_int_distribution<size_t> pick(0, vocab_size - 1);
+    std::uniform_real_distribution<float> boost(4.0f, 12.0f);
+
+    std::vector<std::vector<float>> rows(num_rows, std::vector<float>(vocab_size));
+    for (auto& row : rows) {
+        for (float& x : row) x = bulk(rng);
+        for (int i = 0; i < 40; i++) row[pick(rng)] += boost(rng);
+    }
+    return rows;
+}
+
+// Average microseconds per call of fn over steps calls, cycling through rows
+double time_per_step(const std::vector<std::vector<float>>& rows, int steps,
+                     const std::function<int(const std::vector<float>&)>& fn) {
+    volatile int sink = 0;
+    for (size_t i = 0; i < rows.size(); i++) sink = sink + fn(rows[i]);  // Warm-up
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < steps; i++) {
+        sink = sink + fn(rows[i % rows.size()]);
+    }
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::micro>(end - start).count() / steps;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    size_t vocab_size = 50257;
+    int steps = 2000;
+    int top_k = 50;
+    float top_p = 0.9f;
+    float temperature = 1.0f;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--vocab-size" && i + 1 < argc) {
+            vocab_size = std::stoul(argv[++i]);
+        } else if (arg == "--steps" && i + 1 < argc) {
+            steps = std::stoi(argv[++i]);
+        } else if (arg == "--top-k" && i + 1 < argc) {
+            top_k = std::stoi(argv[++i]);
+        } else if (arg == "--top-p" && i + 1 < argc) {
+            top_p = std::stof(argv[++i]);
+        } else if (arg == "--temperature" && i + 1 < argc) {
+            temperature = std::stof(argv[++i]);
+        }
+    }
+    if (vocab_size == 0 || steps <= 0) {
+        std::cerr << "--vocab-size and --steps must be positive" << std::endl;
+        return 1;
+    }
+
+    auto rows = make_rows(64, vocab_size);
+    LegacySampler legacy(42);
+    Sampler sampler(42);
+    size_t n = vocab_size;
+
+    // Constrained decoding: about a third of the vocabulary allowed, as a
+    // per-token flag the way a caller without bitsets would hold it, and as
+    // the bitset TokenConstraint keeps
+    std::vector<bool> allowed_flags(n);
+    std::vector<uint64_t> allowed_bits((n + 63) / 64, 0);
+    std::mt19937 mask_rng(99);
+    for (size_t i = 0; i < n; i++) {
+        allowed_flags[i] = mask_rng() % 3 == 0;
+        if (allowed_flags[i]) allowed_bits[i / 64] |= 1ull << (i % 64);
+    }
+    std::vector<float> masked(n);
+
+    // Penalties over a 256-token history: the per-step way is a count per
+    // vocabulary entry and a pass over all of them; the processors visit only
+    // the distinct tokens seen
+    const float repetition_penalty = 1.2f;
+    const float frequency_penalty = 0.5f;
+    std::vector<int64_t> prompt(256);
+    for (auto& token : prompt) token = static_cast<int64_t>(mask_rng() % n);
+    TokenHistory history(std::vector<int64_t>(prompt.begin(), prompt.begin() + 128));
+    for (size_t i = 128; i < prompt.size(); i++) history.push_back(static_cast<int>(prompt[i]));
+    LogitsProcessorChain penalties;
+    penalties.add(std::make_shared<RepetitionPenalty>(repetition_penalty));
+    penalties.add(std::make_shared<PresenceFrequencyPenalty>(0.0f, frequency_penalty));
+
+    struct Case {
+        std::string name;
+        std::function<int(const std::vector<float>&)> legacy;
+        std::function<int(const std::vector<float>&)> current;
+    };
+    std::vector<Case> cases = {
+        {"greedy",
+         [&](const std::vector<float>& l) { return legacy.sample_greedy(l); },
+         [&](const std::vector<float>& l) { return sampler.sample_greedy(l.data(), n); }},
+        {"temperature",
+         [&](const std::vector<float>& l) { return legacy.sample_with_temperature(l, temperature); },
+         [&](const std::vector<float>& l) { return sampler.sample_with_temperature(l.data(), n, temperature); }},
+        {"top-k " + std::to_string(top_k),
+         [&](const std::vector<float>& l) { return legacy.sample_top_k(l, top_k, temperature); },
+         [&](const std::vector<float>& l) { return sampler.sample_top_k(l.data(), n, top_k, temperature); }},
+        {"top-p " + std::to_string(top_p).substr(0, 4),
+         [&](const std::vector<float>& l) { return legacy.sample_top_p(l, top_p, temperature); },
+         [&](const std::vector<float>& l) { return sampler.sample_top_p(l.data(), n, top_p, temperature); }},
+        {"masked top-k",
+         [&](const std::vector<float>& l) {
+             std::vector<float> copy(l);
+             for (size_t i = 0; i < n; i++) {
+                 if (!allowed_flags[i]) copy[i] = -std::numeric_limits<float>::infinity();
+             }
+             return legacy.sample_top_k(copy, top_k, temperature);
+         },
+         [&](const std::vector<float>& l) {
+             // The engine's buffer is processed in place; the bench rows are
+             // reused, so work on a copy
+             std::copy(l.begin(), l.end(), masked.begin());
+             float max = sampler_kernels::prepare_logits(masked.data(), n, 1.0f / temperature, allowed_bits.data(),
+                                                         nullptr);
+             return sampler.sample_prepared(masked.data(), n, max, 0.0f, false, top_k, 1.0f);
+         }},
+        {"penalties",
+         [&](const std::vector<float>& l) {
+             std::vector<float> copy(l);
+             std::vector<int> seen(n, 0);
+             std::vector<int> generated(n, 0);
+             for (size_t i = 0; i < prompt.size(); i++) {
+                 seen[prompt[i]] = 1;
+                 if (i >= 128) generated[prompt[i]]++;
+             }
+             for (size_t i = 0; i < n; i++) {
+                 if (seen[i]) copy[i] = copy[i] > 0.0f ? copy[i] / repetition_penalty : copy[i] * repetition_penalty;
+                 copy[i] -= frequency_penalty * static_cast<float>(generated[i]);
+             }
+             return legacy.sample_with_temperature(copy, temperature);
+         },
+         [&](const std::vector<float>& l) {
+             std::copy(l.begin(), l.end(), masked.begin());
+             penalties.apply(masked.data(), n, history);
+             float sum;
+             float max = sampler_kernels::prepare_logits(masked.data(), n, 1.0f / temperature, nullptr, &sum);
+             return sampler.sample_prepared(masked.data(), n, max, sum, false, 0, 1.0f);
+         }},
+    };
+
+    std::cout << "Vocab size: " << vocab_size << ", steps: " << steps
+              << ", kernels: " << sampler_kernels::isa_name() << std::endl;
+    std::cout << std::left << std::setw(14) << "method"
+              << std::right << std::setw(14) << "legacy us"
+              << std::setw(14) << "sampler us"
+              << std::setw(10) << "speedup" << std::endl;
+    std::cout << std::fixed << std::setprecision(2);
+
+    for (const auto& c : cases) {
+        double legacy_us = time_per_step(rows, steps, c.legacy);
+        double current_us = time_per_step(rows, steps, c.current);
+        std::cout << std::left << std::setw(14) << c.name
+                  << std::right << std::setw(14) << legacy_us
+                  << std::setw(14) << current_us
+                  << std::setw(9) << legacy_us / current_us << "x" << std::endl;
+    }
+
+    return 0;
+}
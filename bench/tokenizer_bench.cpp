@@ -0,0 +1,147 @@
+// Measures pre-tokenizer and Tokenizer::encode throughput (MB/s and tokens/s),
+// and Tokenizer::encode_batch over the corpus lines at 1, 2, 4, ... threads.
+//
+// Usage: tokenizer_bench [--vocab <path>] [--merges <path>] [--corpus <file>]
+//                        [--iterations <n>] [--cache <n>] [--threads <n>]
+
+#include "pre_tokenizer.h"
+#include "tokenizer.h"
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+// Used when no corpus file is given: mixed prose, numbers and punctuation
+const char* kDefaultText =
+    "The quick brown fox jumps over the lazy dog. It's 3:45pm and we've "
+    "already processed 1,234,567 requests today -- that's roughly 89% of "
+    "yesterday's load. Tokenizers split text like this into words, numbers "
+    "and punctuation before applying byte-pair merges to each piece.\n";
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    std::string vocab_path = "models/gpt2/vocab.json";
+    std::string merges_path = "models/gpt2/merges.txt";
+    std::string corpus_path;
+    int iterations = 5;
+    long long cache_capacity = -1;
+    size_t max_threads = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--vocab" && i + 1 < argc) {
+            vocab_path = argv[++i];
+        } else if (arg == "--merges" && i + 1 < argc) {
+            merges_path = argv[++i];
+        } else if (arg == "--corpus" && i + 1 < argc) {
+            corpus_path = argv[++i];
+        } else if (arg == "--iterations" && i + 1 < argc) {
+            iterations = std::stoi(argv[++i]);
+        } else if (arg == "--cache" && i + 1 < argc) {
+            cache_capacity = std::stoll(argv[++i]);
+        } else if (arg == "--threads" && i + 1 < argc) {
+            max_threads = std::max<size_t>(std::stoul(argv[++i]), 1);
+        }
+    }
+
+    Tokenizer tokenizer;
+    if (!tokenizer.load(vocab_path, merges_path)) {
+        std::cerr << "Failed to load tokenizer" << std::endl;
+        return 1;
+    }
+    if (cache_capacity >= 0) {
+        tokenizer.set_cache_capacity(static_cast<size_t>(cache_capacity));
+    }
+
+    std::string text;
+    if (!corpus_path.empty()) {
+        std::ifstream corpus_file(corpus_path, std::ios::binary);
+        if (!corpus_file.is_open()) {
+            std::cerr << "Failed to open corpus file: " << corpus_path << std::endl;
+            return 1;
+        }
+        std::stringstream buffer;
+        buffer << corpus_file.rdbuf();
+        text = buffer.str();
+    } else {
+        for (int i = 0; i < 4096; i++) text += kDefaultText;
+    }
+
+    // Pre-tokenization alone
+    size_t num_words = 0;
+    auto split_start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) {
+        PreTokenizer words(text);
+        std::string_view word;
+        num_words = 0;
+        while (words.next(word)) num_words++;
+    }
+    auto split_end = std::chrono::steady_clock::now();
+    double split_seconds = std::chrono::duration<double>(split_end - split_start).count() / iterations;
+
+    // Warm-up pass, then timed passes
+    size_t num_tokens = tokenizer.encode(text).size();
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) {
+        num_tokens = tokenizer.encode(text).size();
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    double seconds = std::chrono::duration<double>(end - start).count() / iterations;
+    double megabytes = static_cast<double>(text.size()) / (1024.0 * 1024.0);
+
+    std::cout << std::fixed << std::setprecision(2);
+    std::cout << "Corpus: " << text.size() << " bytes, " << num_tokens << " tokens" << std::endl;
+    std::cout << "Split:  " << split_seconds * 1000.0 << " ms, "
+              << megabytes / split_seconds << " MB/s, "
+              << num_words << " words" << std::endl;
+    std::cout << "Encode: " << seconds * 1000.0 << " ms, "
+              << megabytes / seconds << " MB/s, "
+              << num_tokens / seconds << " tokens/s" << std::endl;
+
+    // Batch encoding, one document per line
+    std::vector<std::string_view> documents;
+    for (size_t begin = 0; begin < text.size();) {
+        size_t end = text.find('\n', begin);
+        end = end == std::string::npos ? text.size() : end + 1;
+        documents.push_back(std::string_view(text).substr(begin, end - begin));
+        begin = end;
+    }
+
+    double single_thread_seconds = 0.0;
+    for (size_t threads = 1;; threads = std::min(threads * 2, max_threads)) {
+        ThreadPool pool(threads);
+        tokenizer.encode_batch(documents, pool);
+
+        auto batch_start = std::chrono::steady_clock::now();
+        for (int i = 0; i < iterations; i++) {
+            tokenizer.encode_batch(documents, pool);
+        }
+        auto batch_end = std::chrono::steady_clock::now();
+        double batch_seconds = std::chrono::duration<double>(batch_end - batch_start).count() / iterations;
+        if (threads == 1) single_thread_seconds = batch_seconds;
+
+        std::cout << "Batch encode, " << threads << " thread" << (threads == 1 ? ": " : "s: ")
+                  << batch_seconds * 1000.0 << " ms, "
+                  << megabytes / batch_seconds << " MB/s, "
+                  << single_thread_seconds / batch_seconds << "x ("
+                  << documents.size() << " documents)" << std::endl;
+        if (threads == max_threads) break;
+    }
+
+    auto stats = tokenizer.cache_stats();
+    uint64_t lookups = stats.hits + stats.misses;
+    std::cout << "BPE cache: " << stats.size << "/" << stats.capacity << " words, "
+              << (lookups ? 100.0 * stats.hits / lookups : 0.0) << "% hit rate" << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "kv_cache.h"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Past keys/values of beam search hypotheses, shared copy-on-write. A beam is
+// a chain of segments back to the prompt; beams forked from one parent share
+// every segment up to the fork, and a segment is only appended to in place
+// while a single beam holds it. Each beam therefore owns just the positions
+// it added since it last forked, and the prompt is stored once.
+//
+// The model takes dense past tensors, so gather() lays the beams out as an
+// ordinary batch for each forward pass.
+class BeamCache {
+public:
+    struct Segment;
+    using Beam = std::shared_ptr<Segment>;
+
+    BeamCache();
+    ~BeamCache();
+
+    // Beam holding a prefilled single-row cache without padding (the prompt)
+    Beam start(const KVCache& prompt);
+
+    // One row per beam, in order, ready to be fed to forward(); the beams
+    // must all hold the same number of positions
+    KVCache gather(const std::vector<Beam>& beams) const;
+
+    // Append the newest position of a row of cache (a forward() output) to
+    // beam; in place if beam is the only handle on its last segment, in a new
+    // segment otherwise. Pass the caller's handle by move.
+    Beam extend(Beam beam, const KVCache& cache, size_t row) const;
+
+    // Positions held by a beam
+    static int64_t length(const Beam& beam);
+
+    // Bytes of past keys/values held by beams, each shared segment once
+    size_t bytes(const std::vector<Beam>& beams) const;
+
+    // Bytes of a single position (all layers, keys and values)
+    size_t position_bytes() const;
+
+private:
+    size_t num_tensors_ = 0;
+    int64_t num_heads_ = 0;
+    int64_t head_dim_ = 0;
+};
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Bounded, thread-safe LRU cache from a pre-tokenized word to its BPE token
+// IDs. Entries are spread over independently locked shards so concurrent
+// encoders rarely contend on the same mutex.
+class BpeCache {
+public:
+    struct Stats {
+        uint64_t hits;
+        uint64_t misses;
+        size_t size;
+        size_t capacity;
+    };
+
+    explicit BpeCache(size_t capacity);
+
+    // Append the cached token IDs for word to token_ids; false on a miss
+    bool lookup(std::string_view word, std::vector<int>& token_ids);
+
+    void insert(std::string_view word, const int* token_ids, size_t count);
+
+    // Change the total number of cached words (0 disables the cache)
+    void set_capacity(size_t capacity);
+    size_t capacity() const { return shard_capacity_.load(std::memory_order_relaxed) * kNumShards; }
+
+    void clear();
+    Stats stats() const;
+
+private:
+    static constexpr size_t kNumShards = 16;
+
+    struct Entry {
+        std::string word;
+        std::vector<int> token_ids;
+    };
+
+    struct Shard {
+        mutable std::mutex mutex;
+        std::list<Entry> entries;  // Most recently used first
+        // Keys view the word stored in the list node, which never moves
+        std::unordered_map<std::string_view, std::list<Entry>::iterator> index;
+    };
+
+    std::array<Shard, kNumShards> shards_;
+    std::atomic<size_t> shard_capacity_;
+    std::atomic<uint64_t> hits_{0};
+    std::atomic<uint64_t> misses_{0};
+
+    Shard& shard_for(std::string_view word);
+    static void evict_to(Shard& shard, size_t capacity);
+};
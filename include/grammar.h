@@ -0,0 +1,114 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Deterministic automaton over bytes, used to constrain generated text.
+// States are small integers numbered as they are first reached, so callers
+// can key per-state tables on them; transitions are computed on demand and
+// cached. Not thread-safe.
+class ByteAutomaton {
+public:
+    static constexpr int kReject = -1;
+
+    virtual ~ByteAutomaton() = default;
+
+    virtual int start() = 0;
+
+    // State after reading byte in state, or kReject
+    virtual int step(int state, uint8_t byte) = 0;
+
+    // True if the text read to reach state is complete
+    virtual bool accepting(int state) = 0;
+
+    // States numbered so far
+    virtual size_t num_states() const = 0;
+};
+
+// Full match of a regular expression. Supported: literals, ., character
+// classes ([a-z], [^"], \d \w \s and their negations), escapes (\n \t \r
+// \xHH and escaped metacharacters), groups ((...) and (?:...)), | and the
+// quantifiers * + ? {n} {n,} {n,m}. The pattern is always anchored at both
+// ends; a leading ^ or trailing $ is accepted and ignored. Classes and . match
+// single bytes, so non-ASCII characters are only matched as literals.
+class RegexAutomaton : public ByteAutomaton {
+public:
+    // Throws std::invalid_argument if the pattern is malformed or too large
+    explicit RegexAutomaton(const std::string& pattern);
+
+    int start() override { return 0; }
+    int step(int state, uint8_t byte) override;
+    bool accepting(int state) override { return dfa_accepting_[state]; }
+    size_t num_states() const override { return dfa_.size(); }
+
+private:
+    // Thompson NFA: a state either matches one byte from a set and moves to
+    // next, or has up to two epsilon transitions
+    struct NfaState {
+        std::array<uint64_t, 4> bytes{};  // Bitset; empty for epsilon states
+        int next = -1;
+        int epsilon[2] = {-1, -1};
+    };
+    std::vector<NfaState> nfa_;
+    int nfa_accept_ = -1;
+
+    // Subset construction, one DFA state per set of NFA states reached
+    static constexpr int kUnknown = -2;
+    std::vector<std::vector<int>> dfa_;         // Sorted NFA states of each DFA state
+    std::vector<std::array<int, 256>> dfa_next_;
+    std::vector<bool> dfa_accepting_;
+    std::unordered_map<std::string, int> dfa_ids_;
+
+    class Parser;
+
+    // DFA state of the epsilon closure of states
+    int intern(std::vector<int> states);
+};
+
+// Well-formed JSON (RFC 8259): a single value with optional surrounding
+// whitespace inside containers, nothing after it. Strings must be valid
+// UTF-8 without raw control characters. Nesting is limited to max_depth so
+// the number of states stays finite. With object_only the value must be an
+// object.
+class JsonAutomaton : public ByteAutomaton {
+public:
+    explicit JsonAutomaton(size_t max_depth = 32, bool object_only = false);
+
+    int start() override { return 0; }
+    int step(int state, uint8_t byte) override;
+    bool accepting(int state) override;
+    size_t num_states() const override { return states_.size(); }
+
+private:
+    enum class Mode : uint8_t;
+
+    // Lexer mode, a mode-specific counter (UTF-8 continuation bytes or \u
+    // digits left, or literal and position) and the open containers, '{' or
+    // '[' each, innermost last
+    struct State {
+        Mode mode;
+        uint8_t aux;
+        bool key;  // In or after an object key rather than a value
+        std::string stack;
+    };
+
+    size_t max_depth_;
+    bool object_only_;
+
+    static constexpr int kUnknown = -2;
+    std::vector<State> states_;
+    std::vector<std::array<int, 256>> next_;
+    std::unordered_map<std::string, int> ids_;
+
+    int intern(const State& state);
+
+    // Transition of an interned state, uncached
+    int transition(int id, uint8_t byte);
+
+    // State once a value has ended, in a container or at the top level
+    State after_value(std::string stack) const;
+};
@@ -1,28 +1,128 @@
 #pragma once
 
+#include "kv_cache.h"
+#include "shared_model.h"
 #include <string>
 #include <vector>
 #include <memory>
 #include <onnxruntime_cxx_api.h>
 
+// Read-only view of the logits at one position, owned by the engine and
+// valid until its next forward call
+struct LogitsView {
+    const float* data = nullptr;
+    size_t size = 0;
+
+    bool empty() const { return size == 0; }
+    const float* begin() const { return data; }
+    const float* end() const { return data + size; }
+    float operator[](size_t i) const { return data[i]; }
+};
+
+// ONNX Runtime session and threading settings. Thread counts of 0 let ONNX
+// Runtime pick (one intra-op thread per physical core).
+struct EngineOptions {
+    int intra_op_threads = 0;
+    int inter_op_threads = 0;        // Only used with parallel_execution
+    bool parallel_execution = false;  // Run independent graph nodes concurrently
+    GraphOptimizationLevel optimization_level = ORT_ENABLE_ALL;
+
+    // Let idle pool threads busy-wait for work: lower latency per op, but the
+    // cores stay at 100% between steps
+    bool allow_spinning = true;
+
+    // Intra-op thread affinities in ONNX Runtime's format: one entry per
+    // thread except the calling one, ';'-separated, each a list or range of
+    // 1-based logical processors, e.g. "2;3;4" or "1-8;9-16"
+    std::string intra_op_affinity;
+
+    // Linux: pin the calling thread and one intra-op thread per CPU to this
+    // NUMA node's CPUs (-1 = no pinning). Ignored if intra_op_affinity is set.
+    int numa_node = -1;
+
+    // Run every session in the process on one pair of thread pools owned by
+    // the shared Ort::Env, instead of per-session pools. The pools are sized
+    // by the first engine created with this option.
+    bool global_thread_pool = false;
+
+    // Directory for optimized graphs. The first load of a model writes its
+    // optimized graph here; later loads with the same model bytes, ONNX
+    // Runtime version, optimization settings and CPU read it back with
+    // optimizations disabled. Empty = always optimize at load.
+    std::string optimized_model_dir;
+
+    // Run a short prefill and one decode step at load so the first request
+    // does not pay for first-run allocations and kernel setup
+    bool warm_up = false;
+
+    // Record ONNX Runtime's per-operator profile to <prefix>_<timestamp>.json
+    // (Chrome trace format), written by end_profiling() or when the session
+    // closes. Empty = off; profiling adds overhead to every run.
+    std::string profile_prefix;
+};
+
+// Not thread-safe: input/output buffers are reused across forward calls, so
+// one caller at a time
 class InferenceEngine {
 public:
-    InferenceEngine();
+    explicit InferenceEngine(const EngineOptions& options = EngineOptions());
     ~InferenceEngine();
 
     bool load_model(const std::string& model_path);
 
-    // Run a single forward pass
+    // Load a model mapped once and shared with other engines: weights and
+    // prepacked kernels are shared, so each extra engine costs its
+    // activations rather than another copy of the model
+    bool load_model(std::shared_ptr<SharedModel> model);
+
+    // Run a single forward pass over the full sequence (no cache)
     // input_ids: [1, seq_len] - token IDs
-    // Returns: logits [1, seq_len, vocab_size]
-    std::vector<float> forward(const std::vector<int64_t>& input_ids, bool use_cache = false);
+    // Returns: false on error; logits [1, seq_len, vocab_size] are read with logits()
+    bool forward(const std::vector<int64_t>& input_ids);
+
+    // Run an incremental forward pass
+    // input_ids: [1, new_len] - only the tokens not yet in the cache
+    // cache: past keys/values, updated in place with the new positions
+    // Returns: false on error; logits [1, new_len, vocab_size]
+    bool forward(const std::vector<int64_t>& input_ids, KVCache& cache);
+
+    // Run an incremental forward pass over a batch of sequences
+    // input_ids: [batch_size, new_len] row-major, left padded
+    // attention_mask: [batch_size, new_len] - 1 for real tokens, 0 for padding
+    // cache: past keys/values and mask for all rows, updated in place
+    // Returns: false on error; logits [batch_size, new_len, vocab_size]
+    bool forward(const std::vector<int64_t>& input_ids,
+                 const std::vector<int64_t>& attention_mask,
+                 size_t batch_size,
+                 KVCache& cache);
+
+    // Logits of the last successful forward pass for one batch row at one of
+    // the positions it fed (0 .. new_len - 1); empty if out of range
+    LogitsView logits(size_t batch_index, size_t position) const;
+
+    // Logits at the last fed position of a row, i.e. for the next token
+    LogitsView last_logits(size_t batch_index) const;
+
+    // The same get_vocab_size() floats, writable so processing before
+    // sampling needs no copy; nullptr if out of range
+    float* mutable_last_logits(size_t batch_index);
+
+    // True if the model exposes past_key_values.* inputs and present.* outputs
+    bool supports_kv_cache() const { return !past_names_.empty(); }
 
     int get_vocab_size() const { return vocab_size_; }
 
+    // Stop profiling and write the trace; returns its path, or empty if
+    // profiling is off or already ended
+    std::string end_profiling();
+
 private:
-    std::unique_ptr<Ort::Env> env_;
+    // Shared by every engine in the process; ONNX Runtime allows one Env
+    std::shared_ptr<Ort::Env> env_;
+    std::shared_ptr<SharedModel> shared_model_;  // Must outlive session_
     std::unique_ptr<Ort::Session> session_;
     std::unique_ptr<Ort::SessionOptions> session_options_;
+    EngineOptions options_;  // As resolved: NUMA pinning filled in thread count and affinity
     Ort::MemoryInfo memory_info_;
 
     // Model metadata
@@ -30,6 +130,43 @@ private:
     std::vector<std::string> input_names_;
     std::vector<std::string> output_names_;
 
+    // KV cache metadata (empty for models exported without past)
+    std::vector<std::string> past_names_;     // past_key_values.{i}.key / .value
+    std::vector<std::string> present_names_;  // present.{i}.key / .value, same order
+    int64_t num_heads_;
+    int64_t head_dim_;
+    bool has_position_ids_;
+    bool has_use_cache_branch_;
+
+    // Backing storage for zero-length past tensors on the first step
+    float empty_past_;
+
+    // Reused across forward calls: logits are written straight into logits_
+    // through the binding, present.* outputs are allocated by ONNX Runtime and
+    // handed to the cache
+    std::unique_ptr<Ort::IoBinding> binding_;
+    std::vector<float> logits_;          // [logits_batch_, logits_len_, vocab_size]
+    size_t logits_batch_;
+    size_t logits_len_;
+    std::vector<int64_t> ones_;          // Attention mask of single-row calls
+    std::vector<int64_t> full_mask_;     // Cached mask followed by the new mask
+    std::vector<int64_t> position_ids_;
+    std::vector<int64_t> next_positions_;
+
+    bool profiling_;  // The current session records a profile not yet written
+
+    bool has_input(const std::string& name) const;
+
+    void create_session(const std::string& path, const Ort::SessionOptions& options);
+
+    // Read inputs/outputs of the new session, report the load and warm up
+    bool finish_load(double load_ms, const std::string& load_note);
+
+    // Cache file for a model's optimized graph, or empty if it cannot be hashed
+    std::string optimized_model_path(const std::string& model_path) const;
+
+    void warm_up();
+
     // Helper to get output shape
-    std::vector<int64_t> get_output_shape(size_t seq_len);
+    std::vector<int64_t> get_output_shape(size_t batch_size, size_t seq_len);
 };
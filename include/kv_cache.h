@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <onnxruntime_cxx_api.h>
+
+// Past key/value tensors for a batch of sequences, carried between forward
+// passes. Holds the model's present.* outputs from the previous step, which
+// the engine feeds back as past_key_values.* inputs on the next one.
+class KVCache {
+public:
+    KVCache() = default;
+    KVCache(KVCache&&) = default;
+    KVCache& operator=(KVCache&&) = default;
+
+    // Number of positions already held in the cache (including padding)
+    int64_t length() const { return length_; }
+    bool empty() const { return length_ == 0; }
+
+    size_t batch_size() const { return batch_size_; }
+
+    // Position id of row's next real token: how many real positions it holds
+    int64_t next_position(size_t row) const { return next_positions_[row]; }
+
+    // Attention mask over the cached positions: [batch, length]
+    const std::vector<int64_t>& attention_mask() const { return attention_mask_; }
+
+    void clear() {
+        tensors_.clear();
+        attention_mask_.clear();
+        next_positions_.clear();
+        batch_size_ = 0;
+        length_ = 0;
+    }
+
+    // Keep only the given rows, in the given order, and drop leading
+    // positions that are padding in every remaining row
+    void select_rows(const std::vector<size_t>& rows);
+
+    // Append the rows of another cache below these ones, left-padding
+    // whichever cache is shorter so both share one length
+    void append_rows(KVCache&& other);
+
+    // Drop the newest positions so that length remain, e.g. to roll back
+    // tokens a verifier rejected
+    void truncate(int64_t length);
+
+    // Positions of one row kept by evict(): its first sink real positions
+    // (attention sinks) and its latest recent ones
+    struct Retain {
+        int64_t sink;
+        int64_t recent;
+    };
+
+    // Drop every other position of each row, padding included, so the cache
+    // stays within the model's position limit however long a sequence runs.
+    // Rows stay right-aligned, and each row's next position id is re-based to
+    // the number of positions it kept. retain has one entry per row; returns
+    // the real positions dropped.
+    int64_t evict(const std::vector<Retain>& retain);
+
+    // Bytes held by the past key/value tensors
+    size_t bytes() const;
+
+    // Copy of positions [begin, end) of a single-row cache without padding
+    KVCache slice(int64_t begin, int64_t end) const;
+
+    // Single-row cache holding the positions of parts one after another;
+    // parts are single-row caches without padding from the same model
+    static KVCache concat(const std::vector<const KVCache*>& parts);
+
+private:
+    friend class InferenceEngine;
+    friend class BeamCache;
+
+    // One tensor per past_key_values.* input, in the engine's input order
+    // Each tensor is float [batch, num_heads, length, head_dim]
+    std::vector<Ort::Value> tensors_;
+    std::vector<int64_t> attention_mask_;
+    std::vector<int64_t> next_positions_;  // Position id of each row's next real token
+    size_t batch_size_ = 0;
+    int64_t length_ = 0;
+};
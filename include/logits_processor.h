@@ -0,0 +1,130 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Tokens of one sequence as the logits processors see them: the prompt, then
+// what has been generated, with each distinct token's generated count kept
+// alongside so penalties visit only tokens that occurred.
+class TokenHistory {
+public:
+    struct Entry {
+        int token;
+        uint32_t generated;  // Times generated; 0 if only in the prompt
+    };
+
+    TokenHistory() = default;
+    explicit TokenHistory(const std::vector<int64_t>& prompt);
+
+    // Record a generated token
+    void push_back(int token);
+
+    const std::vector<int>& tokens() const { return tokens_; }
+    size_t prompt_length() const { return prompt_length_; }
+    size_t generated() const { return tokens_.size() - prompt_length_; }
+
+    // Each token of tokens() once, in order of first occurrence
+    const std::vector<Entry>& distinct() const { return distinct_; }
+
+private:
+    std::vector<int> tokens_;
+    size_t prompt_length_ = 0;
+    std::vector<Entry> distinct_;
+    std::unordered_map<int, size_t> index_;  // Token -> position in distinct_
+
+    Entry& entry(int token);
+};
+
+// One step of adjusting a row of next-token logits before sampling. A
+// processor changes the row in place and touches only the tokens it is about,
+// so a chain of them costs time in proportion to those tokens rather than to
+// the vocabulary. The dense steps (temperature, constraint mask, softmax)
+// are not processors: they run afterwards in one fused pass, see
+// sampler_kernels::prepare_logits.
+//
+// Processors hold no per-sequence state, so one instance can serve every
+// sequence and thread.
+class LogitsProcessor {
+public:
+    virtual ~LogitsProcessor() = default;
+
+    virtual void apply(float* logits, size_t n, const TokenHistory& history) const = 0;
+};
+
+// Divide positive logits of tokens in the prompt or generated so far by
+// penalty and multiply negative ones by it (penalty > 1 discourages repeats)
+class RepetitionPenalty : public LogitsProcessor {
+public:
+    explicit RepetitionPenalty(float penalty) : penalty_(penalty) {}
+    void apply(float* logits, size_t n, const TokenHistory& history) const override;
+
+private:
+    float penalty_;
+};
+
+// Subtract presence once from the logit of every generated token and
+// frequency once per time it was generated
+class PresenceFrequencyPenalty : public LogitsProcessor {
+public:
+    PresenceFrequencyPenalty(float presence, float frequency) : presence_(presence), frequency_(frequency) {}
+    void apply(float* logits, size_t n, const TokenHistory& history) const override;
+
+private:
+    float presence_;
+    float frequency_;
+};
+
+// Add a fixed bias to the logits of some tokens (-infinity bans them)
+class LogitBias : public LogitsProcessor {
+public:
+    explicit LogitBias(std::vector<std::pair<int, float>> bias) : bias_(std::move(bias)) {}
+    void apply(float* logits, size_t n, const TokenHistory& history) const override;
+
+private:
+    std::vector<std::pair<int, float>> bias_;
+};
+
+// Ban EOS until min_length tokens have been generated
+class MinLength : public LogitsProcessor {
+public:
+    MinLength(size_t min_length, int eos_token_id) : min_length_(min_length), eos_token_id_(eos_token_id) {}
+    void apply(float* logits, size_t n, const TokenHistory& history) const override;
+
+private:
+    size_t min_length_;
+    int eos_token_id_;
+};
+
+// Never complete one of these token sequences: the last token of each is
+// banned whenever the text ends with the ones before it
+class BadWords : public LogitsProcessor {
+public:
+    explicit BadWords(const std::vector<std::vector<int>>& sequences);
+    void apply(float* logits, size_t n, const TokenHistory& history) const override;
+
+private:
+    std::vector<int> banned_;                    // Single-token sequences
+    std::vector<std::vector<int>> sequences_;    // Longer ones
+};
+
+// Processors run in order on the same row
+class LogitsProcessorChain {
+public:
+    void add(std::shared_ptr<const LogitsProcessor> processor) { processors_.push_back(std::move(processor)); }
+
+    bool empty() const { return processors_.empty(); }
+    size_t size() const { return processors_.size(); }
+
+    void apply(float* logits, size_t n, const TokenHistory& history) const {
+        for (const auto& processor : processors_) {
+            processor->apply(logits, n, history);
+        }
+    }
+
+private:
+    std::vector<std::shared_ptr<const LogitsProcessor>> processors_;
+};
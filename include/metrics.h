@@ -0,0 +1,126 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Latency histogram over fixed log-spaced buckets, four per power of two
+// (each about 19% wide) from 1 us to about 18 minutes. Recording is a few
+// relaxed atomic adds, so any thread can record without locking; readers see
+// a consistent-enough snapshot for monitoring.
+class Histogram {
+public:
+    static constexpr int kBucketsPerOctave = 4;
+    static constexpr int kNumBuckets = 30 * kBucketsPerOctave;
+
+    Histogram();
+
+    void record(double microseconds);
+
+    uint64_t count() const { return count_.load(std::memory_order_relaxed); }
+    double sum() const { return sum_ns_.load(std::memory_order_relaxed) / 1000.0; }  // us
+    double mean() const;
+
+    // Approximate value (us) below which a fraction q of samples fall,
+    // interpolated within the bucket holding it
+    double quantile(double q) const;
+
+    // Samples in bucket i; bucket i holds values up to bucket_bound(i) us and
+    // bucket kNumBuckets everything above the last bound
+    uint64_t bucket_count(int i) const { return buckets_[i].load(std::memory_order_relaxed); }
+    static double bucket_bound(int i);
+
+    void reset();
+
+private:
+    std::array<std::atomic<uint64_t>, kNumBuckets + 1> buckets_;
+    std::atomic<uint64_t> count_{0};
+    std::atomic<uint64_t> sum_ns_{0};
+};
+
+// Process-wide counters and latency histograms for the generation hot path.
+// TextGenerator, Scheduler and InferenceEngine record into global().
+class Metrics {
+public:
+    static Metrics& global();
+
+    // Stage latencies
+    Histogram tokenize;    // Tokenizer::encode of a prompt
+    Histogram prefill;     // First forward pass of a request or batch
+    Histogram decode;      // Each later forward pass
+    Histogram sample;      // Picking one token from its logits
+    Histogram detokenize;  // Turning one token into streamed text
+
+    // Per-request latencies
+    Histogram ttft;         // Request start to first generated token
+    Histogram inter_token;  // Between consecutive tokens of one request
+
+    std::atomic<uint64_t> requests{0};
+    std::atomic<uint64_t> prompt_tokens{0};
+    std::atomic<uint64_t> generated_tokens{0};
+    std::atomic<uint64_t> evicted_tokens{0};  // Context dropped to stay within the model's positions
+    std::atomic<int64_t> queue_depth{0};  // Requests waiting for admission
+    std::atomic<int64_t> running{0};      // Requests in the running batch
+
+    Metrics();
+
+    double uptime_seconds() const;
+
+    // Generated tokens per second of busy time (prefill, decode and sampling
+    // spans) since start or the last reset(), so idle periods do not drag
+    // it down
+    double tokens_per_second() const;
+
+    // Prometheus text exposition format (histograms in seconds)
+    std::string to_prometheus() const;
+
+    // JSON object with counters and per-histogram count/mean/p50/p90/p99 in ms
+    std::string to_json() const;
+
+    // Write to_json() if path ends in ".json", to_prometheus() otherwise
+    bool write(const std::string& path) const;
+
+    void reset();
+
+private:
+    std::atomic<int64_t> start_ns_;
+};
+
+// Records the time from construction to destruction into a histogram
+class Span {
+public:
+    explicit Span(Histogram& histogram)
+        : histogram_(histogram), start_(std::chrono::steady_clock::now()) {}
+    ~Span() {
+        histogram_.record(std::chrono::duration<double, std::micro>(
+            std::chrono::steady_clock::now() - start_).count());
+    }
+
+    Span(const Span&) = delete;
+    Span& operator=(const Span&) = delete;
+
+private:
+    Histogram& histogram_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+// Time to first token and inter-token latency of one request: construct when
+// the request starts and call token() as each generated token is produced
+class RequestTimer {
+public:
+    RequestTimer() : last_(std::chrono::steady_clock::now()) {}
+
+    void token();
+
+    void restart() {
+        last_ = std::chrono::steady_clock::now();
+        first_ = true;
+    }
+
+private:
+    std::chrono::steady_clock::time_point last_;
+    bool first_ = true;
+};
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <cstddef>
+#include <string_view>
+
+// Splits UTF-8 text into words with GPT-2's pre-tokenization pattern
+//   's|'t|'re|'ve|'m|'ll|'d| ?\p{L}+| ?\p{N}+| ?[^\s\p{L}\p{N}]+|\s+(?!\S)|\s+
+// in a single pass, without allocating: words are views into the input.
+class PreTokenizer {
+public:
+    explicit PreTokenizer(std::string_view text) : text_(text), pos_(0) {}
+
+    // Store the next word in word; returns false at the end of the text
+    bool next(std::string_view& word);
+
+private:
+    std::string_view text_;
+    size_t pos_;
+};
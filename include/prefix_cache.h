@@ -0,0 +1,74 @@
+#pragma once
+
+#include "kv_cache.h"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// Past keys/values of earlier prompts, keyed on their token IDs, so a new
+// prompt sharing a prefix with one seen before (a system prompt, a few-shot
+// template) only prefills the tokens after it. Stored as a radix tree: each
+// edge holds a run of tokens and the KV block for those positions, and a
+// lookup joins the blocks along the longest matching path. Least recently
+// used leaves are evicted to stay within a byte budget.
+//
+// Keys are plain token IDs, so use one cache per model. Thread-safe.
+class PrefixCache {
+public:
+    struct Stats {
+        uint64_t lookups;
+        uint64_t hits;             // Lookups that matched at least one token
+        uint64_t prompt_tokens;    // Tokens looked up
+        uint64_t reused_tokens;    // Tokens served from the cache (prefill saved)
+        uint64_t evictions;
+        size_t nodes;
+        size_t bytes;
+        size_t max_bytes;
+
+        double hit_rate() const { return lookups ? static_cast<double>(hits) / lookups : 0.0; }
+    };
+
+    explicit PrefixCache(size_t max_bytes);
+    ~PrefixCache();
+
+    // Set cache to the KV of the longest cached prefix of tokens and return
+    // its length (0 on a miss, leaving cache empty)
+    size_t lookup(const std::vector<int64_t>& tokens, KVCache& cache);
+
+    // Store the KV of tokens, held in the first tokens.size() positions of a
+    // single-row, unpadded cache
+    void insert(const std::vector<int64_t>& tokens, const KVCache& cache);
+
+    void clear();
+    Stats stats() const;
+
+private:
+    struct Node {
+        std::vector<int64_t> tokens;  // Edge label, empty only at the root
+        KVCache block;                // KV for the edge's positions
+        Node* parent = nullptr;
+        std::unordered_map<int64_t, std::unique_ptr<Node>> children;  // By first token
+        uint64_t last_used = 0;
+    };
+
+    mutable std::mutex mutex_;
+    std::unique_ptr<Node> root_;
+    size_t max_bytes_;
+    size_t bytes_ = 0;
+    size_t nodes_ = 0;
+    uint64_t clock_ = 0;
+    uint64_t lookups_ = 0;
+    uint64_t hits_ = 0;
+    uint64_t prompt_tokens_ = 0;
+    uint64_t reused_tokens_ = 0;
+    uint64_t evictions_ = 0;
+
+    // Split node's edge after its first length tokens; returns the new upper node
+    Node* split(Node* node, size_t length);
+
+    // Remove least recently used leaves until the cache fits its budget
+    void evict();
+};
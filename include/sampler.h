@@ -0,0 +1,115 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+// Vectorized reductions over a row of logits. Each call dispatches to an
+// AVX-512, AVX2 or scalar implementation picked once from the running CPU.
+namespace sampler_kernels {
+
+float max_value(const float* x, size_t n);
+
+size_t argmax(const float* x, size_t n);
+
+// out[i] = exp((x[i] - max) * scale); returns the sum of out
+float exp_sum(const float* x, float* out, size_t n, float max, float scale);
+
+// out[i] = bucket of x[i] among num_buckets equal buckets starting at lo,
+// each 1 / scale wide (values past the last bucket go in it), or -1 if x[i] < lo
+void bucketize(const float* x, int32_t* out, size_t n, float lo, float scale, int num_buckets);
+
+// Write the indices i with x[i] >= threshold to out, in order; returns how many
+size_t select_at_least(const float* x, size_t n, float threshold, int32_t* out);
+
+// The dense steps before sampling, fused into one pass over the row, in
+// place: x[i] *= scale (1 / temperature), and x[i] = -infinity where bit i of
+// allowed (bit i % 64 of word i / 64) is clear, unless allowed is null.
+// Returns the maximum; with sum, also sets it to the sum of exp(x[i] - max),
+// the softmax denominator.
+float prepare_logits(float* x, size_t n, float scale, const uint64_t* allowed, float* sum);
+
+// Name of the selected implementation ("avx512", "avx2" or "scalar")
+const char* isa_name();
+
+} // namespace sampler_kernels
+
+// Token sampler for one row of logits. Candidates for top-k and top-p are
+// found with a histogram over logit values instead of sorting the vocabulary,
+// so only the handful of tokens near the cutoff are ever ordered. Scratch
+// buffers are kept between calls and each sample costs one random draw.
+class Sampler {
+public:
+    explicit Sampler(uint64_t seed);
+
+    void seed(uint64_t seed) { rng_.seed(static_cast<std::mt19937::result_type>(seed)); }
+
+    // Pick the next token. temperature == 0 selects greedily; otherwise
+    // top_k (if 0 < top_k < n) takes precedence over top_p (if < 1), and
+    // with neither the full distribution is sampled.
+    int sample(const float* logits, size_t n, float temperature, int top_k, float top_p);
+
+    int sample_greedy(const float* logits, size_t n);
+    int sample_with_temperature(const float* logits, size_t n, float temperature);
+    int sample_top_k(const float* logits, size_t n, int k, float temperature);
+    int sample_top_p(const float* logits, size_t n, float p, float temperature);
+
+    // Pick the next token from logits prepared by sampler_kernels::prepare_logits
+    // (temperature and mask applied), given the maximum it returned and, for
+    // the full distribution (neither top-k nor top-p), the sum. greedy takes
+    // the first maximum. Returns 0 if every logit is -infinity.
+    int sample_prepared(const float* logits, size_t n, float max, float sum, bool greedy, int top_k, float top_p);
+
+    // Write the distribution sample() draws from to out[0 .. n): normalized,
+    // zero outside the top-k / top-p set, one-hot at the argmax when greedy
+    void distribution(const float* logits, size_t n, float temperature, int top_k, float top_p, float* out);
+
+    // Draw index i with probability weights[i] / sum(weights); weights need
+    // not be normalized. Returns -1 if they sum to 0.
+    int sample_weights(const float* weights, size_t n);
+
+    // Uniform in [0, 1)
+    float uniform();
+
+private:
+    static constexpr int kNumBuckets = 1024;
+
+    // Top-k estimates its threshold from about this many samples per token kept
+    static constexpr size_t kSamplesPerCandidate = 64;
+
+    std::mt19937 rng_;
+
+    // Scratch buffers, sized to the vocabulary on first use
+    std::vector<float> probs_;
+    std::vector<int32_t> candidates_;
+    std::vector<int32_t> buckets_;
+    std::vector<uint32_t> bucket_counts_;
+    std::vector<float> bucket_mass_;
+    std::vector<float> sample_;
+
+    // Logits more than this many temperature-scaled units below the maximum
+    // have probability 0 in float, so they are never candidates
+    static constexpr float kLogitRange = 87.0f;
+
+    // Indices of at least k (fewer only if fewer can have non-zero probability)
+    // of the largest logits, written to candidates_; returns the count
+    size_t collect_top_k(const float* logits, size_t n, int k, float max, float temperature);
+
+    // Exactly the top-k / top-p set in candidates_[0 .. count) with their
+    // unnormalized probabilities in probs_; returns count, sets their total.
+    // max is the largest logit.
+    size_t top_k_candidates(const float* logits, size_t n, int k, float temperature, float max, float& total);
+    size_t top_p_candidates(const float* logits, size_t n, float p, float temperature, float max, float& total);
+
+    // Tokens whose probabilities draw_softmax() computes at a time
+    static constexpr size_t kDrawBlock = 1024;
+
+    // Single draw from softmax(logits) given its max and sum, computing
+    // probabilities a block at a time only up to the block drawn from
+    int draw_softmax(const float* logits, size_t n, float max, float total);
+
+    // Single inverse-CDF draw over probs_[candidates[0 .. count)], or over
+    // probs_[0 .. count) when candidates is null; total is their sum
+    int draw(const int* candidates, size_t count, float total);
+};
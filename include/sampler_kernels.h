@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Internal to the sampler: the per-ISA implementations that the functions in
+// sampler.h dispatch to, exposed so tests can compare them with each other.
+namespace sampler_kernels {
+
+struct Kernels {
+    const char* name;
+    float (*max_value)(const float*, size_t);
+    size_t (*argmax)(const float*, size_t);
+    float (*exp_sum)(const float*, float*, size_t, float, float);
+    void (*bucketize)(const float*, int32_t*, size_t, float, float, int);
+    size_t (*select_at_least)(const float*, size_t, float, int32_t*);
+    // x[i] *= scale, masked to -infinity by allowed if not null; returns the max
+    float (*scale_mask_max)(float*, size_t, float, const uint64_t*);
+};
+
+// Every implementation the running CPU supports, fastest first; the last is
+// always the scalar one and the first is the one sampler.h uses
+std::vector<Kernels> supported_kernels();
+
+} // namespace sampler_kernels
@@ -0,0 +1,193 @@
+#pragma once
+
+#include "inference_engine.h"
+#include "metrics.h"
+#include "text_generator.h"
+#include "token_streamer.h"
+#include "tokenizer.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+enum class RequestStatus {
+    Completed,         // Reached EOS or max_length
+    Cancelled,         // cancel() was called, or the scheduler stopped
+    DeadlineExceeded,  // Deadline passed before the request finished
+    Failed             // Inference error
+};
+
+struct GenerationResult {
+    RequestStatus status = RequestStatus::Completed;
+    std::string text;         // Generated text, without the prompt
+    std::vector<int> tokens;  // Generated token IDs
+};
+
+struct GenerationRequest {
+    std::string prompt;
+    GenerationConfig config;
+    int priority = 0;  // Higher priority requests are admitted first
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();
+
+    // Called on the scheduler's output thread with newly generated text, in
+    // complete UTF-8 characters (a character split across tokens arrives as
+    // one piece)
+    std::function<void(std::string_view)> on_token;
+
+    // Called once with the final result, just before the result future is
+    // ready; on the output thread after the last on_token, in submit() if
+    // the scheduler is stopping, or in cancel() if the request was still
+    // queued. Must not call back into the scheduler.
+    std::function<void(const GenerationResult&)> on_complete;
+};
+
+struct RequestHandle {
+    uint64_t id;
+    std::future<GenerationResult> result;
+};
+
+// Continuous-batching scheduler: a single worker thread keeps one running
+// batch on the engine, admits queued requests into it between decode steps
+// and drops finished rows without waiting for the rest of the batch. The
+// worker only samples; detokenization, callbacks and the final decode run on
+// a TokenStreamer thread, behind the next forward pass.
+//
+// Prompts are prefilled in chunks between decode steps, so a long prompt
+// delays the running rows by one chunk per step rather than by its whole
+// prefill. step_tokens bounds the tokens fed per step: each running row
+// takes one and the prompts being prefilled share the rest (at least one
+// position each, so they always progress). Lower values keep inter-token
+// latency of running requests steady; higher ones shorten time to first
+// token of new ones. 0 prefills every prompt in a single forward pass.
+class Scheduler {
+public:
+    Scheduler(InferenceEngine& engine, Tokenizer& tokenizer, size_t max_batch_size = 8, size_t step_tokens = 512);
+    ~Scheduler();
+
+    // Start/stop the worker thread. Requests still queued or running when the
+    // scheduler stops finish as Cancelled.
+    bool start();
+    void stop();
+
+    // Thread-safe: queue a request and return its id and result future
+    RequestHandle submit(GenerationRequest request);
+
+    // Thread-safe: cancel a queued or running request; false if unknown/finished.
+    // A queued request finishes before this returns, a running one at the
+    // next step.
+    bool cancel(uint64_t id);
+
+    size_t queue_depth() const;
+
+    // Requests decoding or being prefilled
+    size_t running_count() const { return running_count_.load(); }
+
+private:
+    struct Sequence : std::enable_shared_from_this<Sequence> {
+        uint64_t id;
+        uint64_t arrival;  // Submission order, breaks priority/deadline ties
+        GenerationRequest request;
+        std::promise<GenerationResult> promise;
+        std::atomic<bool> cancelled{false};
+
+        std::vector<int> tokens;  // Generated so far
+        int num_sampled = 0;      // Sampling steps, including a final EOS
+        int64_t pending_token = 0;  // Sampled but not yet fed to the model
+        SamplingState sampling;     // Processors and constraint state, set up at prefill
+        std::shared_ptr<TokenStreamer::Stream> output;  // For on_token, opened at prefill
+        RequestTimer timer;         // From submission, so TTFT includes queueing
+        bool finished = false;
+    };
+    using SequencePtr = std::shared_ptr<Sequence>;
+
+    // Orders the queue, first to admit first: priority, then earliest
+    // deadline, then arrival
+    struct AdmissionOrder {
+        bool operator()(const SequencePtr& a, const SequencePtr& b) const;
+    };
+
+    InferenceEngine& engine_;
+    Tokenizer& tokenizer_;
+    TextGenerator generator_;  // Used for sampling only
+    size_t max_batch_size_;
+    size_t step_tokens_;
+    TokenStreamer streamer_;   // Producer side used by the worker thread only
+
+    mutable std::mutex mutex_;
+    std::condition_variable cv_;
+    std::set<SequencePtr, AdmissionOrder> queue_;  // Ordered so any entry can be removed
+    std::unordered_map<uint64_t, SequencePtr> active_;  // Queued or running, by id
+    uint64_t next_id_ = 1;
+    bool stopping_ = false;
+    std::thread worker_;
+
+    // Prompts admitted together and prefilled a chunk of columns per step,
+    // left padded to one length so every row's last token is in the last
+    // column; they join the running batch after the last chunk
+    struct Prefill {
+        std::vector<SequencePtr> sequences;
+        std::vector<std::vector<int64_t>> prompts;
+        std::vector<int64_t> input_ids;       // [rows, length]
+        std::vector<int64_t> attention_mask;  // [rows, length]
+        size_t length = 0;
+        size_t fed = 0;  // Columns already in cache
+        KVCache cache;
+
+        size_t rows() const { return sequences.size(); }
+    };
+
+    // Worker-thread state: running rows, in the same order as the cache rows
+    std::vector<SequencePtr> running_;
+    KVCache cache_;
+    Prefill prefill_;  // No rows when no prompt is being prefilled
+    std::atomic<size_t> running_count_{0};
+
+    void run_loop();
+
+    // Remove queued requests whose deadline has passed; caller holds mutex_
+    std::vector<SequencePtr> take_expired();
+
+    // Encode the prompts of newly admitted requests into prefill_
+    void admit(std::vector<SequencePtr> admitted);
+
+    // Feed the next chunk of prefill_, with decoded tokens of this step's
+    // budget already used; sample each row's first token after the last chunk
+    void prefill_step(size_t decoded);
+
+    // Finish prefilling rows that were cancelled or ran past their deadline
+    // and drop them from prefill_
+    void retire_prefill();
+
+    void decode_step();
+
+    // Evict from the cache rows whose next token would exceed their
+    // config.max_positions, keeping their sink tokens and latest window
+    void fit_context();
+
+    // Pick the next token of a sequence from its row of the last forward pass
+    int sample(Sequence& sequence, size_t row);
+
+    // Record a sampled token; marks the sequence finished on EOS/max_length
+    void accept_token(Sequence& sequence, int token);
+
+    // Finish rows that are done, cancelled or past deadline and drop them
+    // from the running batch and cache
+    void retire_finished();
+
+    // Mark a sequence finished and queue its last text and result behind
+    // its tokens on the streamer
+    void finish(Sequence& sequence, RequestStatus status);
+
+    // Run on_complete, then fulfil the promise
+    void complete(Sequence& sequence, GenerationResult result);
+};
@@ -0,0 +1,132 @@
+#pragma once
+
+#include "scheduler.h"
+#include "text_generator.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Long-running generation server speaking newline-delimited JSON over a Unix
+// domain socket or a local TCP port. All clients share one Scheduler, and so
+// one loaded engine and tokenizer; their requests are batched together.
+//
+// One thread runs an epoll loop over every socket, so an idle connection
+// costs a file descriptor and two empty buffers. Generated text arrives on
+// the scheduler's output thread, is queued and handed to the loop through an
+// eventfd.
+//
+// Requests, one JSON object per line:
+//   {"id": 1, "prompt": "Hello", "max_length": 50, "temperature": 0.8,
+//    "top_k": 50, "top_p": 0.9, "eos_token_id": 50256, "priority": 0,
+//    "timeout_ms": 0, "stream": true, "json": false, "regex": "..."}
+//       Generation; everything but "prompt" is optional and falls back to the
+//       server's defaults. "id" (any JSON value, unique among the
+//       connection's unfinished requests) is echoed in every reply. "json":
+//       true or a "regex" restricts the output to valid JSON or to a full
+//       match of the pattern (see set_token_trie()).
+//   {"cancel": 1}   Cancel this connection's request with that id
+//   {"metrics": true}
+//
+// Replies, one JSON object per line:
+//   {"id": 1, "token": " world"}   Streamed text (unless "stream" is false)
+//   {"id": 1, "done": true, "status": "completed", "text": " world...", "tokens": 12}
+//   {"id": 1, "error": "..."}
+//   {"metrics": {...}}
+//
+// Closing a connection cancels its unfinished requests. A connection may
+// have 64 unfinished requests; while 1 MB of replies waits for the client to
+// read them, no more requests are read from it, and at 16 MB it is closed.
+// Linux only (epoll).
+class Server {
+public:
+    Server(Scheduler& scheduler, const GenerationConfig& defaults);
+    ~Server();
+
+    Server(const Server&) = delete;
+    Server& operator=(const Server&) = delete;
+
+    // Listen on a Unix domain socket (a stale socket file is replaced) or a
+    // TCP host and port; can be combined. Call before run().
+    bool listen_unix(const std::string& path);
+    bool listen_tcp(const std::string& host, int port);
+
+    // Accept "json" and "regex" in requests, checking tokens against this
+    // trie of the scheduler's tokenizer. Call before run().
+    void set_token_trie(std::shared_ptr<const TokenTrie> trie) { token_trie_ = std::move(trie); }
+
+    // Serve until stop(); unfinished requests are cancelled before returning
+    bool run();
+
+    // Thread-safe and async-signal-safe
+    void stop();
+
+private:
+    struct Connection {
+        int fd = -1;
+        std::string input;         // Received bytes not yet forming a full line
+        std::string output;        // Replies not yet written
+        uint32_t events = 0;       // Currently registered epoll events
+        bool read_closed = false;  // Peer shut down its side, or sent an oversized line
+        bool broken = false;       // Socket error; close without writing
+
+        // Unfinished requests: reply id (as JSON text) -> scheduler id
+        std::unordered_map<std::string, uint64_t> requests;
+    };
+
+    // A reply line from the scheduler's output thread for one connection; done
+    // replies also retire the request from the connection
+    struct Outgoing {
+        uint64_t connection;
+        std::string key;
+        std::string line;
+        bool done;
+    };
+
+    Scheduler& scheduler_;
+    GenerationConfig defaults_;
+
+    // Constraints for requests, kept so their token masks carry over from
+    // one request to the next; used by the loop thread only
+    std::shared_ptr<const TokenTrie> token_trie_;
+    std::shared_ptr<const TokenConstraint> json_constraint_;
+    std::unordered_map<std::string, std::shared_ptr<const TokenConstraint>> regex_constraints_;
+
+    int epoll_fd_ = -1;
+    int wake_fd_ = -1;
+    std::atomic<bool> stopping_{false};
+    std::vector<std::pair<uint64_t, int>> listeners_;  // Epoll key, fd
+    std::string unix_path_;
+    uint64_t next_key_ = 1;  // 0 is the wake eventfd
+    std::unordered_map<uint64_t, std::unique_ptr<Connection>> connections_;
+
+    std::mutex outbox_mutex_;
+    std::condition_variable idle_cv_;
+    std::vector<Outgoing> outbox_;
+    size_t in_flight_ = 0;  // Submitted requests whose on_complete has not run
+
+    bool add_listener(int fd, const std::string& description);
+    void accept_connections(int listen_fd);
+    void read_connection(Connection& connection);
+    void handle_line(uint64_t key, Connection& connection, const std::string& line);
+
+    // Constraint for a request's "json" or "regex" field; throws
+    // std::invalid_argument if it cannot be had
+    std::shared_ptr<const TokenConstraint> constraint_for(bool want_json, const std::string& regex);
+    void drain_outbox();
+
+    // Write queued output, then close the connection or update its epoll
+    // events. A connection closes once the socket fails, or once the peer
+    // has hung up and every reply has been written.
+    void service(uint64_t key);
+    void flush(Connection& connection);
+    void close_connection(uint64_t key);
+
+    // Called from the scheduler's output thread
+    void post(Outgoing message);
+};
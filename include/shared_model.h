@@ -0,0 +1,54 @@
+#pragma once
+
+#include "mapped_file.h"
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <onnxruntime_cxx_api.h>
+
+// An ONNX model mapped once and shared by several InferenceEngine sessions
+// (e.g. one per NUMA node or worker). Sessions are created from the mapped
+// bytes; every large initializer is wrapped in one Ort::Value that all of them
+// use through AddInitializer, and the kernels prepacked from those weights go
+// in one PrepackedWeightsContainer. Each extra session then adds its own
+// activations and small constants, not another copy of the weights.
+//
+// Must outlive every engine loaded from it (engines hold a shared_ptr).
+class SharedModel {
+public:
+    SharedModel();
+    SharedModel(const SharedModel&) = delete;
+    SharedModel& operator=(const SharedModel&) = delete;
+
+    bool open(const std::string& path);
+
+    const std::string& path() const { return path_; }
+    const void* data() const { return file_.data(); }
+    size_t size() const { return file_.size(); }
+
+    // Point options at the shared initializers
+    void add_initializers(Ort::SessionOptions& options) const;
+
+    OrtPrepackedWeightsContainer* prepacked_weights() { return prepacked_weights_; }
+
+    size_t num_initializers() const { return values_.size(); }
+    size_t initializer_bytes() const { return initializer_bytes_; }
+
+private:
+    // Initializers smaller than this stay in the model, where ONNX Runtime
+    // may constant-fold them
+    static constexpr size_t kMinSharedBytes = 64 * 1024;
+
+    // Tensor data is used in place when the mapping is aligned this well,
+    // otherwise copied once into arena_
+    static constexpr size_t kAlignment = 64;
+
+    std::string path_;
+    MappedFile file_;
+    Ort::MemoryInfo memory_info_;
+    Ort::PrepackedWeightsContainer prepacked_weights_;
+    std::vector<unsigned char> arena_;
+    std::vector<std::string> names_;
+    std::vector<Ort::Value> values_;
+    size_t initializer_bytes_ = 0;
+};
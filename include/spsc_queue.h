@@ -0,0 +1,71 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <utility>
+
+// Bounded lock-free queue between exactly one producer thread and one
+// consumer thread. Each side owns one index and only reads the other's, so a
+// push or pop is a couple of loads and one release store; the indices sit on
+// separate cache lines so the two threads do not contend for one.
+template <typename T>
+class SpscQueue {
+public:
+    // Capacity is rounded up to a power of two
+    explicit SpscQueue(size_t capacity) {
+        size_t size = 2;
+        while (size < capacity) size *= 2;
+        mask_ = size - 1;
+        slots_ = std::make_unique<T[]>(size);
+    }
+
+    SpscQueue(const SpscQueue&) = delete;
+    SpscQueue& operator=(const SpscQueue&) = delete;
+
+    size_t capacity() const { return mask_ + 1; }
+
+    // Producer only; false if the queue is full
+    bool try_push(T&& value) {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail - cached_head_ > mask_) {
+            cached_head_ = head_.load(std::memory_order_acquire);
+            if (tail - cached_head_ > mask_) return false;
+        }
+        slots_[tail & mask_] = std::move(value);
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer only; false if the queue is empty
+    bool try_pop(T& value) {
+        size_t head = head_.load(std::memory_order_relaxed);
+        if (head == cached_tail_) {
+            cached_tail_ = tail_.load(std::memory_order_acquire);
+            if (head == cached_tail_) return false;
+        }
+        value = std::move(slots_[head & mask_]);
+        slots_[head & mask_] = T();  // Release what the slot holds now, not when it is next reused
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Either thread; exact only when the other side is idle
+    bool empty() const {
+        return head_.load(std::memory_order_acquire) == tail_.load(std::memory_order_acquire);
+    }
+
+private:
+    static constexpr size_t kCacheLine = 64;
+
+    std::unique_ptr<T[]> slots_;
+    size_t mask_;
+
+    // Consumer side: next slot to pop, and the producer's tail as last seen
+    alignas(kCacheLine) std::atomic<size_t> head_{0};
+    size_t cached_tail_ = 0;
+
+    // Producer side: next slot to fill, and the consumer's head as last seen
+    alignas(kCacheLine) std::atomic<size_t> tail_{0};
+    size_t cached_head_ = 0;
+};
@@ -0,0 +1,30 @@
+#pragma once
+
+#include "tokenizer.h"
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+// Incremental detokenizer for streaming output. Tokens are pushed as they are
+// generated and only complete UTF-8 codepoints are returned; bytes of a
+// codepoint split across tokens are held until the rest arrives. The output
+// buffer is reused, so steady-state pushes do not allocate.
+class StreamingDecoder {
+public:
+    explicit StreamingDecoder(const Tokenizer& tokenizer);
+
+    // Append a token; returns the text it completes. The view is valid until
+    // the next call on this decoder.
+    std::string_view push(int token_id);
+
+    // Return any held bytes of an incomplete trailing codepoint as they are
+    std::string_view flush();
+
+    void reset() { pending_size_ = 0; }
+
+private:
+    const Tokenizer& tokenizer_;
+    std::string buffer_;
+    char pending_[4];
+    size_t pending_size_;
+};
@@ -1,10 +1,18 @@
 #pragma once
 
+#include "beam_cache.h"
 #include "inference_engine.h"
+#include "logits_processor.h"
+#include "metrics.h"
+#include "prefix_cache.h"
+#include "sampler.h"
+#include "token_constraint.h"
+#include "token_streamer.h"
 #include "tokenizer.h"
+#include <memory>
 #include <string>
+#include <utility>
 #include <vector>
-#include <random>
 
 struct GenerationConfig {
     int max_length = 50;           // Maximum number of tokens to generate
@@ -12,6 +20,55 @@ struct GenerationConfig {
     int top_k = 50;                // Top-k sampling (0 = disabled)
     float top_p = 0.9f;            // Nucleus sampling (1.0 = disabled)
     int eos_token_id = 50256;      // End of sequence token
+    int draft_tokens = 4;          // Tokens the draft model proposes per step (with a draft engine)
+    int num_beams = 1;             // Beam search when > 1; sampling settings are then unused
+    float length_penalty = 1.0f;   // Finished beams score log-probability / length^length_penalty
+    bool early_stopping = false;   // Stop once num_beams beams have finished, not when none can improve
+    std::shared_ptr<const TokenConstraint> constraint;  // Only generate text it accepts (sampling only)
+
+    // Logits processors, applied in this order before the sampling settings
+    float repetition_penalty = 1.0f;  // Divide logits of tokens already seen (> 1 discourages repeats)
+    float presence_penalty = 0.0f;    // Subtract from logits of tokens generated at least once
+    float frequency_penalty = 0.0f;   // Subtract per time a token was generated
+    std::vector<std::pair<int, float>> logit_bias;  // Token id, added to its logit
+    int min_length = 0;                             // EOS banned until this many tokens are generated
+    std::vector<std::vector<int>> bad_words;        // Token sequences never completed
+    std::vector<std::shared_ptr<const LogitsProcessor>> logits_processors;  // Run after the built-in ones
+
+    // Bounded context: once a sequence would outgrow max_positions (GPT-2's
+    // position embeddings), only its first sink_tokens and latest
+    // window_tokens stay in the KV cache; 0 = unbounded
+    int max_positions = 1024;
+    int sink_tokens = 4;
+    int window_tokens = 768;
+};
+
+// Per-sequence state of TextGenerator::sample_next(): the processors config
+// asks for, the tokens they look at and the position in config.constraint
+struct SamplingState {
+    LogitsProcessorChain processors;
+    TokenHistory history;  // Only kept while there are processors
+    int constraint_state = 0;
+
+    SamplingState() = default;
+    SamplingState(const GenerationConfig& config, const std::vector<int64_t>& prompt);
+
+    // Record the token picked
+    void push_back(int token) {
+        if (!processors.empty()) history.push_back(token);
+    }
+};
+
+// Counters from the last speculative generate() call
+struct SpeculativeStats {
+    size_t rounds = 0;      // Verifying forward passes of the target model
+    size_t proposed = 0;    // Draft tokens offered for verification
+    size_t accepted = 0;    // Draft tokens the target model kept
+    size_t generated = 0;   // Tokens emitted
+    double seconds = 0.0;   // Wall time of the decode loop, prefill included
+
+    double acceptance_rate() const { return proposed ? static_cast<double>(accepted) / proposed : 0.0; }
+    double tokens_per_second() const { return seconds > 0.0 ? generated / seconds : 0.0; }
 };
 
 class TextGenerator {
@@ -21,20 +78,72 @@ public:
 
     std::string generate(const std::string& prompt, const GenerationConfig& config);
 
+    // Generate for several prompts at once, running all rows through each
+    // forward pass (left padded, per-row attention mask and EOS tracking)
+    std::vector<std::string> generate_batch(const std::vector<std::string>& prompts,
+                                            const GenerationConfig& config);
+
+    // Pick the next token with the sampling method selected by config,
+    // leaving the logits untouched (no processors or constraint)
+    int sample_next(const LogitsView& logits, const GenerationConfig& config);
+
+    // Pick the next token for the sequence state belongs to, rewriting logits
+    // in place: state's processors, then temperature and config.constraint in
+    // one pass, then the sampling method. EOS is allowed under the constraint
+    // once the text is complete, and returned if it allows nothing. Records
+    // the token in state.
+    int sample_next(float* logits, size_t n, const GenerationConfig& config, SamplingState& state);
+
+    // Use a smaller model with the same vocabulary to propose
+    // config.draft_tokens tokens per step, which the main engine verifies in
+    // one forward pass. Rejection sampling keeps the output distribution the
+    // main model's own. nullptr turns it off; used by generate() only.
+    void set_draft_engine(InferenceEngine* draft);
+
+    const SpeculativeStats& speculative_stats() const { return speculative_stats_; }
+
+    // Start generate() from the KV of the longest cached prefix of each
+    // prompt and store every prefilled prompt. The cache must belong to this
+    // generator's model. nullptr turns it off.
+    void set_prefix_cache(PrefixCache* cache) { prefix_cache_ = cache; }
+
+    // The tokens of prompt a bounded context feeds: all of them if they fit
+    // config.max_positions, else the sink tokens and the latest window
+    static std::vector<int64_t> fit_prompt(const std::vector<int64_t>& prompt, const GenerationConfig& config);
+
+    // Positions of a row to keep so new_tokens more fit within limit
+    static KVCache::Retain context_retain(const GenerationConfig& config, size_t limit, size_t new_tokens);
+
 private:
     InferenceEngine& engine_;
     Tokenizer& tokenizer_;
-    std::mt19937 rng_;
+    Sampler sampler_;
+
+    PrefixCache* prefix_cache_ = nullptr;
+    InferenceEngine* draft_ = nullptr;
+    SpeculativeStats speculative_stats_;
+    std::vector<float> draft_probs_;   // [draft_tokens, vocab_size] distributions of the proposals
+    std::vector<float> target_probs_;  // [vocab_size]
+    std::vector<float> beam_scratch_;  // [vocab_size] for beam search log-softmax
+
+    // Detokenizes and prints streamed output off the model thread; started on
+    // first use, since a generator used only for sampling never streams
+    std::unique_ptr<TokenStreamer> streamer_;
+    TokenStreamer& streamer();
+
+    // Fill cache from the prefix cache, always leaving the last prompt token
+    // to feed; returns how many prompt tokens are already in cache
+    size_t reuse_prefix(const std::vector<int64_t>& prompt, KVCache& cache);
 
-    // Sampling methods
-    int sample_greedy(const std::vector<float>& logits);
-    int sample_with_temperature(const std::vector<float>& logits, float temperature);
-    int sample_top_k(const std::vector<float>& logits, int k, float temperature);
-    int sample_top_p(const std::vector<float>& logits, float p, float temperature);
+    // Evict from every row of cache if feeding new_tokens more would exceed
+    // config.max_positions
+    void fit_context(KVCache& cache, size_t new_tokens, const GenerationConfig& config);
 
-    // Helper: apply temperature to logits and convert to probabilities
-    std::vector<float> softmax(const std::vector<float>& logits, float temperature);
+    std::string generate_speculative(std::vector<int64_t> input_ids, const GenerationConfig& config,
+                                     RequestTimer& timer);
 
-    // Helper: get logits for last token
-    std::vector<float> get_last_token_logits(const std::vector<float>& all_logits, size_t seq_len, int vocab_size);
+    // Keep the config.num_beams most likely continuations, all advanced in
+    // one batched forward pass per step, their KV shared through a BeamCache
+    std::string generate_beam_search(std::vector<int64_t> input_ids, const GenerationConfig& config,
+                                     RequestTimer& timer);
 };
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads for data-parallel loops. parallel_for() hands
+// out index ranges from a shared counter, so uneven items balance themselves,
+// and the calling thread works alongside the pool.
+class ThreadPool {
+public:
+    // num_threads counts the calling thread; 0 means one per hardware thread
+    explicit ThreadPool(size_t num_threads = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    size_t num_threads() const { return workers_.size() + 1; }
+
+    // Call fn(begin, end) over [0, n) in ranges of at most grain indices and
+    // return when all are done. The first exception thrown by fn is rethrown
+    // here. Calls from several threads take turns; fn must not call
+    // parallel_for on the same pool.
+    void parallel_for(size_t n, size_t grain, const std::function<void(size_t, size_t)>& fn);
+
+    // Process-wide pool with one thread per hardware thread
+    static ThreadPool& shared();
+
+private:
+    std::vector<std::thread> workers_;
+    std::mutex job_mutex_;  // One parallel_for at a time
+
+    std::mutex mutex_;
+    std::condition_variable work_cv_;
+    std::condition_variable done_cv_;
+    uint64_t generation_ = 0;  // Bumped for every job
+    size_t busy_ = 0;          // Workers still on the current job
+    bool stopping_ = false;
+
+    // Current job
+    const std::function<void(size_t, size_t)>* fn_ = nullptr;
+    size_t n_ = 0;
+    size_t grain_ = 1;
+    std::atomic<size_t> next_{0};
+    std::exception_ptr error_;
+
+    void worker_loop();
+    void work();
+};
@@ -0,0 +1,88 @@
+#pragma once
+
+#include "grammar.h"
+#include "tokenizer.h"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Prefix tree of the bytes every token decodes to, children ordered by byte.
+// Tokens sharing a prefix share its nodes, so checking the whole vocabulary
+// against an automaton reads each distinct prefix once and skips every token
+// below a rejected one. Immutable once built; share one per tokenizer.
+class TokenTrie {
+public:
+    explicit TokenTrie(const Tokenizer& tokenizer);
+
+    size_t vocab_size() const { return vocab_size_; }
+    size_t num_nodes() const { return nodes_.size(); }
+
+private:
+    struct Node {
+        uint32_t first_child;  // Children are nodes_[first_child .. first_child + num_children)
+        uint32_t num_children;
+        int32_t token;         // Token ending here, or -1
+        uint8_t byte;          // Edge from the parent
+    };
+
+    std::vector<Node> nodes_;  // nodes_[0] is the root
+    size_t vocab_size_ = 0;
+
+    // Bytes of token i are bytes_[offsets_[i] .. offsets_[i + 1])
+    std::string bytes_;
+    std::vector<uint32_t> offsets_;
+
+    friend class TokenConstraint;
+};
+
+// Restricts generation to text an automaton accepts. For each automaton
+// state reached, the tokens whose bytes keep the automaton alive are found
+// once by walking the TokenTrie and kept as a bitset over the vocabulary;
+// every later step in that state is a table lookup, and the mask is applied
+// to a row of logits by sampler_kernels::prepare_logits.
+//
+// The end-of-sequence token is left to the caller: it is allowed exactly in
+// accepting states. Thread-safe; masks and states are shared by all callers.
+class TokenConstraint {
+public:
+    TokenConstraint(std::shared_ptr<const TokenTrie> trie, std::unique_ptr<ByteAutomaton> automaton);
+
+    // Well-formed JSON, see JsonAutomaton
+    static std::shared_ptr<TokenConstraint> json(std::shared_ptr<const TokenTrie> trie, bool object_only = false);
+
+    // Full match of pattern, see RegexAutomaton; throws std::invalid_argument
+    static std::shared_ptr<TokenConstraint> regex(std::shared_ptr<const TokenTrie> trie, const std::string& pattern);
+
+    size_t vocab_size() const { return trie_->vocab_size(); }
+
+    int start() const { return start_; }
+
+    // Bitset of the tokens allowed in state (bit i of word i / 64 for token
+    // i), vocab_size() bits long; valid as long as the constraint
+    const uint64_t* allowed(int state) const;
+
+    // True if the text so far is complete, so the sequence may end here
+    bool accepting(int state) const;
+
+    // State after token, or ByteAutomaton::kReject if it is not allowed
+    int advance(int state, int token) const;
+
+    // Automaton states with a computed mask
+    size_t num_masks() const;
+
+private:
+    std::shared_ptr<const TokenTrie> trie_;
+    int start_;
+    size_t words_;  // uint64_t per mask
+
+    mutable std::mutex mutex_;
+    std::unique_ptr<ByteAutomaton> automaton_;
+    mutable std::vector<std::unique_ptr<uint64_t[]>> masks_;  // By state; null until first asked for
+    mutable size_t num_masks_ = 0;
+
+    // Walk the trie from state; caller holds mutex_
+    std::unique_ptr<uint64_t[]> compute_mask(int state) const;
+};
@@ -0,0 +1,82 @@
+#pragma once
+
+#include "spsc_queue.h"
+#include "streaming_decoder.h"
+#include "tokenizer.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <thread>
+#include <utility>
+
+// Detokenizes generated tokens and delivers their text on a thread of its
+// own. The model thread only queues token ids between forward passes; the
+// decoding, text callbacks and writes overlap the next forward instead of
+// delaying it. Text of a stream arrives in order, and work queued with
+// close() runs after every token queued before it.
+//
+// push(), close() and drain() must all be called from one thread (the
+// producer); open() may be called from any.
+class TokenStreamer {
+public:
+    using TextCallback = std::function<void(std::string_view)>;
+
+    // One sequence's detokenizer and the destination of its text; touched
+    // only on the streamer thread once opened
+    class Stream {
+    public:
+        Stream(const Tokenizer& tokenizer, TextCallback on_text) : decoder_(tokenizer), on_text_(std::move(on_text)) {}
+
+    private:
+        StreamingDecoder decoder_;
+        TextCallback on_text_;
+
+        friend class TokenStreamer;
+    };
+
+    explicit TokenStreamer(const Tokenizer& tokenizer, size_t capacity = 4096);
+    ~TokenStreamer();  // Delivers everything queued, then joins the thread
+
+    TokenStreamer(const TokenStreamer&) = delete;
+    TokenStreamer& operator=(const TokenStreamer&) = delete;
+
+    // on_text receives complete UTF-8 characters, on the streamer thread
+    std::shared_ptr<Stream> open(TextCallback on_text);
+
+    // Queue a token of stream; blocks only while the queue is full
+    void push(const std::shared_ptr<Stream>& stream, int token);
+
+    // Queue delivery of the stream's held bytes of an incomplete character,
+    // then fn; either may be null
+    void close(std::shared_ptr<Stream> stream, std::function<void()> fn = nullptr);
+
+    // Return once everything queued so far has been delivered
+    void drain();
+
+private:
+    struct Event {
+        std::shared_ptr<Stream> stream;
+        int token = kFlush;
+        std::function<void()> fn;
+    };
+    static constexpr int kFlush = -1;  // Event token that flushes its stream
+
+    const Tokenizer& tokenizer_;
+    SpscQueue<Event> queue_;
+
+    // The consumer sleeps on cv_ when the queue is empty; the producer only
+    // takes the mutex to wake it
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::atomic<bool> sleeping_{false};
+    bool stopping_ = false;
+    std::thread thread_;
+
+    void enqueue(Event event);
+    void run();
+    void deliver(Event& event);
+};
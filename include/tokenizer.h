@@ -1,10 +1,43 @@
 #pragma once
 
+#include "bpe_cache.h"
+#include "thread_pool.h"
+#include "tokenizer_data.h"
+#include <array>
+#include <cstdint>
 #include <string>
+#include <string_view>
 #include <vector>
-#include <unordered_map>
-#include <utility>
 
+// Token IDs of many texts in one buffer: text i is
+// tokens[offsets[i] .. offsets[i + 1])
+struct TokenBatch {
+    std::vector<int> tokens;
+    std::vector<size_t> offsets{0};
+
+    size_t size() const { return offsets.size() - 1; }
+    const int* data(size_t i) const { return tokens.data() + offsets[i]; }
+    size_t length(size_t i) const { return offsets[i + 1] - offsets[i]; }
+
+    void push_back(const std::vector<int>& ids) {
+        tokens.insert(tokens.end(), ids.begin(), ids.end());
+        offsets.push_back(tokens.size());
+    }
+};
+
+// Many decoded texts in one buffer: text i is text[offsets[i] .. offsets[i + 1])
+struct TextBatch {
+    std::string text;
+    std::vector<size_t> offsets{0};
+
+    size_t size() const { return offsets.size() - 1; }
+    std::string_view operator[](size_t i) const {
+        return std::string_view(text).substr(offsets[i], offsets[i + 1] - offsets[i]);
+    }
+};
+
+// Thread-safe once loaded: encoding only reads the vocabulary and merge
+// tables, and the BPE cache is internally locked.
 class Tokenizer {
 public:
     Tokenizer();
@@ -12,28 +45,60 @@ public:
 
     bool load(const std::string& vocab_path, const std::string& merges_path);
 
-    std::vector<int> encode(const std::string& text);
-    std::string decode(const std::vector<int>& tokens);
+    // Load a tokenizer compiled by save_binary(); the file is memory-mapped
+    // and used in place
+    bool load_binary(const std::string& path);
+    bool save_binary(const std::string& path) const;
+
+    size_t vocab_size() const { return data_.vocab_size(); }
+
+    // GPT-2's <|endoftext|>, which also stands for the beginning of text and
+    // is fed in place of an empty prompt; 0 if the vocabulary lacks it
+    int bos_token_id() const;
+
+    // Raw bytes a single token decodes to; may end inside a UTF-8 codepoint
+    std::string_view token_bytes(int token_id) const { return data_.raw_token(token_id); }
+
+    std::vector<int> encode(const std::string& text) const;
+    std::string decode(const std::vector<int>& tokens) const;
+
+    // Encode/decode many texts on a thread pool, one text per task, into a
+    // single buffer. Results match encode()/decode() text by text.
+    TokenBatch encode_batch(const std::vector<std::string_view>& texts,
+                            ThreadPool& pool = ThreadPool::shared()) const;
+    TokenBatch encode_batch(const std::vector<std::string>& texts,
+                            ThreadPool& pool = ThreadPool::shared()) const;
+    TextBatch decode_batch(const TokenBatch& batch, ThreadPool& pool = ThreadPool::shared()) const;
+
+    // Word-level BPE result cache (0 disables it)
+    void set_cache_capacity(size_t capacity) { bpe_cache_.set_capacity(capacity); }
+    BpeCache::Stats cache_stats() const { return bpe_cache_.stats(); }
 
 private:
-    // Vocabulary: token string -> token ID
-    std::unordered_map<std::string, int> vocab_;
+    // Vocabulary, reverse vocabulary and BPE merge tables, either built from
+    // vocab.json/merges.txt or mapped from a compiled tokenizer file
+    TokenizerData data_;
+
+    // Token ID of each byte's unicode symbol (-1 if missing from the vocab)
+    std::array<int, 256> byte_token_ids_;
 
-    // Reverse vocabulary: token ID -> token string
-    std::unordered_map<int, std::string> reverse_vocab_;
+    // Pre-tokenized word -> BPE token IDs; shared by concurrent encoders
+    mutable BpeCache bpe_cache_;
 
-    // BPE merges: pair of tokens -> merged token
-    std::vector<std::pair<std::string, std::string>> merges_;
+    // Unlocked per-worker cache in front of bpe_cache_ for encode_batch
+    struct LocalWordCache;
+
+    // Append the token IDs of text to token_ids
+    void encode_into(std::string_view text, std::vector<int>& token_ids, LocalWordCache* local) const;
 
     // Helper functions
-    std::vector<std::string> byte_pair_encode(const std::string& token);
-    std::vector<std::string> split_to_words(const std::string& text);
-    std::string bytes_to_unicode_char(unsigned char byte);
-    std::vector<std::string> get_pairs(const std::vector<std::string>& word);
+    void byte_pair_encode(std::string_view token, std::vector<int>& token_ids) const;
 
-    // Byte encoder for handling all possible bytes
-    std::unordered_map<unsigned char, std::string> byte_encoder_;
-    std::unordered_map<std::string, unsigned char> byte_decoder_;
+    // Byte encoder for handling all possible bytes: byte -> vocab symbol
+    std::array<std::string, 256> byte_encoder_;
 
     void init_byte_encoder();
+
+    // Resolve byte_token_ids_ against the loaded vocabulary
+    void init_byte_token_ids();
 };
@@ -0,0 +1,103 @@
+#pragma once
+
+#include "mapped_file.h"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Flat tokenizer tables: the vocabulary string table, an id -> string index,
+// the raw bytes each token decodes to, a hashed string -> id table and a
+// hashed (left id, right id) -> merge table.
+// The same bytes are the on-disk format written by save() and mapped by
+// open(), so a compiled tokenizer is used in place, with no per-entry
+// allocation, and its pages are shared by every process that maps it.
+//
+// Integers are stored in native (little-endian) byte order; sections are
+// 8-byte aligned.
+class TokenizerData {
+public:
+    struct Header {
+        char magic[8];                   // "GPT2BPE\0"
+        uint32_t version;
+        uint32_t vocab_size;             // Token IDs are 0 .. vocab_size - 1
+        uint32_t vocab_buckets;          // Power of two
+        uint32_t merge_buckets;          // Power of two
+        uint32_t num_merges;
+        uint32_t reserved;
+        uint64_t strings_offset;         // Concatenated token strings
+        uint64_t strings_size;
+        uint64_t string_offsets_offset;  // uint32_t[vocab_size + 1] into strings
+        uint64_t raw_strings_offset;     // Concatenated decoded bytes of each token
+        uint64_t raw_strings_size;
+        uint64_t raw_offsets_offset;     // uint32_t[vocab_size + 1] into raw strings
+        uint64_t vocab_table_offset;     // uint32_t[vocab_buckets]: token ID + 1, 0 = empty
+        uint64_t merge_table_offset;     // MergeEntry[merge_buckets]
+        uint64_t file_size;
+    };
+
+    struct MergeEntry {
+        uint64_t key;       // (left id << 32) | right id, kEmptyKey if unused
+        int32_t rank;       // Position in merges.txt, lower merges first
+        int32_t merged_id;  // Token ID of the concatenated pair
+    };
+
+    static constexpr uint64_t kEmptyKey = ~0ull;
+
+    TokenizerData() = default;
+    ~TokenizerData();
+    TokenizerData(const TokenizerData&) = delete;
+    TokenizerData& operator=(const TokenizerData&) = delete;
+
+    // Compile vocab.json and merges.txt into tables held in memory.
+    // byte_symbols[b] is the vocabulary symbol that byte b is written as.
+    bool build(const std::string& vocab_path, const std::string& merges_path,
+               const std::array<std::string, 256>& byte_symbols);
+
+    // Memory-map a file written by save()
+    bool open(const std::string& path);
+
+    bool save(const std::string& path) const;
+
+    bool loaded() const { return header_ != nullptr; }
+
+    uint32_t vocab_size() const { return header_ ? header_->vocab_size : 0; }
+    uint32_t num_merges() const { return header_ ? header_->num_merges : 0; }
+
+    // Token ID of a vocabulary string, or -1
+    int find_token(std::string_view token) const;
+
+    // Vocabulary string of a token ID (empty if out of range)
+    std::string_view token(int id) const;
+
+    // Bytes a token ID decodes to (empty if out of range)
+    std::string_view raw_token(int id) const;
+
+    // Merge rule for a pair of token IDs, or nullptr
+    const MergeEntry* find_merge(uint64_t key) const;
+
+    static uint64_t pair_key(int left_id, int right_id) {
+        return (static_cast<uint64_t>(static_cast<uint32_t>(left_id)) << 32) | static_cast<uint32_t>(right_id);
+    }
+
+private:
+    // Either owned_ or mapping_ holds the bytes that header_ points into
+    std::vector<uint64_t> owned_;
+    MappedFile mapping_;
+
+    const Header* header_ = nullptr;
+    const char* strings_ = nullptr;
+    const uint32_t* string_offsets_ = nullptr;
+    const char* raw_strings_ = nullptr;
+    const uint32_t* raw_offsets_ = nullptr;
+    const uint32_t* vocab_table_ = nullptr;
+    const MergeEntry* merge_table_ = nullptr;
+
+    const char* bytes() const { return reinterpret_cast<const char*>(header_); }
+
+    // Validate the header against size bytes at data and set the section pointers
+    bool attach(const void* data, size_t size);
+    void release();
+};
@@ -0,0 +1,139 @@
+#include "beam_cache.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <unordered_set>
+
+// Positions [start, start + length) of a beam after those of parent. Data is
+// position-major, [length, num_heads, head_dim] per past tensor, so appending
+// a position is a push_back.
+struct BeamCache::Segment {
+    Beam parent;
+    int64_t start = 0;
+    int64_t length = 0;
+    std::vector<std::vector<float>> data;
+};
+
+BeamCache::BeamCache() {}
+
+BeamCache::~BeamCache() {}
+
+BeamCache::Beam BeamCache::start(const KVCache& prompt) {
+    if (prompt.batch_size() != 1 ||
+        std::find(prompt.attention_mask_.begin(), prompt.attention_mask_.end(), 0) != prompt.attention_mask_.end()) {
+        throw std::runtime_error("BeamCache::start: needs a single row without padding");
+    }
+
+    auto segment = std::make_shared<Segment>();
+    segment->length = prompt.length();
+    num_tensors_ = prompt.tensors_.size();
+    segment->data.resize(num_tensors_);
+    for (size_t i = 0; i < num_tensors_; i++) {
+        auto shape = prompt.tensors_[i].GetTensorTypeAndShapeInfo().GetShape();
+        num_heads_ = shape[1];
+        head_dim_ = shape[3];
+
+        // [1, heads, length, dim] -> [length, heads, dim]
+        const float* src = prompt.tensors_[i].GetTensorData<float>();
+        std::vector<float>& dst = segment->data[i];
+        dst.resize(static_cast<size_t>(segment->length * num_heads_ * head_dim_));
+        for (int64_t h = 0; h < num_heads_; h++) {
+            for (int64_t p = 0; p < segment->length; p++) {
+                std::memcpy(dst.data() + (p * num_heads_ + h) * head_dim_,
+                            src + (h * segment->length + p) * head_dim_,
+                            sizeof(float) * head_dim_);
+            }
+        }
+    }
+    return segment;
+}
+
+KVCache BeamCache::gather(const std::vector<Beam>& beams) const {
+    KVCache result;
+    if (beams.empty()) return result;
+
+    int64_t length = BeamCache::length(beams[0]);
+    int64_t batch = static_cast<int64_t>(beams.size());
+    for (const Beam& beam : beams) {
+        if (BeamCache::length(beam) != length) {
+            throw std::runtime_error("BeamCache::gather: beams differ in length");
+        }
+    }
+
+    // Segments of each beam; each knows where its positions go
+    std::vector<std::vector<const Segment*>> chains(beams.size());
+    for (size_t b = 0; b < beams.size(); b++) {
+        for (const Segment* s = beams[b].get(); s; s = s->parent.get()) {
+            chains[b].push_back(s);
+        }
+    }
+
+    Ort::AllocatorWithDefaultOptions allocator;
+    std::vector<int64_t> shape = {batch, num_heads_, length, head_dim_};
+    size_t head_stride = static_cast<size_t>(length * head_dim_);
+    for (size_t i = 0; i < num_tensors_; i++) {
+        auto tensor = Ort::Value::CreateTensor<float>(allocator, shape.data(), shape.size());
+        float* dst = tensor.GetTensorMutableData<float>();
+        for (size_t b = 0; b < beams.size(); b++) {
+            for (const Segment* s : chains[b]) {
+                const float* src = s->data[i].data();
+                for (int64_t p = 0; p < s->length; p++) {
+                    for (int64_t h = 0; h < num_heads_; h++) {
+                        std::memcpy(dst + (b * num_heads_ + h) * head_stride + (s->start + p) * head_dim_,
+                                    src + (p * num_heads_ + h) * head_dim_,
+                                    sizeof(float) * head_dim_);
+                    }
+                }
+            }
+        }
+        result.tensors_.push_back(std::move(tensor));
+    }
+
+    result.attention_mask_.assign(static_cast<size_t>(batch * length), 1);
+    result.next_positions_.assign(beams.size(), length);
+    result.batch_size_ = beams.size();
+    result.length_ = length;
+    return result;
+}
+
+BeamCache::Beam BeamCache::extend(Beam beam, const KVCache& cache, size_t row) const {
+    // Another beam or a child segment sees this one as it is: start a new one
+    if (beam.use_count() > 1) {
+        auto segment = std::make_shared<Segment>();
+        segment->start = beam->start + beam->length;
+        segment->data.resize(num_tensors_);
+        segment->parent = std::move(beam);
+        beam = std::move(segment);
+    }
+
+    int64_t position = cache.length() - 1;
+    for (size_t i = 0; i < num_tensors_; i++) {
+        const float* src = cache.tensors_[i].GetTensorData<float>();
+        std::vector<float>& dst = beam->data[i];
+        for (int64_t h = 0; h < num_heads_; h++) {
+            const float* from = src + ((row * num_heads_ + h) * cache.length() + position) * head_dim_;
+            dst.insert(dst.end(), from, from + head_dim_);
+        }
+    }
+    beam->length++;
+    return beam;
+}
+
+int64_t BeamCache::length(const Beam& beam) {
+    return beam ? beam->start + beam->length : 0;
+}
+
+size_t BeamCache::bytes(const std::vector<Beam>& beams) const {
+    std::unordered_set<const Segment*> seen;
+    size_t positions = 0;
+    for (const Beam& beam : beams) {
+        for (const Segment* s = beam.get(); s && seen.insert(s).second; s = s->parent.get()) {
+            positions += static_cast<size_t>(s->length);
+        }
+    }
+    return positions * position_bytes();
+}
+
+size_t BeamCache::position_bytes() const {
+    return num_tensors_ * static_cast<size_t>(num_heads_ * head_dim_) * sizeof(float);
+}
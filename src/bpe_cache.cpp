@@ -0,0 +1,81 @@
+#include "bpe_cache.h"
+#include <functional>
+
+BpeCache::BpeCache(size_t capacity) : shard_capacity_(0) {
+    set_capacity(capacity);
+}
+
+BpeCache::Shard& BpeCache::shard_for(std::string_view word) {
+    return shards_[std::hash<std::string_view>{}(word) % kNumShards];
+}
+
+bool BpeCache::lookup(std::string_view word, std::vector<int>& token_ids) {
+    if (shard_capacity_.load(std::memory_order_relaxed) == 0) return false;
+
+    Shard& shard = shard_for(word);
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.index.find(word);
+        if (it != shard.index.end()) {
+            shard.entries.splice(shard.entries.begin(), shard.entries, it->second);
+            const auto& ids = it->second->token_ids;
+            token_ids.insert(token_ids.end(), ids.begin(), ids.end());
+            hits_.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+    misses_.fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
+
+void BpeCache::insert(std::string_view word, const int* token_ids, size_t count) {
+    size_t capacity = shard_capacity_.load(std::memory_order_relaxed);
+    if (capacity == 0) return;
+
+    Shard& shard = shard_for(word);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    if (shard.index.count(word)) return;
+
+    shard.entries.push_front({std::string(word), std::vector<int>(token_ids, token_ids + count)});
+    shard.index.emplace(shard.entries.front().word, shard.entries.begin());
+    evict_to(shard, capacity);
+}
+
+void BpeCache::set_capacity(size_t capacity) {
+    size_t per_shard = (capacity + kNumShards - 1) / kNumShards;
+    shard_capacity_ = per_shard;
+    for (auto& shard : shards_) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        evict_to(shard, per_shard);
+    }
+}
+
+void BpeCache::evict_to(Shard& shard, size_t capacity) {
+    while (shard.entries.size() > capacity) {
+        shard.index.erase(shard.entries.back().word);
+        shard.entries.pop_back();
+    }
+}
+
+void BpeCache::clear() {
+    for (auto& shard : shards_) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.index.clear();
+        shard.entries.clear();
+    }
+    hits_ = 0;
+    misses_ = 0;
+}
+
+BpeCache::Stats BpeCache::stats() const {
+    Stats stats;
+    stats.hits = hits_.load();
+    stats.misses = misses_.load();
+    stats.size = 0;
+    for (auto& shard : shards_) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        stats.size += shard.entries.size();
+    }
+    stats.capacity = shard_capacity_.load() * kNumShards;
+    return stats;
+}
@@ -0,0 +1,632 @@
+#include "grammar.h"
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+
+// ---------------------------------------------------------------------------
+// Regular expressions
+
+namespace {
+
+using ByteSet = std::array<uint64_t, 4>;
+
+void set_range(ByteSet& set, unsigned lo, unsigned hi) {
+    for (unsigned b = lo; b <= hi; b++) {
+        set[b >> 6] |= 1ull << (b & 63);
+    }
+}
+
+bool contains(const ByteSet& set, unsigned b) {
+    return (set[b >> 6] >> (b & 63)) & 1;
+}
+
+ByteSet complement(const ByteSet& set) {
+    return {~set[0], ~set[1], ~set[2], ~set[3]};
+}
+
+int hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// NFA states a pattern may expand to; bounded repeats copy their operand
+constexpr size_t kMaxNfaStates = 1 << 16;
+constexpr int kMaxRepeat = 1000;
+
+} // namespace
+
+// Recursive-descent parser building a syntax tree, then compiled back to
+// front into Thompson NFA states of the automaton
+class RegexAutomaton::Parser {
+public:
+    Parser(const std::string& pattern, RegexAutomaton& automaton) : pattern_(pattern), automaton_(automaton) {}
+
+    // Fill automaton.nfa_; returns the start state
+    int parse() {
+        // Anchors at the ends are implied
+        size_t begin = 0;
+        size_t end = pattern_.size();
+        if (end > 0 && pattern_[0] == '^') begin = 1;
+        if (end > begin && pattern_[end - 1] == '$') {
+            size_t backslashes = 0;
+            while (end - 1 - backslashes > begin && pattern_[end - 2 - backslashes] == '\\') backslashes++;
+            if (backslashes % 2 == 0) end--;
+        }
+        pattern_ = pattern_.substr(begin, end - begin);
+
+        std::unique_ptr<Node> root = parse_alternation();
+        if (pos_ < pattern_.size()) fail("unmatched ')'");
+
+        automaton_.nfa_.emplace_back();
+        automaton_.nfa_accept_ = 0;
+        return compile(*root, automaton_.nfa_accept_);
+    }
+
+private:
+    struct Node {
+        enum Kind { Bytes, Concat, Alternation, Repeat } kind;
+        ByteSet bytes{};
+        std::vector<std::unique_ptr<Node>> children;
+        int min = 0;
+        int max = 0;  // -1 = unbounded
+
+        explicit Node(Kind k) : kind(k) {}
+    };
+
+    std::string pattern_;
+    RegexAutomaton& automaton_;
+    size_t pos_ = 0;
+
+    [[noreturn]] void fail(const std::string& message) const {
+        throw std::invalid_argument("regex: " + message + " at offset " + std::to_string(pos_));
+    }
+
+    bool at_end() const { return pos_ >= pattern_.size(); }
+    char peek() const { return pattern_[pos_]; }
+
+    std::unique_ptr<Node> parse_alternation() {
+        auto node = std::make_unique<Node>(Node::Alternation);
+        node->children.push_back(parse_concat());
+        while (!at_end() && peek() == '|') {
+            pos_++;
+            node->children.push_back(parse_concat());
+        }
+        if (node->children.size() == 1) return std::move(node->children[0]);
+        return node;
+    }
+
+    std::unique_ptr<Node> parse_concat() {
+        auto node = std::make_unique<Node>(Node::Concat);
+        while (!at_end() && peek() != '|' && peek() != ')') {
+            node->children.push_back(parse_repeat());
+        }
+        return node;
+    }
+
+    std::unique_ptr<Node> parse_repeat() {
+        std::unique_ptr<Node> atom = parse_atom();
+        while (!at_end()) {
+            int min;
+            int max;
+            char c = peek();
+            if (c == '*') {
+                min = 0, max = -1;
+                pos_++;
+            } else if (c == '+') {
+                min = 1, max = -1;
+                pos_++;
+            } else if (c == '?') {
+                min = 0, max = 1;
+                pos_++;
+            } else if (c != '{' || !parse_bounds(min, max)) {
+                break;
+            }
+            auto repeat = std::make_unique<Node>(Node::Repeat);
+            repeat->min = min;
+            repeat->max = max;
+            repeat->children.push_back(std::move(atom));
+            atom = std::move(repeat);
+        }
+        return atom;
+    }
+
+    // {n}, {n,} or {n,m} at pos_; anything else leaves pos_ and the '{' is a literal
+    bool parse_bounds(int& min, int& max) {
+        size_t p = pos_ + 1;
+        auto number = [&](int& value) {
+            size_t start = p;
+            value = 0;
+            while (p < pattern_.size() && pattern_[p] >= '0' && pattern_[p] <= '9') {
+                value = std::min(value * 10 + (pattern_[p] - '0'), kMaxRepeat + 1);
+                p++;
+            }
+            return p > start;
+        };
+        if (!number(min)) return false;
+        max = min;
+        if (p < pattern_.size() && pattern_[p] == ',') {
+            p++;
+            if (!number(max)) max = -1;
+        }
+        if (p >= pattern_.size() || pattern_[p] != '}') return false;
+        pos_ = p + 1;
+        if (min > kMaxRepeat || max > kMaxRepeat) fail("repeat count above " + std::to_string(kMaxRepeat));
+        if (max >= 0 && max < min) fail("repeat bounds out of order");
+        return true;
+    }
+
+    std::unique_ptr<Node> parse_atom() {
+        char c = peek();
+        if (c == '(') {
+            pos_++;
+            if (pattern_.compare(pos_, 2, "?:") == 0) pos_ += 2;
+            std::unique_ptr<Node> inner = parse_alternation();
+            if (at_end() || peek() != ')') fail("missing ')'");
+            pos_++;
+            return inner;
+        }
+        if (c == '*' || c == '+' || c == '?') fail("nothing to repeat");
+
+        auto node = std::make_unique<Node>(Node::Bytes);
+        if (c == '[') {
+            pos_++;
+            node->bytes = parse_class();
+        } else if (c == '.') {
+            pos_++;
+            set_range(node->bytes, 0, 255);
+            node->bytes['\n' >> 6] &= ~(1ull << ('\n' & 63));
+        } else if (c == '\\') {
+            pos_++;
+            node->bytes = parse_escape();
+        } else {
+            pos_++;
+            set_range(node->bytes, static_cast<uint8_t>(c), static_cast<uint8_t>(c));
+        }
+        return node;
+    }
+
+    // After '\': a class shorthand, a control character or a literal
+    ByteSet parse_escape() {
+        if (at_end()) fail("trailing '\\'");
+        char c = pattern_[pos_++];
+        ByteSet set{};
+        switch (c) {
+        case 'd': set_range(set, '0', '9'); return set;
+        case 'D': set_range(set, '0', '9'); return complement(set);
+        case 'w':
+        case 'W':
+            set_range(set, '0', '9');
+            set_range(set, 'A', 'Z');
+            set_range(set, 'a', 'z');
+            set_range(set, '_', '_');
+            return c == 'w' ? set : complement(set);
+        case 's':
+        case 'S':
+            set_range(set, '\t', '\r');
+            set_range(set, ' ', ' ');
+            return c == 's' ? set : complement(set);
+        case 'n': c = '\n'; break;
+        case 't': c = '\t'; break;
+        case 'r': c = '\r'; break;
+        case 'f': c = '\f'; break;
+        case 'v': c = '\v'; break;
+        case '0': c = '\0'; break;
+        case 'x': {
+            int hi = pos_ < pattern_.size() ? hex_value(pattern_[pos_]) : -1;
+            int lo = pos_ + 1 < pattern_.size() ? hex_value(pattern_[pos_ + 1]) : -1;
+            if (hi < 0 || lo < 0) fail("\\x needs two hex digits");
+            pos_ += 2;
+            c = static_cast<char>(hi * 16 + lo);
+            break;
+        }
+        default:
+            if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')) {
+                fail(std::string("unsupported escape \\") + c);
+            }
+            break;
+        }
+        set_range(set, static_cast<uint8_t>(c), static_cast<uint8_t>(c));
+        return set;
+    }
+
+    // After '[': members up to the closing ']'
+    ByteSet parse_class() {
+        bool negate = !at_end() && peek() == '^';
+        if (negate) pos_++;
+
+        ByteSet set{};
+        bool first = true;
+        while (true) {
+            if (at_end()) fail("missing ']'");
+            char c = peek();
+            if (c == ']' && !first) {
+                pos_++;
+                break;
+            }
+            first = false;
+
+            // A member is a single byte, possibly starting a range, or a shorthand class
+            pos_++;
+            ByteSet member{};
+            if (c == '\\') {
+                member = parse_escape();
+            } else {
+                set_range(member, static_cast<uint8_t>(c), static_cast<uint8_t>(c));
+            }
+            int count = 0;
+            int lo = -1;
+            for (unsigned b = 0; b < 256; b++) {
+                if (contains(member, b)) {
+                    if (count++ == 0) lo = static_cast<int>(b);
+                }
+            }
+
+            if (count == 1 && pos_ + 1 < pattern_.size() && peek() == '-' && pattern_[pos_ + 1] != ']') {
+                pos_++;
+                char h = pattern_[pos_++];
+                int hi = static_cast<uint8_t>(h);
+                if (h == '\\') {
+                    ByteSet end = parse_escape();
+                    hi = -1;
+                    for (unsigned b = 0; b < 256; b++) {
+                        if (contains(end, b)) {
+                            if (hi >= 0) fail("class shorthand as range end");
+                            hi = static_cast<int>(b);
+                        }
+                    }
+                }
+                if (hi < lo) fail("class range out of order");
+                set_range(set, static_cast<unsigned>(lo), static_cast<unsigned>(hi));
+            } else {
+                for (int w = 0; w < 4; w++) set[w] |= member[w];
+            }
+        }
+        return negate ? complement(set) : set;
+    }
+
+    int add_state() {
+        if (automaton_.nfa_.size() >= kMaxNfaStates) fail("pattern too large");
+        automaton_.nfa_.emplace_back();
+        return static_cast<int>(automaton_.nfa_.size() - 1);
+    }
+
+    int add_epsilon(int a, int b) {
+        int state = add_state();
+        automaton_.nfa_[state].epsilon[0] = a;
+        automaton_.nfa_[state].epsilon[1] = b;
+        return state;
+    }
+
+    // Entry state of states matching node and then continuing at next
+    int compile(const Node& node, int next) {
+        switch (node.kind) {
+        case Node::Bytes: {
+            int state = add_state();
+            automaton_.nfa_[state].bytes = node.bytes;
+            automaton_.nfa_[state].next = next;
+            return state;
+        }
+        case Node::Concat:
+            for (size_t i = node.children.size(); i-- > 0;) {
+                next = compile(*node.children[i], next);
+            }
+            return next;
+        case Node::Alternation: {
+            int entry = compile(*node.children.back(), next);
+            for (size_t i = node.children.size() - 1; i-- > 0;) {
+                entry = add_epsilon(compile(*node.children[i], next), entry);
+            }
+            return entry;
+        }
+        case Node::Repeat: {
+            const Node& child = *node.children[0];
+            int entry = next;
+            if (node.max < 0) {
+                // Loop back through an epsilon state that may also leave
+                int loop = add_epsilon(-1, next);
+                int body = compile(child, loop);
+                automaton_.nfa_[loop].epsilon[0] = body;
+                entry = loop;
+            } else {
+                for (int i = node.min; i < node.max; i++) {
+                    entry = add_epsilon(compile(child, entry), next);
+                }
+            }
+            for (int i = 0; i < node.min; i++) {
+                entry = compile(child, entry);
+            }
+            return entry;
+        }
+        }
+        return next;
+    }
+};
+
+RegexAutomaton::RegexAutomaton(const std::string& pattern) {
+    Parser parser(pattern, *this);
+    int start = parser.parse();
+    intern({start});
+}
+
+int RegexAutomaton::intern(std::vector<int> states) {
+    // Epsilon closure
+    std::vector<bool> seen(nfa_.size(), false);
+    std::vector<int> pending = std::move(states);
+    std::vector<int> closure;
+    while (!pending.empty()) {
+        int s = pending.back();
+        pending.pop_back();
+        if (s < 0 || seen[s]) continue;
+        seen[s] = true;
+        const NfaState& state = nfa_[s];
+        if (state.epsilon[0] >= 0 || state.epsilon[1] >= 0) {
+            pending.push_back(state.epsilon[0]);
+            pending.push_back(state.epsilon[1]);
+        } else {
+            closure.push_back(s);  // Byte states and the accept state
+        }
+    }
+    if (closure.empty()) return kReject;
+    std::sort(closure.begin(), closure.end());
+
+    std::string key(reinterpret_cast<const char*>(closure.data()), closure.size() * sizeof(int));
+    auto it = dfa_ids_.find(key);
+    if (it != dfa_ids_.end()) return it->second;
+
+    int id = static_cast<int>(dfa_.size());
+    dfa_ids_.emplace(std::move(key), id);
+    dfa_accepting_.push_back(std::binary_search(closure.begin(), closure.end(), nfa_accept_));
+    dfa_.push_back(std::move(closure));
+    std::array<int, 256> unknown;
+    unknown.fill(kUnknown);
+    dfa_next_.push_back(unknown);
+    return id;
+}
+
+int RegexAutomaton::step(int state, uint8_t byte) {
+    if (state < 0) return kReject;
+    int next = dfa_next_[state][byte];
+    if (next != kUnknown) return next;
+
+    std::vector<int> targets;
+    for (int s : dfa_[state]) {
+        if (contains(nfa_[s].bytes, byte)) targets.push_back(nfa_[s].next);
+    }
+    next = targets.empty() ? kReject : intern(std::move(targets));
+    dfa_next_[state][byte] = next;
+    return next;
+}
+
+// ---------------------------------------------------------------------------
+// JSON
+
+enum class JsonAutomaton::Mode : uint8_t {
+    Value,           // Before a value: at the top level, after ':' or after ',' in an array
+    ArrayFirst,      // After '[': a value or ']'
+    ObjectFirst,     // After '{': a key or '}'
+    Key,             // After ',' in an object: a key
+    Colon,           // After a key
+    AfterValue,      // After a value in a container: ',' or the closing bracket
+    Done,            // After the top-level value
+    String,          // In a string
+    Escape,          // After '\' in a string
+    Unicode,         // In \uXXXX; aux = hex digits left
+    Utf8,            // In a multi-byte character; aux = continuation bytes left | range << 4
+    Literal,         // In true/false/null; aux = literal << 3 | next position
+    Minus,           // Number digits, by what may come next
+    Zero,
+    Integer,
+    Point,
+    Fraction,
+    Exponent,
+    ExponentSign,
+    ExponentDigits,
+};
+
+namespace {
+
+const char* const kLiterals[] = {"true", "false", "null"};
+
+bool is_whitespace(uint8_t b) {
+    return b == ' ' || b == '\t' || b == '\n' || b == '\r';
+}
+
+bool is_digit(uint8_t b) {
+    return b >= '0' && b <= '9';
+}
+
+// Allowed range of the next UTF-8 continuation byte, by range code; the
+// narrow ones rule out overlong forms, surrogates and code points past U+10FFFF
+bool continuation_allowed(unsigned range, uint8_t b) {
+    static const uint8_t lo[] = {0x80, 0xA0, 0x80, 0x90, 0x80};
+    static const uint8_t hi[] = {0xBF, 0xBF, 0x9F, 0xBF, 0x8F};
+    return range < 5 && b >= lo[range] && b <= hi[range];
+}
+
+} // namespace
+
+JsonAutomaton::JsonAutomaton(size_t max_depth, bool object_only)
+    : max_depth_(std::min<size_t>(max_depth, 255)), object_only_(object_only) {
+    intern({Mode::Value, 0, false, std::string()});
+}
+
+int JsonAutomaton::intern(const State& state) {
+    std::string key;
+    key.reserve(3 + state.stack.size());
+    key.push_back(static_cast<char>(state.mode));
+    key.push_back(static_cast<char>(state.aux));
+    key.push_back(static_cast<char>(state.key));
+    key += state.stack;
+
+    auto it = ids_.find(key);
+    if (it != ids_.end()) return it->second;
+
+    int id = static_cast<int>(states_.size());
+    ids_.emplace(std::move(key), id);
+    states_.push_back(state);
+    std::array<int, 256> unknown;
+    unknown.fill(kUnknown);
+    next_.push_back(unknown);
+    return id;
+}
+
+JsonAutomaton::State JsonAutomaton::after_value(std::string stack) const {
+    Mode mode = stack.empty() ? Mode::Done : Mode::AfterValue;
+    return {mode, 0, false, std::move(stack)};
+}
+
+bool JsonAutomaton::accepting(int state) {
+    if (state < 0) return false;
+    const State& s = states_[state];
+    if (!s.stack.empty()) return false;
+    switch (s.mode) {
+    case Mode::Done:
+    case Mode::Zero:
+    case Mode::Integer:
+    case Mode::Fraction:
+    case Mode::ExponentDigits:
+        return true;
+    default:
+        return false;
+    }
+}
+
+int JsonAutomaton::step(int state, uint8_t byte) {
+    if (state < 0) return kReject;
+    int next = next_[state][byte];
+    if (next == kUnknown) {
+        next = transition(state, byte);
+        next_[state][byte] = next;
+    }
+    return next;
+}
+
+int JsonAutomaton::transition(int id, uint8_t b) {
+    State s = states_[id];  // Copy: interning may grow states_
+
+    auto open = [&](char bracket) {
+        if (s.stack.size() >= max_depth_) return kReject;
+        s.stack.push_back(bracket);
+        return intern({bracket == '{' ? Mode::ObjectFirst : Mode::ArrayFirst, 0, false, s.stack});
+    };
+    auto close = [&](char bracket) {
+        if (s.stack.empty() || s.stack.back() != bracket) return kReject;
+        s.stack.pop_back();
+        return intern(after_value(s.stack));
+    };
+
+    // First byte of a value
+    auto begin_value = [&]() {
+        if (object_only_ && s.stack.empty() && b != '{') return kReject;
+        switch (b) {
+        case '{': return open('{');
+        case '[': return open('[');
+        case '"': return intern({Mode::String, 0, false, s.stack});
+        case '-': return intern({Mode::Minus, 0, false, s.stack});
+        case '0': return intern({Mode::Zero, 0, false, s.stack});
+        case 't': return intern({Mode::Literal, 0 << 3 | 1, false, s.stack});
+        case 'f': return intern({Mode::Literal, 1 << 3 | 1, false, s.stack});
+        case 'n': return intern({Mode::Literal, 2 << 3 | 1, false, s.stack});
+        default:
+            return is_digit(b) ? intern({Mode::Integer, 0, false, s.stack}) : kReject;
+        }
+    };
+
+    // A byte that is not part of the number ends it and is read after it
+    auto end_number = [&]() {
+        State after = after_value(s.stack);
+        if (after.mode == Mode::Done) return kReject;
+        return step(intern(after), b);
+    };
+    auto number = [&](Mode mode) { return intern({mode, 0, false, s.stack}); };
+
+    switch (s.mode) {
+    case Mode::Value:
+        return is_whitespace(b) ? id : begin_value();
+    case Mode::ArrayFirst:
+        if (is_whitespace(b)) return id;
+        return b == ']' ? close('[') : begin_value();
+    case Mode::ObjectFirst:
+        if (is_whitespace(b)) return id;
+        if (b == '}') return close('{');
+        return b == '"' ? intern({Mode::String, 0, true, s.stack}) : kReject;
+    case Mode::Key:
+        if (is_whitespace(b)) return id;
+        return b == '"' ? intern({Mode::String, 0, true, s.stack}) : kReject;
+    case Mode::Colon:
+        if (is_whitespace(b)) return id;
+        return b == ':' ? intern({Mode::Value, 0, false, s.stack}) : kReject;
+    case Mode::AfterValue:
+        if (is_whitespace(b)) return id;
+        if (b == ',') return intern({s.stack.back() == '[' ? Mode::Value : Mode::Key, 0, false, s.stack});
+        if (b == ']') return close('[');
+        if (b == '}') return close('{');
+        return kReject;
+    case Mode::Done:
+        return kReject;
+
+    case Mode::String:
+        if (b == '"') return s.key ? intern({Mode::Colon, 0, false, s.stack}) : intern(after_value(s.stack));
+        if (b == '\\') return intern({Mode::Escape, 0, s.key, s.stack});
+        if (b < 0x20) return kReject;
+        if (b < 0x80) return id;
+        if (b >= 0xC2 && b <= 0xDF) return intern({Mode::Utf8, 1, s.key, s.stack});
+        if (b == 0xE0) return intern({Mode::Utf8, 2 | 1 << 4, s.key, s.stack});
+        if (b == 0xED) return intern({Mode::Utf8, 2 | 2 << 4, s.key, s.stack});
+        if (b >= 0xE1 && b <= 0xEF) return intern({Mode::Utf8, 2, s.key, s.stack});
+        if (b == 0xF0) return intern({Mode::Utf8, 3 | 3 << 4, s.key, s.stack});
+        if (b >= 0xF1 && b <= 0xF3) return intern({Mode::Utf8, 3, s.key, s.stack});
+        if (b == 0xF4) return intern({Mode::Utf8, 3 | 4 << 4, s.key, s.stack});
+        return kReject;
+    case Mode::Utf8: {
+        if (!continuation_allowed(s.aux >> 4, b)) return kReject;
+        uint8_t left = (s.aux & 0x0F) - 1;
+        return intern({left == 0 ? Mode::String : Mode::Utf8, left, s.key, s.stack});
+    }
+    case Mode::Escape:
+        if (b == 'u') return intern({Mode::Unicode, 4, s.key, s.stack});
+        return std::strchr("\"\\/bfnrt", b) && b ? intern({Mode::String, 0, s.key, s.stack}) : kReject;
+    case Mode::Unicode: {
+        if (hex_value(static_cast<char>(b)) < 0) return kReject;
+        uint8_t left = s.aux - 1;
+        return intern({left == 0 ? Mode::String : Mode::Unicode, left, s.key, s.stack});
+    }
+    case Mode::Literal: {
+        const char* literal = kLiterals[s.aux >> 3];
+        size_t position = s.aux & 7;
+        if (b != static_cast<uint8_t>(literal[position])) return kReject;
+        if (literal[position + 1] == '\0') return intern(after_value(s.stack));
+        return intern({Mode::Literal, static_cast<uint8_t>(s.aux + 1), false, s.stack});
+    }
+
+    case Mode::Minus:
+        if (b == '0') return number(Mode::Zero);
+        return is_digit(b) ? number(Mode::Integer) : kReject;
+    case Mode::Zero:
+        if (b == '.') return number(Mode::Point);
+        if (b == 'e' || b == 'E') return number(Mode::Exponent);
+        return end_number();
+    case Mode::Integer:
+        if (is_digit(b)) return id;
+        if (b == '.') return number(Mode::Point);
+        if (b == 'e' || b == 'E') return number(Mode::Exponent);
+        return end_number();
+    case Mode::Point:
+        return is_digit(b) ? number(Mode::Fraction) : kReject;
+    case Mode::Fraction:
+        if (is_digit(b)) return id;
+        if (b == 'e' || b == 'E') return number(Mode::Exponent);
+        return end_number();
+    case Mode::Exponent:
+        if (b == '+' || b == '-') return number(Mode::ExponentSign);
+        return is_digit(b) ? number(Mode::ExponentDigits) : kReject;
+    case Mode::ExponentSign:
+        return is_digit(b) ? number(Mode::ExponentDigits) : kReject;
+    case Mode::ExponentDigits:
+        return is_digit(b) ? id : end_number();
+    }
+    return kReject;
+}
@@ -1,33 +1,376 @@
 #include "inference_engine.h"
 #include <iostream>
 #include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <mutex>
+#include <sstream>
 
-InferenceEngine::InferenceEngine()
-    : memory_info_(Ort::MemoryInfo::CreateCpu(OrtArenaAllocator, OrtMemTypeDefault)),
-      vocab_size_(50257) { // GPT-2 default vocab size
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+namespace {
+
+// CPUs of a NUMA node, from its sysfs cpulist (e.g. "0-15,32-47")
+std::vector<int> numa_node_cpus(int node) {
+    std::vector<int> cpus;
+    std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+    std::string list;
+    if (!std::getline(file, list)) return cpus;
+
+    std::stringstream ranges(list);
+    std::string range;
+    while (std::getline(ranges, range, ',')) {
+        try {
+            size_t dash = range.find('-');
+            int first = std::stoi(range.substr(0, dash));
+            int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+            for (int cpu = first; cpu <= last; cpu++) {
+                cpus.push_back(cpu);
+            }
+        } catch (const std::exception&) {
+            return {};
+        }
+    }
+    return cpus;
+}
+
+// ONNX Runtime affinity string giving intra-op threads 1 .. num_threads - 1
+// one CPU each; thread 0 is the calling thread, which it never pins
+std::string one_cpu_per_thread(const std::vector<int>& cpus, int num_threads) {
+    std::string affinity;
+    for (int t = 1; t < num_threads; t++) {
+        if (!affinity.empty()) affinity += ';';
+        affinity += std::to_string(cpus[t % cpus.size()] + 1);  // 1-based
+    }
+    return affinity;
+}
+
+bool pin_current_thread(const std::vector<int>& cpus) {
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus) {
+        if (cpu < CPU_SETSIZE) CPU_SET(cpu, &set);
+    }
+    return sched_setaffinity(0, sizeof(set), &set) == 0;
+#else
+    (void)cpus;
+    return false;
+#endif
+}
+
+// ONNX Runtime keeps one Env per process, so every engine shares this one.
+// Global thread pools can only be attached when it is first created.
+std::shared_ptr<Ort::Env> shared_env(const EngineOptions& options, bool& global_pools) {
+    static std::mutex mutex;
+    static std::weak_ptr<Ort::Env> env;
+    static bool env_has_global_pools = false;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (auto existing = env.lock()) {
+        global_pools = env_has_global_pools;
+        return existing;
+    }
+
+    std::shared_ptr<Ort::Env> created;
+    if (options.global_thread_pool) {
+        Ort::ThreadingOptions threading;
+        threading.SetGlobalIntraOpNumThreads(options.intra_op_threads);
+        threading.SetGlobalInterOpNumThreads(options.inter_op_threads);
+        threading.SetGlobalSpinControl(options.allow_spinning ? 1 : 0);
+        if (!options.intra_op_affinity.empty()) {
+            Ort::ThrowOnError(Ort::GetApi().SetGlobalIntraOpThreadAffinity(
+                threading, options.intra_op_affinity.c_str()));
+        }
+        created = std::make_shared<Ort::Env>(threading, ORT_LOGGING_LEVEL_WARNING, "InferenceEngine");
+    } else {
+        created = std::make_shared<Ort::Env>(ORT_LOGGING_LEVEL_WARNING, "InferenceEngine");
+    }
+
+    env = created;
+    env_has_global_pools = options.global_thread_pool;
+    global_pools = env_has_global_pools;
+    return created;
+}
+
+uint64_t mix64(uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ull;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebull;
+    x ^= x >> 31;
+    return x;
+}
+
+// 64-bit hash of a file's contents, eight bytes at a time so hashing a
+// large model costs little next to loading it
+bool hash_file(const std::string& path, uint64_t& hash) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open()) return false;
+
+    std::vector<char> buffer(1 << 20);
+    uint64_t h = 0x9e3779b97f4a7c15ull;
+    uint64_t total = 0;
+    while (file) {
+        file.read(buffer.data(), buffer.size());
+        size_t n = static_cast<size_t>(file.gcount());
+        total += n;
+
+        size_t i = 0;
+        for (; i + 8 <= n; i += 8) {
+            uint64_t word;
+            std::memcpy(&word, buffer.data() + i, 8);
+            h = mix64(h ^ word) + i;
+        }
+        for (; i < n; i++) {
+            h = mix64(h ^ static_cast<unsigned char>(buffer[i]));
+        }
+    }
+    hash = mix64(h ^ total);
+    return true;
+}
+
+uint64_t hash_string(const std::string& text, uint64_t seed) {
+    uint64_t h = seed;
+    for (unsigned char c : text) {
+        h = mix64(h ^ c);
+    }
+    return h;
+}
+
+// Optimized graphs can contain kernels picked for the CPU they were built on
+std::string cpu_tag() {
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) return "x86-avx512";
+    if (__builtin_cpu_supports("avx2")) return "x86-avx2";
+    return "x86";
+#elif defined(__aarch64__) || defined(_M_ARM64)
+    return "arm64";
+#else
+    return "generic";
+#endif
+}
+
+const char* optimization_level_name(GraphOptimizationLevel level) {
+    switch (level) {
+        case ORT_DISABLE_ALL: return "disabled";
+        case ORT_ENABLE_BASIC: return "basic";
+        case ORT_ENABLE_EXTENDED: return "extended";
+        default: return "all";
+    }
+}
+
+} // namespace
+
+InferenceEngine::InferenceEngine(const EngineOptions& options)
+    : options_(options),
+      memory_info_(Ort::MemoryInfo::CreateCpu(OrtArenaAllocator, OrtMemTypeDefault)),
+      vocab_size_(50257), // GPT-2 default vocab size
+      num_heads_(0),
+      head_dim_(0),
+      has_position_ids_(false),
+      has_use_cache_branch_(false),
+      empty_past_(0.0f),
+      logits_batch_(0),
+      logits_len_(0),
+      profiling_(false) {
+
+    // NUMA pinning: keep the calling thread on the node and give each
+    // intra-op thread one of its CPUs, so activations and weights stay local
+    if (options_.numa_node >= 0 && options_.intra_op_affinity.empty()) {
+        std::vector<int> cpus = numa_node_cpus(options_.numa_node);
+        if (cpus.empty()) {
+            std::cerr << "NUMA node " << options_.numa_node << " not found, threads are not pinned" << std::endl;
+        } else {
+            if (options_.intra_op_threads <= 0) {
+                options_.intra_op_threads = static_cast<int>(cpus.size());
+            }
+            options_.intra_op_affinity = one_cpu_per_thread(cpus, options_.intra_op_threads);
+            if (!pin_current_thread(cpus)) {
+                std::cerr << "Failed to pin the calling thread to NUMA node " << options_.numa_node << std::endl;
+            }
+        }
+    }
+
+    bool global_pools = false;
+    env_ = shared_env(options_, global_pools);
+    if (options_.global_thread_pool && !global_pools) {
+        std::cerr << "Ort::Env already exists without global thread pools, using per-session threads" << std::endl;
+        options_.global_thread_pool = false;
+    }
 
-    env_ = std::make_unique<Ort::Env>(ORT_LOGGING_LEVEL_WARNING, "InferenceEngine");
     session_options_ = std::make_unique<Ort::SessionOptions>();
+    session_options_->SetIntraOpNumThreads(options_.intra_op_threads);
+    session_options_->SetInterOpNumThreads(options_.inter_op_threads);
+    session_options_->SetExecutionMode(options_.parallel_execution ? ORT_PARALLEL : ORT_SEQUENTIAL);
+    session_options_->SetGraphOptimizationLevel(options_.optimization_level);
+
+    const char* spin = options_.allow_spinning ? "1" : "0";
+    session_options_->AddConfigEntry("session.intra_op.allow_spinning", spin);
+    session_options_->AddConfigEntry("session.inter_op.allow_spinning", spin);
+
+    if (options_.global_thread_pool) {
+        // Thread counts, spinning and affinity were applied to the Env's pools
+        session_options_->DisablePerSessionThreads();
+    } else if (!options_.intra_op_affinity.empty()) {
+        session_options_->AddConfigEntry("session.intra_op_thread_affinities", options_.intra_op_affinity.c_str());
+    }
+
+    if (!options_.profile_prefix.empty()) {
+#ifdef _WIN32
+        std::wstring wide_prefix(options_.profile_prefix.begin(), options_.profile_prefix.end());
+        session_options_->EnableProfiling(wide_prefix.c_str());
+#else
+        session_options_->EnableProfiling(options_.profile_prefix.c_str());
+#endif
+    }
+}
 
-    // Set optimization level
-    session_options_->SetIntraOpNumThreads(1);
-    session_options_->SetGraphOptimizationLevel(GraphOptimizationLevel::ORT_ENABLE_BASIC);
+InferenceEngine::~InferenceEngine() {
+    end_profiling();
 }
 
-InferenceEngine::~InferenceEngine() {}
+std::string InferenceEngine::end_profiling() {
+    if (!profiling_ || !session_) return "";
+    try {
+        Ort::AllocatorWithDefaultOptions allocator;
+        std::string path = session_->EndProfilingAllocated(allocator).get();
+        if (!path.empty()) {
+            std::cout << "Wrote ONNX Runtime profile: " << path << std::endl;
+        }
+        profiling_ = false;
+        return path;
+    } catch (const Ort::Exception& e) {
+        std::cerr << "ONNX Runtime error: " << e.what() << std::endl;
+        return "";
+    }
+}
 
 bool InferenceEngine::load_model(const std::string& model_path) {
     try {
         std::cout << "Loading model from: " << model_path << std::endl;
 
-        // Create session
+        auto load_start = std::chrono::steady_clock::now();
+        binding_.reset();
+        session_.reset();
+        shared_model_.reset();
+
+        // Create session, from the optimized graph cache when possible
+        std::string cache_status = "off";
+        std::string cache_path;
+        if (!options_.optimized_model_dir.empty()) {
+            cache_path = optimized_model_path(model_path);
+            if (cache_path.empty()) {
+                std::cerr << "Cannot hash " << model_path << ", optimized model cache disabled" << std::endl;
+            }
+        }
+
+        std::error_code ec;
+        if (!cache_path.empty() && std::filesystem::exists(cache_path, ec)) {
+            Ort::SessionOptions cached_options = session_options_->Clone();
+            cached_options.SetGraphOptimizationLevel(ORT_DISABLE_ALL);
+            try {
+                create_session(cache_path, cached_options);
+                cache_status = "hit";
+            } catch (const Ort::Exception& e) {
+                std::cerr << "Discarding unreadable optimized model " << cache_path << ": " << e.what() << std::endl;
+                std::filesystem::remove(cache_path, ec);
+            }
+        }
+
+        if (!session_) {
+            if (cache_path.empty()) {
+                create_session(model_path, *session_options_);
+            } else {
+                // Write to a private file and rename it into place, so processes
+                // starting together never read a half-written graph
+                std::filesystem::create_directories(options_.optimized_model_dir, ec);
+                std::string temp_path = cache_path + ".tmp" +
+                    std::to_string(std::chrono::steady_clock::now().time_since_epoch().count());
+
+                Ort::SessionOptions writing_options = session_options_->Clone();
 #ifdef _WIN32
-        // Convert to wide string for Windows
-        std::wstring wide_path(model_path.begin(), model_path.end());
-        session_ = std::make_unique<Ort::Session>(*env_, wide_path.c_str(), *session_options_);
+                std::wstring wide_temp_path(temp_path.begin(), temp_path.end());
+                writing_options.SetOptimizedModelFilePath(wide_temp_path.c_str());
 #else
-        session_ = std::make_unique<Ort::Session>(*env_, model_path.c_str(), *session_options_);
+                writing_options.SetOptimizedModelFilePath(temp_path.c_str());
 #endif
+                create_session(model_path, writing_options);
+
+                std::filesystem::rename(temp_path, cache_path, ec);
+                if (ec) {
+                    std::cerr << "Failed to store optimized model " << cache_path << ": " << ec.message() << std::endl;
+                    std::filesystem::remove(temp_path, ec);
+                    cache_status = "off";
+                } else {
+                    cache_status = "miss, written";
+                }
+            }
+        }
+        double load_ms = std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - load_start).count();
+
+        return finish_load(load_ms, "optimized model cache: " + cache_status +
+                                    (cache_path.empty() ? "" : ", " + cache_path));
+
+    } catch (const Ort::Exception& e) {
+        std::cerr << "ONNX Runtime error: " << e.what() << std::endl;
+        return false;
+    }
+}
+
+bool InferenceEngine::load_model(std::shared_ptr<SharedModel> model) {
+    try {
+        if (!model || !model->data()) {
+            std::cerr << "Shared model is not open" << std::endl;
+            return false;
+        }
+        std::cout << "Loading shared model: " << model->path() << std::endl;
+        if (!options_.optimized_model_dir.empty()) {
+            std::cout << "Optimized model cache is not used for shared models" << std::endl;
+        }
+
+        auto load_start = std::chrono::steady_clock::now();
+        binding_.reset();
+        session_.reset();
+
+        // The session parses the shared mapping and takes the large weights
+        // from the shared initializers; prepacked kernels are reused from (or
+        // added to) the shared container
+        Ort::SessionOptions options = session_options_->Clone();
+        model->add_initializers(options);
+        session_ = std::make_unique<Ort::Session>(*env_, model->data(), model->size(), options,
+                                                  model->prepacked_weights());
+        shared_model_ = std::move(model);
+
+        double load_ms = std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - load_start).count();
+        return finish_load(load_ms, std::to_string(shared_model_->num_initializers()) + " shared initializers");
+
+    } catch (const Ort::Exception& e) {
+        std::cerr << "ONNX Runtime error: " << e.what() << std::endl;
+        return false;
+    }
+}
+
+bool InferenceEngine::finish_load(double load_ms, const std::string& load_note) {
+    profiling_ = !options_.profile_prefix.empty();
+    try {
+        std::cout << "Threads: intra-op " << (options_.intra_op_threads > 0 ? std::to_string(options_.intra_op_threads) : "auto")
+                  << ", inter-op " << (options_.inter_op_threads > 0 ? std::to_string(options_.inter_op_threads) : "auto")
+                  << (options_.parallel_execution ? ", parallel" : ", sequential")
+                  << (options_.global_thread_pool ? ", global pool" : "")
+                  << (options_.allow_spinning ? "" : ", no spinning")
+                  << "; optimization " << optimization_level_name(options_.optimization_level) << std::endl;
+
+        input_names_.clear();
+        output_names_.clear();
 
         // Get input names
         Ort::AllocatorWithDefaultOptions allocator;
@@ -49,7 +392,65 @@ bool InferenceEngine::load_model(const std::string& model_path) {
             std::cout << "  Output " << i << ": " << output_names_.back() << std::endl;
         }
 
-        std::cout << "Model loaded successfully" << std::endl;
+        // Logits shape: [batch, seq_len, vocab_size]
+        for (size_t i = 0; i < output_names_.size(); i++) {
+            if (output_names_[i] != "logits") continue;
+            auto shape = session_->GetOutputTypeInfo(i).GetTensorTypeAndShapeInfo().GetShape();
+            if (shape.size() == 3 && shape[2] > 0) {
+                vocab_size_ = static_cast<int>(shape[2]);
+            }
+        }
+
+        binding_ = std::make_unique<Ort::IoBinding>(*session_);
+
+        has_position_ids_ = has_input("position_ids");
+        has_use_cache_branch_ = has_input("use_cache_branch");
+
+        // Pair every past_key_values.* input with its present.* output
+        past_names_.clear();
+        present_names_.clear();
+        const std::string past_prefix = "past_key_values.";
+        for (size_t i = 0; i < input_names_.size(); i++) {
+            const std::string& name = input_names_[i];
+            if (name.compare(0, past_prefix.size(), past_prefix) != 0) continue;
+
+            std::string present = "present." + name.substr(past_prefix.size());
+            if (std::find(output_names_.begin(), output_names_.end(), present) == output_names_.end()) {
+                std::cerr << "Model has " << name << " but no " << present << " output" << std::endl;
+                past_names_.clear();
+                present_names_.clear();
+                break;
+            }
+
+            // Past shape: [batch, num_heads, past_seq_len, head_dim]
+            auto shape = session_->GetInputTypeInfo(i).GetTensorTypeAndShapeInfo().GetShape();
+            if (shape.size() != 4 || shape[1] <= 0 || shape[3] <= 0) {
+                std::cerr << "Unsupported shape for " << name << std::endl;
+                past_names_.clear();
+                present_names_.clear();
+                break;
+            }
+            num_heads_ = shape[1];
+            head_dim_ = shape[3];
+
+            past_names_.push_back(name);
+            present_names_.push_back(present);
+        }
+
+        if (supports_kv_cache()) {
+            std::cout << "KV cache: " << past_names_.size() / 2 << " layers, "
+                      << num_heads_ << " heads, head dim " << head_dim_ << std::endl;
+        } else {
+            std::cout << "KV cache: not supported by model, using full recompute" << std::endl;
+        }
+
+        std::cout << "Model loaded successfully in " << std::fixed << std::setprecision(1) << load_ms
+                  << " ms (" << load_note << ")" << std::endl;
+        std::cout.unsetf(std::ios::floatfield);
+
+        if (options_.warm_up) {
+            warm_up();
+        }
         return true;
 
     } catch (const Ort::Exception& e) {
@@ -58,18 +459,123 @@ bool InferenceEngine::load_model(const std::string& model_path) {
     }
 }
 
-std::vector<int64_t> InferenceEngine::get_output_shape(size_t seq_len) {
-    return {1, static_cast<int64_t>(seq_len), static_cast<int64_t>(vocab_size_)};
+std::vector<int64_t> InferenceEngine::get_output_shape(size_t batch_size, size_t seq_len) {
+    return {static_cast<int64_t>(batch_size), static_cast<int64_t>(seq_len), static_cast<int64_t>(vocab_size_)};
+}
+
+void InferenceEngine::create_session(const std::string& path, const Ort::SessionOptions& options) {
+#ifdef _WIN32
+    // Convert to wide string for Windows
+    std::wstring wide_path(path.begin(), path.end());
+    session_ = std::make_unique<Ort::Session>(*env_, wide_path.c_str(), options);
+#else
+    session_ = std::make_unique<Ort::Session>(*env_, path.c_str(), options);
+#endif
+}
+
+std::string InferenceEngine::optimized_model_path(const std::string& model_path) const {
+    uint64_t hash;
+    if (!hash_file(model_path, hash)) return "";
+
+    // Everything that changes the optimized graph goes into the key
+    std::string settings = Ort::GetVersionString() + "|" +
+        optimization_level_name(options_.optimization_level) + "|" +
+        (options_.parallel_execution ? "parallel" : "sequential") + "|" + cpu_tag();
+    uint64_t key = hash_string(settings, hash);
+
+    std::ostringstream name;
+    name << std::filesystem::path(model_path).stem().string() << "-"
+         << std::hex << std::setw(16) << std::setfill('0') << key << ".onnx";
+    return (std::filesystem::path(options_.optimized_model_dir) / name.str()).string();
+}
+
+void InferenceEngine::warm_up() {
+    auto start = std::chrono::steady_clock::now();
+
+    // A short prefill, then one cached decode step: the merged decoder runs a
+    // different branch for each
+    std::vector<int64_t> prompt(8, 0);
+    KVCache cache;
+    bool ok = forward(prompt, cache);
+    if (ok && supports_kv_cache()) {
+        std::vector<int64_t> next(1, 0);
+        ok = forward(next, cache);
+    }
+
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    if (ok) {
+        std::cout << "Warm-up: " << std::fixed << std::setprecision(1) << ms << " ms" << std::endl;
+        std::cout.unsetf(std::ios::floatfield);
+    } else {
+        std::cerr << "Warm-up forward pass failed" << std::endl;
+    }
+}
+
+bool InferenceEngine::has_input(const std::string& name) const {
+    return std::find(input_names_.begin(), input_names_.end(), name) != input_names_.end();
+}
+
+bool InferenceEngine::forward(const std::vector<int64_t>& input_ids) {
+    KVCache cache;
+    return forward(input_ids, cache);
+}
+
+bool InferenceEngine::forward(const std::vector<int64_t>& input_ids, KVCache& cache) {
+    ones_.assign(input_ids.size(), 1);
+    return forward(input_ids, ones_, 1, cache);
 }
 
-std::vector<float> InferenceEngine::forward(const std::vector<int64_t>& input_ids, bool use_cache) {
+LogitsView InferenceEngine::logits(size_t batch_index, size_t position) const {
+    if (batch_index >= logits_batch_ || position >= logits_len_) return {};
+    size_t vocab = static_cast<size_t>(vocab_size_);
+    return {logits_.data() + (batch_index * logits_len_ + position) * vocab, vocab};
+}
+
+LogitsView InferenceEngine::last_logits(size_t batch_index) const {
+    if (logits_len_ == 0) return {};
+    return logits(batch_index, logits_len_ - 1);
+}
+
+float* InferenceEngine::mutable_last_logits(size_t batch_index) {
+    if (batch_index >= logits_batch_ || logits_len_ == 0) return nullptr;
+    size_t vocab = static_cast<size_t>(vocab_size_);
+    return logits_.data() + (batch_index * logits_len_ + logits_len_ - 1) * vocab;
+}
+
+bool InferenceEngine::forward(const std::vector<int64_t>& input_ids,
+                              const std::vector<int64_t>& attention_mask,
+                              size_t batch_size,
+                              KVCache& cache) {
+    logits_batch_ = 0;
+    logits_len_ = 0;
+
     try {
-        size_t seq_len = input_ids.size();
+        if (!binding_) {
+            std::cerr << "Inference error: no model loaded" << std::endl;
+            return false;
+        }
+        if (batch_size == 0 || input_ids.empty() || input_ids.size() % batch_size != 0 ||
+            attention_mask.size() != input_ids.size()) {
+            std::cerr << "Inference error: input_ids/attention_mask do not match batch size "
+                      << batch_size << std::endl;
+            return false;
+        }
+
+        size_t seq_len = input_ids.size() / batch_size;
+        int64_t past_len = supports_kv_cache() ? cache.length() : 0;
+        int64_t total_len = past_len + static_cast<int64_t>(seq_len);
+
+        if (past_len > 0 && cache.batch_size() != batch_size) {
+            std::cerr << "Inference error: cache holds " << cache.batch_size()
+                      << " rows but batch has " << batch_size << std::endl;
+            return false;
+        }
 
-        // Prepare input tensor shape: [batch_size=1, seq_len]
-        std::vector<int64_t> input_shape = {1, static_cast<int64_t>(seq_len)};
+        // Prepare input tensor shape: [batch_size, seq_len]
+        int64_t batch = static_cast<int64_t>(batch_size);
+        std::vector<int64_t> input_shape = {batch, static_cast<int64_t>(seq_len)};
 
-        // Create input_ids tensor
+        // Create input_ids tensor over the caller's buffer
         auto input_ids_tensor = Ort::Value::CreateTensor<int64_t>(
             memory_info_,
             const_cast<int64_t*>(input_ids.data()),
@@ -78,64 +584,153 @@ std::vector<float> InferenceEngine::forward(const std::vector<int64_t>& input_id
             input_shape.size()
         );
 
-        // Create attention_mask tensor (all ones)
-        std::vector<int64_t> attention_mask(seq_len, 1);
+        // Create attention_mask tensor: cached mask for past positions followed
+        // by the mask of the new tokens, per row
+        full_mask_.resize(batch_size * total_len);
+        for (size_t b = 0; b < batch_size; b++) {
+            int64_t* row = full_mask_.data() + b * total_len;
+            if (past_len > 0) {
+                std::copy_n(cache.attention_mask_.data() + b * past_len, past_len, row);
+            }
+            std::copy_n(attention_mask.data() + b * seq_len, seq_len, row + past_len);
+        }
+        std::vector<int64_t> mask_shape = {batch, total_len};
         auto attention_mask_tensor = Ort::Value::CreateTensor<int64_t>(
             memory_info_,
-            attention_mask.data(),
-            attention_mask.size(),
-            input_shape.data(),
-            input_shape.size()
+            full_mask_.data(),
+            full_mask_.size(),
+            mask_shape.data(),
+            mask_shape.size()
         );
 
-        // Create use_cache_branch tensor (bool)
-        // Note: std::vector<bool> doesn't have .data(), so we use a plain bool
-        bool use_cache_value = use_cache;
-        std::vector<int64_t> scalar_shape = {1};
-        auto use_cache_tensor = Ort::Value::CreateTensor<bool>(
-            memory_info_,
-            &use_cache_value,
-            1,
-            scalar_shape.data(),
-            scalar_shape.size()
-        );
+        // Position ids count only real tokens, so left padding does not shift them
+        if (past_len > 0) {
+            next_positions_.assign(cache.next_positions_.begin(), cache.next_positions_.end());
+        } else {
+            next_positions_.assign(batch_size, 0);
+        }
+        position_ids_.assign(input_ids.size(), 0);
+        for (size_t b = 0; b < batch_size; b++) {
+            for (size_t t = 0; t < seq_len; t++) {
+                if (attention_mask[b * seq_len + t] != 0) {
+                    position_ids_[b * seq_len + t] = next_positions_[b]++;
+                }
+            }
+        }
 
-        // Prepare inputs
+        // Bind inputs; the tensors must stay alive until Run returns
         std::vector<Ort::Value> input_tensors;
+        std::vector<const char*> input_names_cstr;
         input_tensors.push_back(std::move(input_ids_tensor));
+        input_names_cstr.push_back("input_ids");
         input_tensors.push_back(std::move(attention_mask_tensor));
-        input_tensors.push_back(std::move(use_cache_tensor));
+        input_names_cstr.push_back("attention_mask");
 
-        // Prepare input/output names as C strings
-        std::vector<const char*> input_names_cstr = {"input_ids", "attention_mask", "use_cache_branch"};
+        if (has_position_ids_) {
+            input_tensors.push_back(Ort::Value::CreateTensor<int64_t>(
+                memory_info_,
+                position_ids_.data(),
+                position_ids_.size(),
+                input_shape.data(),
+                input_shape.size()
+            ));
+            input_names_cstr.push_back("position_ids");
+        }
 
-        std::vector<const char*> output_names_cstr;
-        for (const auto& name : output_names_) {
-            output_names_cstr.push_back(name.c_str());
+        // Past keys/values: the cached tensors, or zero-length ones on the first step
+        std::vector<int64_t> empty_past_shape = {batch, num_heads_, 0, head_dim_};
+        for (size_t i = 0; i < past_names_.size(); i++) {
+            if (past_len > 0) {
+                input_tensors.push_back(std::move(cache.tensors_[i]));
+            } else {
+                input_tensors.push_back(Ort::Value::CreateTensor<float>(
+                    memory_info_,
+                    &empty_past_,
+                    0,
+                    empty_past_shape.data(),
+                    empty_past_shape.size()
+                ));
+            }
+            input_names_cstr.push_back(past_names_[i].c_str());
         }
 
-        // Run inference
-        auto output_tensors = session_->Run(
-            Ort::RunOptions{nullptr},
-            input_names_cstr.data(),
-            input_tensors.data(),
-            input_tensors.size(),
-            output_names_cstr.data(),
-            output_names_cstr.size()
+        // Create use_cache_branch tensor (bool)
+        // Note: std::vector<bool> doesn't have .data(), so we use a plain bool
+        bool use_cache_value = past_len > 0;
+        std::vector<int64_t> scalar_shape = {1};
+        if (has_use_cache_branch_) {
+            input_tensors.push_back(Ort::Value::CreateTensor<bool>(
+                memory_info_,
+                &use_cache_value,
+                1,
+                scalar_shape.data(),
+                scalar_shape.size()
+            ));
+            input_names_cstr.push_back("use_cache_branch");
+        }
+
+        binding_->ClearBoundInputs();
+        binding_->ClearBoundOutputs();
+        for (size_t i = 0; i < input_tensors.size(); i++) {
+            binding_->BindInput(input_names_cstr[i], input_tensors[i]);
+        }
+
+        // Logits go straight into the reused buffer, which only ever grows
+        std::vector<int64_t> logits_shape = get_output_shape(batch_size, seq_len);
+        size_t logits_size = batch_size * seq_len * static_cast<size_t>(vocab_size_);
+        if (logits_.size() < logits_size) {
+            logits_.resize(logits_size);
+        }
+        auto logits_tensor = Ort::Value::CreateTensor<float>(
+            memory_info_,
+            logits_.data(),
+            logits_size,
+            logits_shape.data(),
+            logits_shape.size()
         );
+        binding_->BindOutput("logits", logits_tensor);
 
-        // Get logits from output
-        float* output_data = output_tensors[0].GetTensorMutableData<float>();
-        auto output_shape_info = output_tensors[0].GetTensorTypeAndShapeInfo();
-        size_t output_size = output_shape_info.GetElementCount();
+        // present.* outputs grow every step, so ONNX Runtime allocates them
+        for (const auto& name : present_names_) {
+            binding_->BindOutput(name.c_str(), memory_info_);
+        }
+
+        // The cache tensors were moved into the inputs; drop them until Run succeeds
+        cache.clear();
+
+        // Run inference
+        session_->Run(Ort::RunOptions{nullptr}, *binding_);
+
+        // Outputs come back in binding order: logits, then present.* in past order
+        std::vector<Ort::Value> output_tensors = binding_->GetOutputValues();
 
-        // Copy output data
-        std::vector<float> logits(output_data, output_data + output_size);
+        // Release the inputs (including the old past tensors) held by the binding
+        binding_->ClearBoundInputs();
+        binding_->ClearBoundOutputs();
 
-        return logits;
+        // Keep present keys/values for the next step
+        if (supports_kv_cache()) {
+            for (size_t i = 1; i < output_tensors.size(); i++) {
+                cache.tensors_.push_back(std::move(output_tensors[i]));
+            }
+            // Trade buffers with the cache so neither side reallocates per step
+            cache.attention_mask_.swap(full_mask_);
+            cache.next_positions_.swap(next_positions_);
+            cache.batch_size_ = batch_size;
+            cache.length_ = total_len;
+        }
+
+        logits_batch_ = batch_size;
+        logits_len_ = seq_len;
+        return true;
 
     } catch (const Ort::Exception& e) {
         std::cerr << "Inference error: " << e.what() << std::endl;
-        return {};
+        if (binding_) {
+            binding_->ClearBoundInputs();
+            binding_->ClearBoundOutputs();
+        }
+        cache.clear();
+        return false;
     }
 }
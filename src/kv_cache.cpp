@@ -0,0 +1,350 @@
+#include "kv_cache.h"
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <stdexcept>
+
+namespace {
+
+// Shape of a past tensor split into its row and per-row parts
+struct PastShape {
+    int64_t batch;
+    int64_t num_heads;
+    int64_t length;
+    int64_t head_dim;
+};
+
+PastShape past_shape(const Ort::Value& tensor) {
+    auto shape = tensor.GetTensorTypeAndShapeInfo().GetShape();
+    return {shape[0], shape[1], shape[2], shape[3]};
+}
+
+Ort::Value allocate_past(int64_t batch, int64_t num_heads, int64_t length, int64_t head_dim) {
+    Ort::AllocatorWithDefaultOptions allocator;
+    std::vector<int64_t> shape = {batch, num_heads, length, head_dim};
+    auto tensor = Ort::Value::CreateTensor<float>(allocator, shape.data(), shape.size());
+    // Padding slots must stay finite: masked scores are offset, not replaced
+    std::memset(tensor.GetTensorMutableData<float>(), 0,
+                sizeof(float) * batch * num_heads * length * head_dim);
+    return tensor;
+}
+
+// Slicing and concatenation assume positions are the row's token indices
+void check_unpadded(const std::vector<int64_t>& mask, size_t batch_size, const char* caller) {
+    if (batch_size != 1 || std::find(mask.begin(), mask.end(), 0) != mask.end()) {
+        throw std::runtime_error(std::string(caller) + ": needs a single row without padding");
+    }
+}
+
+} // namespace
+
+void KVCache::select_rows(const std::vector<size_t>& rows) {
+    if (rows.empty() || empty()) {
+        clear();
+        return;
+    }
+
+    // Left padding means leading columns that are masked in every kept row
+    // can be dropped without changing any row's attention
+    int64_t first = length_;
+    for (size_t row : rows) {
+        const int64_t* mask = attention_mask_.data() + row * length_;
+        int64_t col = 0;
+        while (col < length_ && mask[col] == 0) col++;
+        first = std::min(first, col);
+    }
+    int64_t new_length = length_ - first;
+    int64_t new_batch = static_cast<int64_t>(rows.size());
+
+    bool identity = first == 0 && rows.size() == batch_size_;
+    for (size_t r = 0; identity && r < rows.size(); r++) {
+        identity = rows[r] == r;
+    }
+    if (identity) return;
+
+    std::vector<Ort::Value> tensors;
+    tensors.reserve(tensors_.size());
+    for (const auto& src_tensor : tensors_) {
+        PastShape shape = past_shape(src_tensor);
+        auto dst_tensor = allocate_past(new_batch, shape.num_heads, new_length, shape.head_dim);
+
+        const float* src = src_tensor.GetTensorData<float>();
+        float* dst = dst_tensor.GetTensorMutableData<float>();
+        size_t row_stride = shape.length * shape.head_dim;
+        size_t copy_size = new_length * shape.head_dim;
+        for (int64_t r = 0; r < new_batch; r++) {
+            for (int64_t h = 0; h < shape.num_heads; h++) {
+                const float* from = src + (rows[r] * shape.num_heads + h) * row_stride + first * shape.head_dim;
+                float* to = dst + (r * shape.num_heads + h) * copy_size;
+                std::memcpy(to, from, sizeof(float) * copy_size);
+            }
+        }
+        tensors.push_back(std::move(dst_tensor));
+    }
+
+    std::vector<int64_t> mask(rows.size() * new_length);
+    std::vector<int64_t> positions(rows.size());
+    for (size_t r = 0; r < rows.size(); r++) {
+        std::copy_n(attention_mask_.begin() + rows[r] * length_ + first, new_length,
+                    mask.begin() + r * new_length);
+        positions[r] = next_positions_[rows[r]];
+    }
+
+    tensors_ = std::move(tensors);
+    attention_mask_ = std::move(mask);
+    next_positions_ = std::move(positions);
+    batch_size_ = rows.size();
+    length_ = new_length;
+}
+
+void KVCache::append_rows(KVCache&& other) {
+    if (other.empty()) return;
+    if (empty()) {
+        *this = std::move(other);
+        return;
+    }
+    if (tensors_.size() != other.tensors_.size()) {
+        throw std::runtime_error("KVCache::append_rows: caches come from different models");
+    }
+
+    int64_t new_length = std::max(length_, other.length_);
+    int64_t new_batch = static_cast<int64_t>(batch_size_ + other.batch_size_);
+
+    // Copy both sets of rows, right-aligned so the newest positions line up
+    auto copy_rows = [new_length](const Ort::Value& src_tensor, float* dst, int64_t first_row) {
+        PastShape shape = past_shape(src_tensor);
+        const float* src = src_tensor.GetTensorData<float>();
+        size_t src_stride = shape.length * shape.head_dim;
+        size_t dst_stride = new_length * shape.head_dim;
+        size_t offset = (new_length - shape.length) * shape.head_dim;
+        for (int64_t r = 0; r < shape.batch; r++) {
+            for (int64_t h = 0; h < shape.num_heads; h++) {
+                std::memcpy(dst + ((first_row + r) * shape.num_heads + h) * dst_stride + offset,
+                            src + (r * shape.num_heads + h) * src_stride,
+                            sizeof(float) * src_stride);
+            }
+        }
+    };
+
+    std::vector<Ort::Value> tensors;
+    tensors.reserve(tensors_.size());
+    for (size_t i = 0; i < tensors_.size(); i++) {
+        PastShape shape = past_shape(tensors_[i]);
+        auto dst_tensor = allocate_past(new_batch, shape.num_heads, new_length, shape.head_dim);
+        float* dst = dst_tensor.GetTensorMutableData<float>();
+        copy_rows(tensors_[i], dst, 0);
+        copy_rows(other.tensors_[i], dst, static_cast<int64_t>(batch_size_));
+        tensors.push_back(std::move(dst_tensor));
+    }
+
+    std::vector<int64_t> mask(new_batch * new_length, 0);
+    auto copy_mask = [&mask, new_length](const KVCache& cache, size_t first_row) {
+        for (size_t r = 0; r < cache.batch_size_; r++) {
+            std::copy_n(cache.attention_mask_.begin() + r * cache.length_, cache.length_,
+                        mask.begin() + (first_row + r) * new_length + (new_length - cache.length_));
+        }
+    };
+    copy_mask(*this, 0);
+    copy_mask(other, batch_size_);
+
+    tensors_ = std::move(tensors);
+    attention_mask_ = std::move(mask);
+    next_positions_.insert(next_positions_.end(), other.next_positions_.begin(), other.next_positions_.end());
+    batch_size_ = static_cast<size_t>(new_batch);
+    length_ = new_length;
+    other.clear();
+}
+
+void KVCache::truncate(int64_t length) {
+    if (length >= length_) return;
+    if (length <= 0) {
+        clear();
+        return;
+    }
+
+    std::vector<Ort::Value> tensors;
+    tensors.reserve(tensors_.size());
+    for (const auto& src_tensor : tensors_) {
+        PastShape shape = past_shape(src_tensor);
+        auto dst_tensor = allocate_past(shape.batch, shape.num_heads, length, shape.head_dim);
+
+        const float* src = src_tensor.GetTensorData<float>();
+        float* dst = dst_tensor.GetTensorMutableData<float>();
+        size_t src_stride = shape.length * shape.head_dim;
+        size_t copy_size = length * shape.head_dim;
+        for (int64_t r = 0; r < shape.batch * shape.num_heads; r++) {
+            std::memcpy(dst + r * copy_size, src + r * src_stride, sizeof(float) * copy_size);
+        }
+        tensors.push_back(std::move(dst_tensor));
+    }
+
+    // Each row's next position moves back by the real tokens dropped
+    std::vector<int64_t> mask(batch_size_ * length);
+    for (size_t r = 0; r < batch_size_; r++) {
+        const int64_t* row = attention_mask_.data() + r * length_;
+        std::copy_n(row, length, mask.begin() + r * length);
+        for (int64_t col = length; col < length_; col++) {
+            next_positions_[r] -= row[col];
+        }
+    }
+
+    tensors_ = std::move(tensors);
+    attention_mask_ = std::move(mask);
+    length_ = length;
+}
+
+int64_t KVCache::evict(const std::vector<Retain>& retain) {
+    if (empty() || retain.size() != batch_size_) return 0;
+
+    // Kept columns of each row as runs of adjacent source columns
+    struct Run {
+        int64_t from;
+        int64_t count;
+    };
+    std::vector<std::vector<Run>> runs(batch_size_);
+    std::vector<int64_t> kept(batch_size_, 0);
+    int64_t dropped = 0;
+    for (size_t r = 0; r < batch_size_; r++) {
+        const int64_t* mask = attention_mask_.data() + r * length_;
+        int64_t real = std::count(mask, mask + length_, int64_t{1});
+        int64_t sink = std::clamp<int64_t>(retain[r].sink, 0, real);
+        int64_t recent = std::clamp<int64_t>(retain[r].recent, 0, real - sink);
+
+        int64_t index = 0;  // Among the row's real positions
+        for (int64_t col = 0; col < length_; col++) {
+            if (mask[col] == 0) continue;
+            if (index < sink || index >= real - recent) {
+                if (!runs[r].empty() && runs[r].back().from + runs[r].back().count == col) {
+                    runs[r].back().count++;
+                } else {
+                    runs[r].push_back({col, 1});
+                }
+            }
+            index++;
+        }
+        kept[r] = sink + recent;
+        dropped += real - kept[r];
+    }
+    int64_t new_length = *std::max_element(kept.begin(), kept.end());
+    if (dropped == 0 && new_length == length_) return 0;  // Nothing to drop, not even padding
+    if (new_length == 0) {
+        clear();
+        return dropped;
+    }
+
+    std::vector<Ort::Value> tensors;
+    tensors.reserve(tensors_.size());
+    for (const auto& src_tensor : tensors_) {
+        PastShape shape = past_shape(src_tensor);
+        auto dst_tensor = allocate_past(shape.batch, shape.num_heads, new_length, shape.head_dim);
+
+        const float* src = src_tensor.GetTensorData<float>();
+        float* dst = dst_tensor.GetTensorMutableData<float>();
+        size_t src_stride = shape.length * shape.head_dim;
+        size_t dst_stride = new_length * shape.head_dim;
+        for (int64_t r = 0; r < shape.batch; r++) {
+            for (int64_t h = 0; h < shape.num_heads; h++) {
+                const float* from = src + (r * shape.num_heads + h) * src_stride;
+                float* to = dst + (r * shape.num_heads + h) * dst_stride + (new_length - kept[r]) * shape.head_dim;
+                for (const Run& run : runs[r]) {
+                    std::memcpy(to, from + run.from * shape.head_dim, sizeof(float) * run.count * shape.head_dim);
+                    to += run.count * shape.head_dim;
+                }
+            }
+        }
+        tensors.push_back(std::move(dst_tensor));
+    }
+
+    std::vector<int64_t> mask(batch_size_ * new_length, 0);
+    for (size_t r = 0; r < batch_size_; r++) {
+        std::fill_n(mask.begin() + (r + 1) * new_length - kept[r], kept[r], 1);
+    }
+
+    tensors_ = std::move(tensors);
+    attention_mask_ = std::move(mask);
+    next_positions_ = std::move(kept);
+    length_ = new_length;
+    return dropped;
+}
+
+size_t KVCache::bytes() const {
+    size_t total = 0;
+    for (const auto& tensor : tensors_) {
+        total += tensor.GetTensorTypeAndShapeInfo().GetElementCount() * sizeof(float);
+    }
+    return total;
+}
+
+KVCache KVCache::slice(int64_t begin, int64_t end) const {
+    check_unpadded(attention_mask_, batch_size_, "KVCache::slice");
+    begin = std::max<int64_t>(begin, 0);
+    end = std::min(end, length_);
+
+    KVCache result;
+    if (begin >= end) return result;
+
+    int64_t length = end - begin;
+    result.tensors_.reserve(tensors_.size());
+    for (const auto& src_tensor : tensors_) {
+        PastShape shape = past_shape(src_tensor);
+        auto dst_tensor = allocate_past(1, shape.num_heads, length, shape.head_dim);
+
+        const float* src = src_tensor.GetTensorData<float>();
+        float* dst = dst_tensor.GetTensorMutableData<float>();
+        size_t src_stride = shape.length * shape.head_dim;
+        size_t copy_size = length * shape.head_dim;
+        for (int64_t h = 0; h < shape.num_heads; h++) {
+            std::memcpy(dst + h * copy_size, src + h * src_stride + begin * shape.head_dim,
+                        sizeof(float) * copy_size);
+        }
+        result.tensors_.push_back(std::move(dst_tensor));
+    }
+
+    result.attention_mask_.assign(length, 1);
+    result.next_positions_.assign(1, length);
+    result.batch_size_ = 1;
+    result.length_ = length;
+    return result;
+}
+
+KVCache KVCache::concat(const std::vector<const KVCache*>& parts) {
+    KVCache result;
+    int64_t length = 0;
+    const KVCache* first = nullptr;
+    for (const KVCache* part : parts) {
+        if (part->empty()) continue;
+        check_unpadded(part->attention_mask_, part->batch_size_, "KVCache::concat");
+        if (first && part->tensors_.size() != first->tensors_.size()) {
+            throw std::runtime_error("KVCache::concat: caches come from different models");
+        }
+        if (!first) first = part;
+        length += part->length_;
+    }
+    if (!first) return result;
+
+    result.tensors_.reserve(first->tensors_.size());
+    for (size_t i = 0; i < first->tensors_.size(); i++) {
+        PastShape shape = past_shape(first->tensors_[i]);
+        auto dst_tensor = allocate_past(1, shape.num_heads, length, shape.head_dim);
+        float* dst = dst_tensor.GetTensorMutableData<float>();
+
+        size_t dst_stride = length * shape.head_dim;
+        size_t offset = 0;
+        for (const KVCache* part : parts) {
+            if (part->empty()) continue;
+            const float* src = part->tensors_[i].GetTensorData<float>();
+            size_t part_size = part->length_ * shape.head_dim;
+            for (int64_t h = 0; h < shape.num_heads; h++) {
+                std::memcpy(dst + h * dst_stride + offset, src + h * part_size, sizeof(float) * part_size);
+            }
+            offset += part_size;
+        }
+        result.tensors_.push_back(std::move(dst_tensor));
+    }
+
+    result.attention_mask_.assign(length, 1);
+    result.next_positions_.assign(1, length);
+    result.batch_size_ = 1;
+    result.length_ = length;
+    return result;
+}
@@ -0,0 +1,87 @@
+#include "logits_processor.h"
+#include <algorithm>
+#include <limits>
+
+TokenHistory::TokenHistory(const std::vector<int64_t>& prompt) {
+    tokens_.reserve(prompt.size());
+    for (int64_t token : prompt) {
+        tokens_.push_back(static_cast<int>(token));
+        entry(static_cast<int>(token));
+    }
+    prompt_length_ = tokens_.size();
+}
+
+void TokenHistory::push_back(int token) {
+    tokens_.push_back(token);
+    entry(token).generated++;
+}
+
+TokenHistory::Entry& TokenHistory::entry(int token) {
+    auto [it, inserted] = index_.emplace(token, distinct_.size());
+    if (inserted) {
+        distinct_.push_back({token, 0});
+    }
+    return distinct_[it->second];
+}
+
+namespace {
+
+bool in_range(int token, size_t n) {
+    return token >= 0 && static_cast<size_t>(token) < n;
+}
+
+} // namespace
+
+void RepetitionPenalty::apply(float* logits, size_t n, const TokenHistory& history) const {
+    for (const TokenHistory::Entry& entry : history.distinct()) {
+        if (!in_range(entry.token, n)) continue;
+        float& logit = logits[entry.token];
+        logit = logit > 0.0f ? logit / penalty_ : logit * penalty_;
+    }
+}
+
+void PresenceFrequencyPenalty::apply(float* logits, size_t n, const TokenHistory& history) const {
+    for (const TokenHistory::Entry& entry : history.distinct()) {
+        if (entry.generated == 0 || !in_range(entry.token, n)) continue;
+        logits[entry.token] -= presence_ + frequency_ * static_cast<float>(entry.generated);
+    }
+}
+
+void LogitBias::apply(float* logits, size_t n, const TokenHistory&) const {
+    for (const auto& [token, bias] : bias_) {
+        if (in_range(token, n)) logits[token] += bias;
+    }
+}
+
+void MinLength::apply(float* logits, size_t n, const TokenHistory& history) const {
+    if (history.generated() < min_length_ && in_range(eos_token_id_, n)) {
+        logits[eos_token_id_] = -std::numeric_limits<float>::infinity();
+    }
+}
+
+BadWords::BadWords(const std::vector<std::vector<int>>& sequences) {
+    for (const auto& sequence : sequences) {
+        if (sequence.size() == 1) {
+            banned_.push_back(sequence[0]);
+        } else if (sequence.size() > 1) {
+            sequences_.push_back(sequence);
+        }
+    }
+}
+
+void BadWords::apply(float* logits, size_t n, const TokenHistory& history) const {
+    const float neg_inf = -std::numeric_limits<float>::infinity();
+    for (int token : banned_) {
+        if (in_range(token, n)) logits[token] = neg_inf;
+    }
+
+    // The prefix may reach back into the prompt
+    const std::vector<int>& tokens = history.tokens();
+    for (const auto& sequence : sequences_) {
+        size_t prefix = sequence.size() - 1;
+        if (tokens.size() < prefix || !in_range(sequence.back(), n)) continue;
+        if (std::equal(sequence.begin(), sequence.end() - 1, tokens.end() - prefix)) {
+            logits[sequence.back()] = neg_inf;
+        }
+    }
+}
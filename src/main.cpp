@@ -1,20 +1,90 @@
 #include "tokenizer.h"
 #include "inference_engine.h"
+#include "metrics.h"
+#include "scheduler.h"
+#include "server.h"
 #include "text_generator.h"
+#include "token_constraint.h"
+#include <csignal>
 #include <iostream>
+#include <memory>
+#include <stdexcept>
 #include <string>
 
+namespace {
+
+Server* active_server = nullptr;
+
+void handle_stop_signal(int) {
+    if (active_server) active_server->stop();
+}
+
+} // namespace
+
+bool parse_optimization_level(const std::string& name, GraphOptimizationLevel& level) {
+    if (name == "disable") {
+        level = ORT_DISABLE_ALL;
+    } else if (name == "basic") {
+        level = ORT_ENABLE_BASIC;
+    } else if (name == "extended") {
+        level = ORT_ENABLE_EXTENDED;
+    } else if (name == "all") {
+        level = ORT_ENABLE_ALL;
+    } else {
+        return false;
+    }
+    return true;
+}
+
 void print_usage(const char* program_name) {
     std::cout << "Usage: " << program_name << " [options]\n";
     std::cout << "\nOptions:\n";
     std::cout << "  --model <path>       Path to ONNX model (default: models/gpt2/onnx/decoder_model_merged.onnx)\n";
     std::cout << "  --vocab <path>       Path to vocab.json (default: models/gpt2/vocab.json)\n";
     std::cout << "  --merges <path>      Path to merges.txt (default: models/gpt2/merges.txt)\n";
+    std::cout << "  --tokenizer <path>   Compiled tokenizer file to mmap instead of vocab/merges\n";
+    std::cout << "  --compile-tokenizer <path>  Compile vocab/merges into a tokenizer file and exit\n";
     std::cout << "  --prompt <text>      Prompt text (default: interactive mode)\n";
     std::cout << "  --max-length <n>     Maximum tokens to generate (default: 50)\n";
     std::cout << "  --temperature <f>    Sampling temperature (default: 1.0, use 0 for greedy)\n";
     std::cout << "  --top-k <n>          Top-k sampling (default: 50, use 0 to disable)\n";
     std::cout << "  --top-p <f>          Nucleus sampling (default: 0.9, use 1.0 to disable)\n";
+    std::cout << "  --num-beams <n>      Beam search with this many beams (default: 1 = sampling)\n";
+    std::cout << "  --length-penalty <f> Beam scores are log-probability / length^f (default: 1.0)\n";
+    std::cout << "  --early-stopping     Stop beam search once --num-beams beams have finished\n";
+    std::cout << "  --repetition-penalty <f>  Divide logits of tokens already seen by f (default: 1.0 = off)\n";
+    std::cout << "  --presence-penalty <f>    Subtract f from logits of tokens already generated (default: 0)\n";
+    std::cout << "  --frequency-penalty <f>   Subtract f per time a token was generated (default: 0)\n";
+    std::cout << "  --min-length <n>     Generate at least n tokens before EOS (default: 0)\n";
+    std::cout << "  --max-positions <n>  Context kept for the model, older tokens evicted (default: 1024, 0 = unbounded)\n";
+    std::cout << "  --sink-tokens <n>    First tokens always kept in the context (default: 4)\n";
+    std::cout << "  --context-window <n> Latest tokens kept when the context is full (default: 768)\n";
+    std::cout << "  --json               Only generate a valid JSON value\n";
+    std::cout << "  --regex <pattern>    Only generate text fully matching the pattern\n";
+    std::cout << "  --bpe-cache <n>      Words kept in the tokenizer's BPE cache (default: 65536, 0 to disable)\n";
+    std::cout << "  --prefix-cache <MB>  Reuse the KV of cached prompt prefixes, up to this many MB\n";
+    std::cout << "  --draft-model <path> Smaller model with the same vocabulary for speculative decoding\n";
+    std::cout << "  --draft-tokens <n>   Tokens the draft model proposes per step (default: 4)\n";
+    std::cout << "\nServer mode:\n";
+    std::cout << "  --socket <path>      Serve newline-delimited JSON requests on a Unix domain socket\n";
+    std::cout << "  --port <n>           Serve on a TCP port (see --host)\n";
+    std::cout << "  --host <addr>        Address for --port (default: 127.0.0.1)\n";
+    std::cout << "  --max-batch <n>      Requests decoded together in server mode (default: 8)\n";
+    std::cout << "  --step-tokens <n>    Tokens fed per scheduler step; longer prompts are prefilled in chunks\n";
+    std::cout << "                       between decode steps (default: 512, 0 = whole prompts)\n";
+    std::cout << "\nEngine options:\n";
+    std::cout << "  --threads <n>        Intra-op threads (default: 0 = one per physical core)\n";
+    std::cout << "  --inter-threads <n>  Inter-op threads for --parallel (default: 0 = auto)\n";
+    std::cout << "  --parallel           Run independent graph nodes concurrently\n";
+    std::cout << "  --opt-level <level>  Graph optimization: disable, basic, extended, all (default: all)\n";
+    std::cout << "  --no-spin            Idle threads sleep instead of busy-waiting\n";
+    std::cout << "  --affinity <spec>    Intra-op thread affinities, e.g. \"2;3;4\" or \"1-8;9-16\"\n";
+    std::cout << "  --numa-node <n>      Pin threads to the CPUs of a NUMA node (Linux)\n";
+    std::cout << "  --global-pool        Share one thread pool between all sessions\n";
+    std::cout << "  --model-cache <dir>  Store/reuse the optimized graph in this directory\n";
+    std::cout << "  --warm-up            Run a warm-up pass at load\n";
+    std::cout << "  --profile <prefix>   Write an ONNX Runtime profile trace to <prefix>_<time>.json\n";
+    std::cout << "  --metrics <path>     Write latency/throughput metrics at exit (.json, else Prometheus text)\n";
     std::cout << "  --help               Show this help message\n";
 }
 
@@ -23,7 +93,21 @@ int main(int argc, char* argv[]) {
     std::string model_path = "models/gpt2/onnx/decoder_model_merged.onnx";
     std::string vocab_path = "models/gpt2/vocab.json";
     std::string merges_path = "models/gpt2/merges.txt";
+    std::string tokenizer_path = "";
+    std::string compile_tokenizer_path = "";
     std::string prompt = "";
+    std::string draft_model_path = "";
+    size_t prefix_cache_mb = 0;
+    std::string metrics_path = "";
+    std::string socket_path = "";
+    std::string host = "127.0.0.1";
+    int port = 0;
+    size_t max_batch_size = 8;
+    size_t step_tokens = 512;
+    long long bpe_cache_capacity = -1;
+    bool json_output = false;
+    std::string regex = "";
+    EngineOptions engine_options;
 
     // Default generation config
     GenerationConfig config;
@@ -45,6 +129,10 @@ int main(int argc, char* argv[]) {
             vocab_path = argv[++i];
         } else if (arg == "--merges" && i + 1 < argc) {
             merges_path = argv[++i];
+        } else if (arg == "--tokenizer" && i + 1 < argc) {
+            tokenizer_path = argv[++i];
+        } else if (arg == "--compile-tokenizer" && i + 1 < argc) {
+            compile_tokenizer_path = argv[++i];
         } else if (arg == "--prompt" && i + 1 < argc) {
             prompt = argv[++i];
         } else if (arg == "--max-length" && i + 1 < argc) {
@@ -55,6 +143,75 @@ int main(int argc, char* argv[]) {
             config.top_k = std::stoi(argv[++i]);
         } else if (arg == "--top-p" && i + 1 < argc) {
             config.top_p = std::stof(argv[++i]);
+        } else if (arg == "--num-beams" && i + 1 < argc) {
+            config.num_beams = std::stoi(argv[++i]);
+        } else if (arg == "--length-penalty" && i + 1 < argc) {
+            config.length_penalty = std::stof(argv[++i]);
+        } else if (arg == "--early-stopping") {
+            config.early_stopping = true;
+        } else if (arg == "--repetition-penalty" && i + 1 < argc) {
+            config.repetition_penalty = std::stof(argv[++i]);
+        } else if (arg == "--presence-penalty" && i + 1 < argc) {
+            config.presence_penalty = std::stof(argv[++i]);
+        } else if (arg == "--frequency-penalty" && i + 1 < argc) {
+            config.frequency_penalty = std::stof(argv[++i]);
+        } else if (arg == "--min-length" && i + 1 < argc) {
+            config.min_length = std::stoi(argv[++i]);
+        } else if (arg == "--max-positions" && i + 1 < argc) {
+            config.max_positions = std::stoi(argv[++i]);
+        } else if (arg == "--sink-tokens" && i + 1 < argc) {
+            config.sink_tokens = std::stoi(argv[++i]);
+        } else if (arg == "--context-window" && i + 1 < argc) {
+            config.window_tokens = std::stoi(argv[++i]);
+        } else if (arg == "--json") {
+            json_output = true;
+        } else if (arg == "--regex" && i + 1 < argc) {
+            regex = argv[++i];
+        } else if (arg == "--bpe-cache" && i + 1 < argc) {
+            bpe_cache_capacity = std::stoll(argv[++i]);
+        } else if (arg == "--prefix-cache" && i + 1 < argc) {
+            prefix_cache_mb = static_cast<size_t>(std::stoul(argv[++i]));
+        } else if (arg == "--draft-model" && i + 1 < argc) {
+            draft_model_path = argv[++i];
+        } else if (arg == "--draft-tokens" && i + 1 < argc) {
+            config.draft_tokens = std::stoi(argv[++i]);
+        } else if (arg == "--threads" && i + 1 < argc) {
+            engine_options.intra_op_threads = std::stoi(argv[++i]);
+        } else if (arg == "--inter-threads" && i + 1 < argc) {
+            engine_options.inter_op_threads = std::stoi(argv[++i]);
+        } else if (arg == "--parallel") {
+            engine_options.parallel_execution = true;
+        } else if (arg == "--opt-level" && i + 1 < argc) {
+            if (!parse_optimization_level(argv[++i], engine_options.optimization_level)) {
+                std::cerr << "Unknown optimization level: " << argv[i] << std::endl;
+                return 1;
+            }
+        } else if (arg == "--no-spin") {
+            engine_options.allow_spinning = false;
+        } else if (arg == "--affinity" && i + 1 < argc) {
+            engine_options.intra_op_affinity = argv[++i];
+        } else if (arg == "--numa-node" && i + 1 < argc) {
+            engine_options.numa_node = std::stoi(argv[++i]);
+        } else if (arg == "--global-pool") {
+            engine_options.global_thread_pool = true;
+        } else if (arg == "--model-cache" && i + 1 < argc) {
+            engine_options.optimized_model_dir = argv[++i];
+        } else if (arg == "--warm-up") {
+            engine_options.warm_up = true;
+        } else if (arg == "--profile" && i + 1 < argc) {
+            engine_options.profile_prefix = argv[++i];
+        } else if (arg == "--metrics" && i + 1 < argc) {
+            metrics_path = argv[++i];
+        } else if (arg == "--socket" && i + 1 < argc) {
+            socket_path = argv[++i];
+        } else if (arg == "--port" && i + 1 < argc) {
+            port = std::stoi(argv[++i]);
+        } else if (arg == "--host" && i + 1 < argc) {
+            host = argv[++i];
+        } else if (arg == "--max-batch" && i + 1 < argc) {
+            max_batch_size = static_cast<size_t>(std::stoul(argv[++i]));
+        } else if (arg == "--step-tokens" && i + 1 < argc) {
+            step_tokens = static_cast<size_t>(std::stoul(argv[++i]));
         }
     }
 
@@ -64,25 +221,104 @@ int main(int argc, char* argv[]) {
     // Initialize tokenizer
     std::cout << "Loading tokenizer..." << std::endl;
     Tokenizer tokenizer;
-    if (!tokenizer.load(vocab_path, merges_path)) {
+    bool tokenizer_loaded = tokenizer_path.empty()
+        ? tokenizer.load(vocab_path, merges_path)
+        : tokenizer.load_binary(tokenizer_path);
+    if (!tokenizer_loaded) {
         std::cerr << "Failed to load tokenizer" << std::endl;
         return 1;
     }
+
+    if (!compile_tokenizer_path.empty()) {
+        if (!tokenizer.save_binary(compile_tokenizer_path)) {
+            std::cerr << "Failed to write tokenizer file" << std::endl;
+            return 1;
+        }
+        std::cout << "Wrote compiled tokenizer to " << compile_tokenizer_path << std::endl;
+        return 0;
+    }
+    if (bpe_cache_capacity >= 0) {
+        tokenizer.set_cache_capacity(static_cast<size_t>(bpe_cache_capacity));
+    }
+
+    // Constrained generation checks tokens against a trie of their bytes
+    bool server_mode = !socket_path.empty() || port > 0;
+    std::shared_ptr<const TokenTrie> token_trie;
+    if (json_output || !regex.empty() || server_mode) {
+        token_trie = std::make_shared<TokenTrie>(tokenizer);
+    }
+    if (json_output && !regex.empty()) {
+        std::cerr << "--json and --regex cannot be combined" << std::endl;
+        return 1;
+    } else if (json_output) {
+        config.constraint = TokenConstraint::json(token_trie);
+    } else if (!regex.empty()) {
+        try {
+            config.constraint = TokenConstraint::regex(token_trie, regex);
+        } catch (const std::invalid_argument& e) {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+    }
     std::cout << std::endl;
 
     // Initialize inference engine
-    InferenceEngine engine;
+    InferenceEngine engine(engine_options);
     if (!engine.load_model(model_path)) {
         std::cerr << "Failed to load model" << std::endl;
         return 1;
     }
     std::cout << std::endl;
 
+    // Optional draft model for speculative decoding
+    std::unique_ptr<InferenceEngine> draft_engine;
+    if (!draft_model_path.empty()) {
+        std::cout << "Loading draft model..." << std::endl;
+        draft_engine = std::make_unique<InferenceEngine>(engine_options);
+        if (!draft_engine->load_model(draft_model_path)) {
+            std::cerr << "Failed to load draft model" << std::endl;
+            return 1;
+        }
+        std::cout << std::endl;
+    }
+
     // Create text generator
     TextGenerator generator(engine, tokenizer);
+    generator.set_draft_engine(draft_engine.get());
+    PrefixCache prefix_cache(prefix_cache_mb * 1024 * 1024);
+    if (prefix_cache_mb > 0) {
+        generator.set_prefix_cache(&prefix_cache);
+    }
+
+    // Server mode, interactive mode or single prompt
+    if (server_mode) {
+        Scheduler scheduler(engine, tokenizer, max_batch_size, step_tokens);
+        if (!scheduler.start()) {
+            return 1;
+        }
 
-    // Interactive mode or single prompt
-    if (prompt.empty()) {
+        Server server(scheduler, config);
+        server.set_token_trie(token_trie);
+        if ((!socket_path.empty() && !server.listen_unix(socket_path)) ||
+            (port > 0 && !server.listen_tcp(host, port))) {
+            return 1;
+        }
+        std::cout << "=== Server Mode ===" << std::endl;
+        std::cout << "Serving requests (Ctrl+C to stop)" << std::endl;
+
+        active_server = &server;
+        std::signal(SIGINT, handle_stop_signal);
+        std::signal(SIGTERM, handle_stop_signal);
+        bool served = server.run();
+        std::signal(SIGINT, SIG_DFL);
+        std::signal(SIGTERM, SIG_DFL);
+        active_server = nullptr;
+        scheduler.stop();
+        if (!served) {
+            return 1;
+        }
+        std::cout << "Server stopped" << std::endl;
+    } else if (prompt.empty()) {
         std::cout << "=== Interactive Mode ===" << std::endl;
         std::cout << "Enter prompts (Ctrl+C to exit)" << std::endl;
         std::cout << std::endl;
@@ -116,5 +352,23 @@ int main(int argc, char* argv[]) {
         std::cout << "\n-------------------\n";
     }
 
+    if (prefix_cache_mb > 0) {
+        auto stats = prefix_cache.stats();
+        std::cout << "Prefix cache: " << stats.hits << "/" << stats.lookups << " hits ("
+                  << static_cast<int>(stats.hit_rate() * 100.0 + 0.5) << "%), "
+                  << stats.reused_tokens << "/" << stats.prompt_tokens << " prefill tokens saved, "
+                  << stats.bytes / (1024 * 1024) << " MB in " << stats.nodes << " blocks, "
+                  << stats.evictions << " evicted" << std::endl;
+    }
+
+    if (!metrics_path.empty()) {
+        if (Metrics::global().write(metrics_path)) {
+            std::cout << "Wrote metrics to " << metrics_path << std::endl;
+        } else {
+            std::cerr << "Failed to write metrics to " << metrics_path << std::endl;
+        }
+    }
+    engine.end_profiling();
+
     return 0;
 }
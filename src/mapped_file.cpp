@@ -0,0 +1,65 @@
+#include "mapped_file.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::~MappedFile() {
+    close();
+}
+
+bool MappedFile::open(const std::string& path) {
+    close();
+
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                              OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) return false;
+
+    LARGE_INTEGER size;
+    GetFileSizeEx(file, &size);
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    void* data = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+    file_handle_ = file;
+    mapping_handle_ = mapping;
+    size_ = static_cast<size_t>(size.QuadPart);
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat st;
+    void* data = nullptr;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        data = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+        if (data == MAP_FAILED) data = nullptr;
+        size_ = static_cast<size_t>(st.st_size);
+    }
+    ::close(fd);
+#endif
+
+    if (!data) {
+        close();
+        return false;
+    }
+    data_ = data;
+    return true;
+}
+
+void MappedFile::close() {
+#ifdef _WIN32
+    if (data_) UnmapViewOfFile(data_);
+    if (mapping_handle_) CloseHandle(mapping_handle_);
+    if (file_handle_) CloseHandle(file_handle_);
+    mapping_handle_ = nullptr;
+    file_handle_ = nullptr;
+#else
+    if (data_) munmap(data_, size_);
+#endif
+    data_ = nullptr;
+    size_ = 0;
+}
@@ -0,0 +1,201 @@
+#include "metrics.h"
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include <nlohmann/json.hpp>
+
+using json = nlohmann::ordered_json;
+
+namespace {
+
+int64_t steady_now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+struct NamedHistogram {
+    const char* name;
+    const char* help;
+    const Histogram* histogram;
+};
+
+std::array<NamedHistogram, 7> named_histograms(const Metrics& m) {
+    return {{
+        {"tokenize", "Prompt tokenization latency", &m.tokenize},
+        {"prefill", "Prefill forward pass latency", &m.prefill},
+        {"decode", "Decode forward pass latency", &m.decode},
+        {"sample", "Per-token sampling latency", &m.sample},
+        {"detokenize", "Per-token detokenization latency", &m.detokenize},
+        {"ttft", "Time to first token", &m.ttft},
+        {"inter_token", "Latency between consecutive tokens of a request", &m.inter_token},
+    }};
+}
+
+} // namespace
+
+Histogram::Histogram() {
+    reset();
+}
+
+void Histogram::record(double microseconds) {
+    int bucket = 0;
+    if (microseconds > 1.0) {
+        bucket = static_cast<int>(std::ceil(std::log2(microseconds) * kBucketsPerOctave));
+        bucket = std::min(bucket, kNumBuckets);
+    }
+    buckets_[bucket].fetch_add(1, std::memory_order_relaxed);
+    count_.fetch_add(1, std::memory_order_relaxed);
+    sum_ns_.fetch_add(static_cast<uint64_t>(std::max(microseconds, 0.0) * 1000.0), std::memory_order_relaxed);
+}
+
+double Histogram::mean() const {
+    uint64_t n = count();
+    return n ? sum() / n : 0.0;
+}
+
+double Histogram::bucket_bound(int i) {
+    return std::exp2(static_cast<double>(i) / kBucketsPerOctave);
+}
+
+double Histogram::quantile(double q) const {
+    uint64_t n = count();
+    if (n == 0) return 0.0;
+
+    double target = std::clamp(q, 0.0, 1.0) * n;
+    uint64_t seen = 0;
+    for (int i = 0; i <= kNumBuckets; i++) {
+        uint64_t in_bucket = bucket_count(i);
+        if (in_bucket == 0 || seen + in_bucket < target) {
+            seen += in_bucket;
+            continue;
+        }
+        if (i == kNumBuckets) return bucket_bound(kNumBuckets - 1);
+        double lo = i == 0 ? 0.0 : bucket_bound(i - 1);
+        double hi = bucket_bound(i);
+        return lo + (hi - lo) * (target - seen) / in_bucket;
+    }
+    return bucket_bound(kNumBuckets - 1);
+}
+
+void Histogram::reset() {
+    for (auto& bucket : buckets_) bucket.store(0, std::memory_order_relaxed);
+    count_.store(0, std::memory_order_relaxed);
+    sum_ns_.store(0, std::memory_order_relaxed);
+}
+
+void RequestTimer::token() {
+    auto now = std::chrono::steady_clock::now();
+    double us = std::chrono::duration<double, std::micro>(now - last_).count();
+    Metrics& metrics = Metrics::global();
+    (first_ ? metrics.ttft : metrics.inter_token).record(us);
+    metrics.generated_tokens.fetch_add(1, std::memory_order_relaxed);
+    first_ = false;
+    last_ = now;
+}
+
+Metrics::Metrics() : start_ns_(steady_now_ns()) {}
+
+Metrics& Metrics::global() {
+    static Metrics metrics;
+    return metrics;
+}
+
+double Metrics::uptime_seconds() const {
+    return (steady_now_ns() - start_ns_.load(std::memory_order_relaxed)) / 1e9;
+}
+
+double Metrics::tokens_per_second() const {
+    double seconds = (prefill.sum() + decode.sum() + sample.sum()) / 1e6;
+    return seconds > 0.0 ? generated_tokens.load(std::memory_order_relaxed) / seconds : 0.0;
+}
+
+std::string Metrics::to_prometheus() const {
+    std::ostringstream out;
+    out.precision(9);
+    auto counter = [&out](const char* name, const char* help, uint64_t value) {
+        out << "# HELP inference_" << name << " " << help << "\n"
+            << "# TYPE inference_" << name << " counter\n"
+            << "inference_" << name << " " << value << "\n";
+    };
+    auto gauge = [&out](const std::string& name, const char* help, double value) {
+        out << "# HELP inference_" << name << " " << help << "\n"
+            << "# TYPE inference_" << name << " gauge\n"
+            << "inference_" << name << " " << value << "\n";
+    };
+
+    counter("requests_total", "Generation requests started", requests.load());
+    counter("prompt_tokens_total", "Prompt tokens processed", prompt_tokens.load());
+    counter("generated_tokens_total", "Tokens generated", generated_tokens.load());
+    counter("evicted_tokens_total", "Context tokens evicted from the KV cache", evicted_tokens.load());
+    gauge("queue_depth", "Requests waiting for admission", static_cast<double>(queue_depth.load()));
+    gauge("running_requests", "Requests in the running batch", static_cast<double>(running.load()));
+    gauge("tokens_per_second", "Generated tokens per second of prefill, decode and sampling time", tokens_per_second());
+
+    // Buckets are exported at powers of two only; each is an exact bucket
+    // bound, so the cumulative counts stay exact
+    for (const auto& h : named_histograms(*this)) {
+        std::string name = std::string("inference_") + h.name + "_seconds";
+        out << "# HELP " << name << " " << h.help << "\n"
+            << "# TYPE " << name << " histogram\n";
+        uint64_t cumulative = 0;
+        for (int i = 0; i < Histogram::kNumBuckets; i++) {
+            cumulative += h.histogram->bucket_count(i);
+            if (i % Histogram::kBucketsPerOctave == 0) {
+                out << name << "_bucket{le=\"" << Histogram::bucket_bound(i) / 1e6 << "\"} " << cumulative << "\n";
+            }
+        }
+        out << name << "_bucket{le=\"+Inf\"} " << h.histogram->count() << "\n"
+            << name << "_sum " << h.histogram->sum() / 1e6 << "\n"
+            << name << "_count " << h.histogram->count() << "\n";
+    }
+
+    gauge("ttft_p50_seconds", "Median time to first token", ttft.quantile(0.5) / 1e6);
+    gauge("ttft_p99_seconds", "99th percentile time to first token", ttft.quantile(0.99) / 1e6);
+    gauge("inter_token_p50_seconds", "Median inter-token latency", inter_token.quantile(0.5) / 1e6);
+    gauge("inter_token_p99_seconds", "99th percentile inter-token latency", inter_token.quantile(0.99) / 1e6);
+    return out.str();
+}
+
+std::string Metrics::to_json() const {
+    json result;
+    result["uptime_s"] = uptime_seconds();
+    result["requests"] = requests.load();
+    result["prompt_tokens"] = prompt_tokens.load();
+    result["generated_tokens"] = generated_tokens.load();
+    result["evicted_tokens"] = evicted_tokens.load();
+    result["tokens_per_s"] = tokens_per_second();
+    result["queue_depth"] = queue_depth.load();
+    result["running"] = running.load();
+
+    json& latency = result["latency_ms"];
+    for (const auto& h : named_histograms(*this)) {
+        latency[h.name] = {
+            {"count", h.histogram->count()},
+            {"mean", h.histogram->mean() / 1000.0},
+            {"p50", h.histogram->quantile(0.5) / 1000.0},
+            {"p90", h.histogram->quantile(0.9) / 1000.0},
+            {"p99", h.histogram->quantile(0.99) / 1000.0},
+        };
+    }
+    return result.dump(2);
+}
+
+bool Metrics::write(const std::string& path) const {
+    std::ofstream out(path);
+    if (!out.is_open()) return false;
+    bool as_json = path.size() >= 5 && path.compare(path.size() - 5, 5, ".json") == 0;
+    out << (as_json ? to_json() : to_prometheus()) << "\n";
+    return static_cast<bool>(out);
+}
+
+void Metrics::reset() {
+    for (Histogram* h : {&tokenize, &prefill, &decode, &sample, &detokenize, &ttft, &inter_token}) {
+        h->reset();
+    }
+    requests = 0;
+    prompt_tokens = 0;
+    generated_tokens = 0;
+    evicted_tokens = 0;
+    start_ns_ = steady_now_ns();
+}
@@ -0,0 +1,213 @@
+#include "pre_tokenizer.h"
+#include <algorithm>
+#include <array>
+#include <cstdint>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define PRE_TOKENIZER_SSE2 1
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace {
+
+struct CodepointRange {
+    char32_t first;
+    char32_t last;
+};
+
+#include "unicode_tables.inc"
+
+enum CharClass : uint8_t {
+    kOther,
+    kLetter,
+    kNumber,
+    kSpace
+};
+
+constexpr std::array<uint8_t, 128> make_ascii_classes() {
+    std::array<uint8_t, 128> classes{};
+    for (int c = 'a'; c <= 'z'; c++) classes[c] = kLetter;
+    for (int c = 'A'; c <= 'Z'; c++) classes[c] = kLetter;
+    for (int c = '0'; c <= '9'; c++) classes[c] = kNumber;
+    for (int c : {' ', '\t', '\n', '\v', '\f', '\r'}) classes[c] = kSpace;
+    return classes;
+}
+
+constexpr std::array<uint8_t, 128> kAsciiClasses = make_ascii_classes();
+
+template <size_t N>
+bool in_ranges(const CodepointRange (&ranges)[N], char32_t cp) {
+    auto it = std::upper_bound(std::begin(ranges), std::end(ranges), cp,
+        [](char32_t value, const CodepointRange& range) { return value < range.first; });
+    return it != std::begin(ranges) && cp <= (it - 1)->last;
+}
+
+// Unicode White_Space outside ASCII
+bool is_unicode_space(char32_t cp) {
+    switch (cp) {
+        case 0x85: case 0xA0: case 0x1680:
+        case 0x2028: case 0x2029: case 0x202F: case 0x205F: case 0x3000:
+            return true;
+        default:
+            return cp >= 0x2000 && cp <= 0x200A;
+    }
+}
+
+// Decode the codepoint starting at pos; invalid sequences decode as one byte
+size_t decode_utf8(std::string_view text, size_t pos, char32_t& cp) {
+    unsigned char c = static_cast<unsigned char>(text[pos]);
+    size_t len = c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : c >= 0xC0 ? 2 : 1;
+    if (len == 1 || pos + len > text.size()) {
+        cp = c;
+        return 1;
+    }
+
+    cp = c & (0x7F >> len);
+    for (size_t i = 1; i < len; i++) {
+        unsigned char next = static_cast<unsigned char>(text[pos + i]);
+        if ((next & 0xC0) != 0x80) {
+            cp = c;
+            return 1;
+        }
+        cp = (cp << 6) | (next & 0x3F);
+    }
+    return len;
+}
+
+CharClass classify(std::string_view text, size_t pos, size_t& len) {
+    unsigned char c = static_cast<unsigned char>(text[pos]);
+    if (c < 0x80) {
+        len = 1;
+        return static_cast<CharClass>(kAsciiClasses[c]);
+    }
+
+    char32_t cp;
+    len = decode_utf8(text, pos, cp);
+    if (len == 1) return kOther;
+    if (is_unicode_space(cp)) return kSpace;
+    if (in_ranges(kLetterRanges, cp)) return kLetter;
+    if (in_ranges(kNumberRanges, cp)) return kNumber;
+    return kOther;
+}
+
+#ifdef PRE_TOKENIZER_SSE2
+unsigned count_trailing_zeros(unsigned mask) {
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return index;
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+#endif
+
+// Skip ASCII characters of class cls starting at pos; letters and digits are
+// classified 16 bytes at a time
+size_t skip_ascii(std::string_view text, size_t pos, CharClass cls) {
+#ifdef PRE_TOKENIZER_SSE2
+    if (cls == kLetter || cls == kNumber) {
+        const __m128i case_bit = _mm_set1_epi8(0x20);
+        const __m128i base = _mm_set1_epi8(cls == kLetter ? 'a' : '0');
+        const __m128i span = _mm_set1_epi8(cls == kLetter ? 25 : 9);
+        while (pos + 16 <= text.size()) {
+            __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(text.data() + pos));
+            if (cls == kLetter) bytes = _mm_or_si128(bytes, case_bit);
+            // In class iff (byte - base) <= span as unsigned bytes
+            __m128i offset = _mm_sub_epi8(bytes, base);
+            __m128i in_class = _mm_cmpeq_epi8(_mm_min_epu8(offset, span), offset);
+            unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(in_class));
+            if (mask != 0xFFFF) {
+                return pos + count_trailing_zeros(~mask);
+            }
+            pos += 16;
+        }
+    }
+#endif
+    while (pos < text.size()) {
+        unsigned char c = static_cast<unsigned char>(text[pos]);
+        if (c >= 0x80 || kAsciiClasses[c] != cls) break;
+        pos++;
+    }
+    return pos;
+}
+
+// End of the run of characters of class cls starting at pos
+size_t skip_run(std::string_view text, size_t pos, CharClass cls) {
+    while (pos < text.size()) {
+        unsigned char c = static_cast<unsigned char>(text[pos]);
+        if (c < 0x80) {
+            if (kAsciiClasses[c] != cls) break;
+            pos = skip_ascii(text, pos, cls);
+            continue;
+        }
+        size_t len;
+        if (classify(text, pos, len) != cls) break;
+        pos += len;
+    }
+    return pos;
+}
+
+// Length of a contraction ('s, 't, 're, 've, 'm, 'll, 'd) at pos, or 0
+size_t contraction_length(std::string_view text, size_t pos) {
+    std::string_view rest = text.substr(pos + 1, 2);
+    if (rest.empty()) return 0;
+    char first = rest[0];
+    if (first == 's' || first == 't' || first == 'm' || first == 'd') return 2;
+    if (rest.size() == 2 && (rest == "re" || rest == "ve" || rest == "ll")) return 3;
+    return 0;
+}
+
+} // namespace
+
+bool PreTokenizer::next(std::string_view& word) {
+    if (pos_ >= text_.size()) return false;
+
+    size_t start = pos_;
+    size_t end;
+
+    if (text_[start] == '\'') {
+        size_t len = contraction_length(text_, start);
+        if (len > 0) {
+            pos_ = start + len;
+            word = text_.substr(start, len);
+            return true;
+        }
+    }
+
+    size_t len;
+    CharClass cls = classify(text_, start, len);
+
+    if (text_[start] == ' ' && start + 1 < text_.size()) {
+        // " ?\p{L}+", " ?\p{N}+" and " ?[^\s\p{L}\p{N}]+" take one leading space
+        size_t next_len;
+        CharClass next_cls = classify(text_, start + 1, next_len);
+        if (next_cls != kSpace) {
+            end = skip_run(text_, start + 1, next_cls);
+            pos_ = end;
+            word = text_.substr(start, end - start);
+            return true;
+        }
+    }
+
+    if (cls != kSpace) {
+        end = skip_run(text_, start, cls);
+    } else {
+        // "\s+(?!\S)": a whitespace run followed by a word gives up its last
+        // character to that word, unless it is the run's only character ("\s+")
+        end = skip_run(text_, start, kSpace);
+        if (end < text_.size()) {
+            size_t last = end - 1;
+            while (last > start && (static_cast<unsigned char>(text_[last]) & 0xC0) == 0x80) last--;
+            if (last > start) end = last;
+        }
+    }
+
+    pos_ = end;
+    word = text_.substr(start, end - start);
+    return true;
+}
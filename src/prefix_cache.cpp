@@ -0,0 +1,169 @@
+#include "prefix_cache.h"
+#include <algorithm>
+#include <functional>
+#include <queue>
+#include <utility>
+
+namespace {
+
+// Length of the common prefix of a node's edge and tokens[offset .. end)
+size_t match_length(const std::vector<int64_t>& edge, const std::vector<int64_t>& tokens,
+                    size_t offset, size_t end) {
+    size_t n = 0;
+    while (n < edge.size() && offset + n < end && edge[n] == tokens[offset + n]) n++;
+    return n;
+}
+
+} // namespace
+
+PrefixCache::PrefixCache(size_t max_bytes)
+    : root_(std::make_unique<Node>()), max_bytes_(max_bytes) {}
+
+PrefixCache::~PrefixCache() {}
+
+size_t PrefixCache::lookup(const std::vector<int64_t>& tokens, KVCache& cache) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    cache.clear();
+    lookups_++;
+    prompt_tokens_ += tokens.size();
+    uint64_t now = ++clock_;
+
+    // Follow full edges as far as they match; a partly matching edge
+    // contributes the front of its block
+    std::vector<const KVCache*> parts;
+    KVCache partial;
+    Node* node = root_.get();
+    size_t matched = 0;
+    while (matched < tokens.size()) {
+        auto it = node->children.find(tokens[matched]);
+        if (it == node->children.end()) break;
+
+        Node* child = it->second.get();
+        size_t n = match_length(child->tokens, tokens, matched, tokens.size());
+        child->last_used = now;
+        matched += n;
+        if (n < child->tokens.size()) {
+            partial = child->block.slice(0, static_cast<int64_t>(n));
+            parts.push_back(&partial);
+            break;
+        }
+        parts.push_back(&child->block);
+        node = child;
+    }
+
+    if (matched == 0) return 0;
+    cache = KVCache::concat(parts);
+    hits_++;
+    reused_tokens_ += matched;
+    return matched;
+}
+
+void PrefixCache::insert(const std::vector<int64_t>& tokens, const KVCache& cache) {
+    size_t length = std::min(tokens.size(), static_cast<size_t>(cache.length()));
+    if (length == 0) return;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    uint64_t now = ++clock_;
+
+    Node* node = root_.get();
+    size_t matched = 0;
+    while (matched < length) {
+        auto it = node->children.find(tokens[matched]);
+        if (it == node->children.end()) break;
+
+        Node* child = it->second.get();
+        size_t n = match_length(child->tokens, tokens, matched, length);
+        child->last_used = now;
+        if (n < child->tokens.size()) {
+            child = split(child, n);
+        }
+        matched += n;
+        node = child;
+    }
+    if (matched == length) return;
+
+    // A block that could never fit is not worth copying
+    size_t new_bytes = cache.bytes() / static_cast<size_t>(cache.length()) * (length - matched);
+    if (new_bytes > max_bytes_) return;
+
+    auto leaf = std::make_unique<Node>();
+    leaf->tokens.assign(tokens.begin() + matched, tokens.begin() + length);
+    leaf->block = cache.slice(static_cast<int64_t>(matched), static_cast<int64_t>(length));
+    leaf->parent = node;
+    leaf->last_used = now;
+    bytes_ += leaf->block.bytes();
+    nodes_++;
+    node->children[leaf->tokens[0]] = std::move(leaf);
+
+    evict();
+}
+
+PrefixCache::Node* PrefixCache::split(Node* node, size_t length) {
+    auto upper = std::make_unique<Node>();
+    upper->tokens.assign(node->tokens.begin(), node->tokens.begin() + length);
+    upper->block = node->block.slice(0, static_cast<int64_t>(length));
+    upper->parent = node->parent;
+    upper->last_used = node->last_used;
+
+    bytes_ -= node->block.bytes();
+    node->block = node->block.slice(static_cast<int64_t>(length), static_cast<int64_t>(node->tokens.size()));
+    node->tokens.erase(node->tokens.begin(), node->tokens.begin() + length);
+    bytes_ += upper->block.bytes() + node->block.bytes();
+    nodes_++;
+
+    // upper takes node's place under its parent and adopts it
+    auto& slot = upper->parent->children[upper->tokens[0]];
+    node->parent = upper.get();
+    upper->children[node->tokens[0]] = std::move(slot);
+
+    Node* result = upper.get();
+    slot = std::move(upper);
+    return result;
+}
+
+void PrefixCache::evict() {
+    if (bytes_ <= max_bytes_) return;
+
+    using Entry = std::pair<uint64_t, Node*>;
+    std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> leaves;
+    std::vector<Node*> stack = {root_.get()};
+    while (!stack.empty()) {
+        Node* node = stack.back();
+        stack.pop_back();
+        if (node->children.empty() && node != root_.get()) {
+            leaves.push({node->last_used, node});
+        }
+        for (auto& [token, child] : node->children) {
+            stack.push_back(child.get());
+        }
+    }
+
+    // A parent left childless becomes a leaf in turn; it was used no earlier
+    // than any of its descendants
+    while (bytes_ > max_bytes_ && !leaves.empty()) {
+        Node* leaf = leaves.top().second;
+        leaves.pop();
+
+        Node* parent = leaf->parent;
+        bytes_ -= leaf->block.bytes();
+        nodes_--;
+        evictions_++;
+        parent->children.erase(leaf->tokens[0]);
+
+        if (parent != root_.get() && parent->children.empty()) {
+            leaves.push({parent->last_used, parent});
+        }
+    }
+}
+
+void PrefixCache::clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    root_ = std::make_unique<Node>();
+    bytes_ = 0;
+    nodes_ = 0;
+}
+
+PrefixCache::Stats PrefixCache::stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return {lookups_, hits_, prompt_tokens_, reused_tokens_, evictions_, nodes_, bytes_, max_bytes_};
+}
@@ -0,0 +1,741 @@
+#include "sampler.h"
+#include "sampler_kernels.h"
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <limits>
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define SAMPLER_X86_DISPATCH 1
+#include <immintrin.h>
+#endif
+
+namespace {
+
+// exp(d) for d below this is 0 (it would be denormal or underflow in float)
+constexpr float kMinExponent = -87.0f;
+
+// Floats prepare_logits() finishes before moving on (8 KB, plus as much
+// scratch); a multiple of 64 so each chunk starts on a word of the bitset
+constexpr size_t kPrepareChunk = 2048;
+
+// ---------------------------------------------------------------------------
+// Scalar
+
+float max_value_scalar(const float* x, size_t n) {
+    float m = -std::numeric_limits<float>::infinity();
+    for (size_t i = 0; i < n; i++) {
+        m = std::max(m, x[i]);
+    }
+    return m;
+}
+
+size_t argmax_scalar(const float* x, size_t n) {
+    return static_cast<size_t>(std::max_element(x, x + n) - x);
+}
+
+float exp_sum_scalar(const float* x, float* out, size_t n, float max, float scale) {
+    float sum = 0.0f;
+    for (size_t i = 0; i < n; i++) {
+        float d = (x[i] - max) * scale;
+        out[i] = d < kMinExponent ? 0.0f : std::exp(d);
+        sum += out[i];
+    }
+    return sum;
+}
+
+void bucketize_scalar(const float* x, int32_t* out, size_t n, float lo, float scale, int num_buckets) {
+    float top = static_cast<float>(num_buckets - 1);
+    for (size_t i = 0; i < n; i++) {
+        out[i] = x[i] >= lo ? static_cast<int32_t>(std::min((x[i] - lo) * scale, top)) : -1;
+    }
+}
+
+size_t select_at_least_scalar(const float* x, size_t n, float threshold, int32_t* out) {
+    size_t count = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (x[i] >= threshold) out[count++] = static_cast<int32_t>(i);
+    }
+    return count;
+}
+
+float scale_mask_max_scalar(float* x, size_t n, float scale, const uint64_t* allowed) {
+    const float neg_inf = -std::numeric_limits<float>::infinity();
+    float m = neg_inf;
+    for (size_t i = 0; i < n; i++) {
+        x[i] = !allowed || ((allowed[i / 64] >> (i % 64)) & 1) ? x[i] * scale : neg_inf;
+        m = std::max(m, x[i]);
+    }
+    return m;
+}
+
+#ifdef SAMPLER_X86_DISPATCH
+
+// Cephes-style expf: exp(x) = 2^n * exp(r) with |r| <= ln(2)/2 and a degree-6
+// polynomial for exp(r). Relative error is around 2 ulp, far below what
+// sampling can notice.
+constexpr float kLog2e = 1.44269504088896341f;
+constexpr float kLn2Hi = 0.693359375f;
+constexpr float kLn2Lo = -2.12194440e-4f;
+constexpr float kExpP0 = 1.9875691500e-4f;
+constexpr float kExpP1 = 1.3981999507e-3f;
+constexpr float kExpP2 = 8.3334519073e-3f;
+constexpr float kExpP3 = 4.1665795894e-2f;
+constexpr float kExpP4 = 1.6666665459e-1f;
+constexpr float kExpP5 = 5.0000001201e-1f;
+
+// ---------------------------------------------------------------------------
+// AVX2 + FMA
+
+__attribute__((target("avx2,fma")))
+inline __m256 exp_avx2(__m256 x) {
+    const __m256 min_exp = _mm256_set1_ps(kMinExponent);
+    __m256 keep = _mm256_cmp_ps(x, min_exp, _CMP_GE_OQ);
+    x = _mm256_max_ps(x, min_exp);
+
+    __m256 fx = _mm256_floor_ps(_mm256_fmadd_ps(x, _mm256_set1_ps(kLog2e), _mm256_set1_ps(0.5f)));
+    x = _mm256_fnmadd_ps(fx, _mm256_set1_ps(kLn2Hi), x);
+    x = _mm256_fnmadd_ps(fx, _mm256_set1_ps(kLn2Lo), x);
+
+    __m256 y = _mm256_set1_ps(kExpP0);
+    y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(kExpP1));
+    y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(kExpP2));
+    y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(kExpP3));
+    y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(kExpP4));
+    y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(kExpP5));
+    y = _mm256_fmadd_ps(y, _mm256_mul_ps(x, x), x);
+    y = _mm256_add_ps(y, _mm256_set1_ps(1.0f));
+
+    __m256i n = _mm256_add_epi32(_mm256_cvttps_epi32(fx), _mm256_set1_epi32(127));
+    __m256 pow2n = _mm256_castsi256_ps(_mm256_slli_epi32(n, 23));
+    return _mm256_and_ps(_mm256_mul_ps(y, pow2n), keep);
+}
+
+__attribute__((target("avx2,fma")))
+inline float hmax_avx2(__m256 v) {
+    __m128 m = _mm_max_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    m = _mm_max_ps(m, _mm_movehl_ps(m, m));
+    m = _mm_max_ss(m, _mm_shuffle_ps(m, m, 1));
+    return _mm_cvtss_f32(m);
+}
+
+__attribute__((target("avx2,fma")))
+inline float hsum_avx2(__m256 v) {
+    __m128 s = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+    s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+    return _mm_cvtss_f32(s);
+}
+
+__attribute__((target("avx2,fma")))
+float max_value_avx2(const float* x, size_t n) {
+    __m256 m0 = _mm256_set1_ps(-std::numeric_limits<float>::infinity());
+    __m256 m1 = m0;
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        m0 = _mm256_max_ps(m0, _mm256_loadu_ps(x + i));
+        m1 = _mm256_max_ps(m1, _mm256_loadu_ps(x + i + 8));
+    }
+    float m = hmax_avx2(_mm256_max_ps(m0, m1));
+    for (; i < n; i++) {
+        m = std::max(m, x[i]);
+    }
+    return m;
+}
+
+__attribute__((target("avx2,fma")))
+size_t argmax_avx2(const float* x, size_t n) {
+    if (n == 0) return 0;
+    float m = max_value_avx2(x, n);
+
+    // First index holding the maximum
+    __m256 target = _mm256_set1_ps(m);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        int mask = _mm256_movemask_ps(_mm256_cmp_ps(_mm256_loadu_ps(x + i), target, _CMP_EQ_OQ));
+        if (mask) return i + __builtin_ctz(static_cast<unsigned>(mask));
+    }
+    for (; i < n; i++) {
+        if (x[i] == m) return i;
+    }
+    return argmax_scalar(x, n);  // NaN maximum
+}
+
+__attribute__((target("avx2,fma")))
+float exp_sum_avx2(const float* x, float* out, size_t n, float max, float scale) {
+    __m256 vmax = _mm256_set1_ps(max);
+    __m256 vscale = _mm256_set1_ps(scale);
+    __m256 sum = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 e = exp_avx2(_mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(x + i), vmax), vscale));
+        _mm256_storeu_ps(out + i, e);
+        sum = _mm256_add_ps(sum, e);
+    }
+    return hsum_avx2(sum) + exp_sum_scalar(x + i, out + i, n - i, max, scale);
+}
+
+__attribute__((target("avx2,fma")))
+void bucketize_avx2(const float* x, int32_t* out, size_t n, float lo, float scale, int num_buckets) {
+    __m256 vlo = _mm256_set1_ps(lo);
+    __m256 vscale = _mm256_set1_ps(scale);
+    __m256 top = _mm256_set1_ps(static_cast<float>(num_buckets - 1));
+    __m256i below_value = _mm256_set1_epi32(-1);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 v = _mm256_loadu_ps(x + i);
+        __m256 below = _mm256_cmp_ps(v, vlo, _CMP_NGE_UQ);
+        __m256i b = _mm256_cvttps_epi32(_mm256_min_ps(_mm256_mul_ps(_mm256_sub_ps(v, vlo), vscale), top));
+        b = _mm256_blendv_epi8(b, below_value, _mm256_castps_si256(below));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), b);
+    }
+    bucketize_scalar(x + i, out + i, n - i, lo, scale, num_buckets);
+}
+
+__attribute__((target("avx2,fma")))
+size_t select_at_least_avx2(const float* x, size_t n, float threshold, int32_t* out) {
+    __m256 t = _mm256_set1_ps(threshold);
+    size_t count = 0;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        unsigned mask = static_cast<unsigned>(
+            _mm256_movemask_ps(_mm256_cmp_ps(_mm256_loadu_ps(x + i), t, _CMP_GE_OQ)));
+        while (mask) {
+            out[count++] = static_cast<int32_t>(i + __builtin_ctz(mask));
+            mask &= mask - 1;
+        }
+    }
+    for (; i < n; i++) {
+        if (x[i] >= threshold) out[count++] = static_cast<int32_t>(i);
+    }
+    return count;
+}
+
+__attribute__((target("avx2,fma")))
+float scale_mask_max_avx2(float* x, size_t n, float scale, const uint64_t* allowed) {
+    const __m256 neg_inf = _mm256_set1_ps(-std::numeric_limits<float>::infinity());
+    const __m256i lane_bits = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+    __m256 vscale = _mm256_set1_ps(scale);
+    __m256 m = neg_inf;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 v = _mm256_mul_ps(_mm256_loadu_ps(x + i), vscale);
+        if (allowed) {
+            // Spread the 8 bits of these tokens over the lanes, all ones where set
+            int bits = static_cast<int>((allowed[i / 64] >> (i % 64)) & 0xFF);
+            __m256i set = _mm256_and_si256(_mm256_set1_epi32(bits), lane_bits);
+            v = _mm256_blendv_ps(neg_inf, v, _mm256_castsi256_ps(_mm256_cmpeq_epi32(set, lane_bits)));
+        }
+        _mm256_storeu_ps(x + i, v);
+        m = _mm256_max_ps(m, v);
+    }
+
+    // i is only a multiple of 8, so the tail indexes the bitset by its own
+    // position rather than handing the scalar kernel a word-aligned slice
+    float tail = -std::numeric_limits<float>::infinity();
+    for (; i < n; i++) {
+        x[i] = !allowed || ((allowed[i / 64] >> (i % 64)) & 1) ? x[i] * scale
+                                                               : -std::numeric_limits<float>::infinity();
+        tail = std::max(tail, x[i]);
+    }
+    return std::max(hmax_avx2(m), tail);
+}
+
+// ---------------------------------------------------------------------------
+// AVX-512F
+
+__attribute__((target("avx512f")))
+inline __m512 exp_avx512(__m512 x) {
+    const __m512 min_exp = _mm512_set1_ps(kMinExponent);
+    __mmask16 keep = _mm512_cmp_ps_mask(x, min_exp, _CMP_GE_OQ);
+    x = _mm512_max_ps(x, min_exp);
+
+    __m512 fx = _mm512_fmadd_ps(x, _mm512_set1_ps(kLog2e), _mm512_set1_ps(0.5f));
+    fx = _mm512_roundscale_ps(fx, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+    x = _mm512_fnmadd_ps(fx, _mm512_set1_ps(kLn2Hi), x);
+    x = _mm512_fnmadd_ps(fx, _mm512_set1_ps(kLn2Lo), x);
+
+    __m512 y = _mm512_set1_ps(kExpP0);
+    y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(kExpP1));
+    y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(kExpP2));
+    y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(kExpP3));
+    y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(kExpP4));
+    y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(kExpP5));
+    y = _mm512_fmadd_ps(y, _mm512_mul_ps(x, x), x);
+    y = _mm512_add_ps(y, _mm512_set1_ps(1.0f));
+
+    __m512i n = _mm512_add_epi32(_mm512_cvttps_epi32(fx), _mm512_set1_epi32(127));
+    __m512 pow2n = _mm512_castsi512_ps(_mm512_slli_epi32(n, 23));
+    return _mm512_maskz_mov_ps(keep, _mm512_mul_ps(y, pow2n));
+}
+
+__attribute__((target("avx512f")))
+float max_value_avx512(const float* x, size_t n) {
+    const __m512 neg_inf = _mm512_set1_ps(-std::numeric_limits<float>::infinity());
+    __m512 m0 = neg_inf;
+    __m512 m1 = neg_inf;
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        m0 = _mm512_max_ps(m0, _mm512_loadu_ps(x + i));
+        m1 = _mm512_max_ps(m1, _mm512_loadu_ps(x + i + 16));
+    }
+    for (; i < n; i += 16) {
+        __mmask16 tail = n - i >= 16 ? 0xFFFF : static_cast<__mmask16>((1u << (n - i)) - 1);
+        m0 = _mm512_max_ps(m0, _mm512_mask_loadu_ps(neg_inf, tail, x + i));
+    }
+    return _mm512_reduce_max_ps(_mm512_max_ps(m0, m1));
+}
+
+__attribute__((target("avx512f")))
+size_t argmax_avx512(const float* x, size_t n) {
+    if (n == 0) return 0;
+    float m = max_value_avx512(x, n);
+
+    __m512 target = _mm512_set1_ps(m);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __mmask16 mask = _mm512_cmp_ps_mask(_mm512_loadu_ps(x + i), target, _CMP_EQ_OQ);
+        if (mask) return i + __builtin_ctz(static_cast<unsigned>(mask));
+    }
+    for (; i < n; i++) {
+        if (x[i] == m) return i;
+    }
+    return argmax_scalar(x, n);  // NaN maximum
+}
+
+__attribute__((target("avx512f")))
+float exp_sum_avx512(const float* x, float* out, size_t n, float max, float scale) {
+    __m512 vmax = _mm512_set1_ps(max);
+    __m512 vscale = _mm512_set1_ps(scale);
+    __m512 sum = _mm512_setzero_ps();
+    for (size_t i = 0; i < n; i += 16) {
+        __mmask16 tail = n - i >= 16 ? 0xFFFF : static_cast<__mmask16>((1u << (n - i)) - 1);
+        __m512 v = _mm512_maskz_loadu_ps(tail, x + i);
+        __m512 e = exp_avx512(_mm512_mul_ps(_mm512_sub_ps(v, vmax), vscale));
+        _mm512_mask_storeu_ps(out + i, tail, e);
+        sum = _mm512_mask_add_ps(sum, tail, sum, e);
+    }
+    return _mm512_reduce_add_ps(sum);
+}
+
+__attribute__((target("avx512f")))
+void bucketize_avx512(const float* x, int32_t* out, size_t n, float lo, float scale, int num_buckets) {
+    __m512 vlo = _mm512_set1_ps(lo);
+    __m512 vscale = _mm512_set1_ps(scale);
+    __m512 top = _mm512_set1_ps(static_cast<float>(num_buckets - 1));
+    __m512i below_value = _mm512_set1_epi32(-1);
+    for (size_t i = 0; i < n; i += 16) {
+        __mmask16 tail = n - i >= 16 ? 0xFFFF : static_cast<__mmask16>((1u << (n - i)) - 1);
+        __m512 v = _mm512_maskz_loadu_ps(tail, x + i);
+        __mmask16 below = _mm512_cmp_ps_mask(v, vlo, _CMP_NGE_UQ);
+        __m512i b = _mm512_cvttps_epi32(_mm512_min_ps(_mm512_mul_ps(_mm512_sub_ps(v, vlo), vscale), top));
+        b = _mm512_mask_mov_epi32(b, below, below_value);
+        _mm512_mask_storeu_epi32(out + i, tail, b);
+    }
+}
+
+__attribute__((target("avx512f")))
+size_t select_at_least_avx512(const float* x, size_t n, float threshold, int32_t* out) {
+    __m512 t = _mm512_set1_ps(threshold);
+    __m512i index = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    const __m512i step = _mm512_set1_epi32(16);
+    size_t count = 0;
+    for (size_t i = 0; i < n; i += 16) {
+        __mmask16 tail = n - i >= 16 ? 0xFFFF : static_cast<__mmask16>((1u << (n - i)) - 1);
+        __mmask16 hit = _mm512_mask_cmp_ps_mask(tail, _mm512_maskz_loadu_ps(tail, x + i), t, _CMP_GE_OQ);
+        _mm512_mask_compressstoreu_epi32(out + count, hit, index);
+        count += __builtin_popcount(hit);
+        index = _mm512_add_epi32(index, step);
+    }
+    return count;
+}
+
+__attribute__((target("avx512f")))
+float scale_mask_max_avx512(float* x, size_t n, float scale, const uint64_t* allowed) {
+    // The bitset is already a lane mask, 16 tokens at a time
+    const __m512 neg_inf = _mm512_set1_ps(-std::numeric_limits<float>::infinity());
+    __m512 vscale = _mm512_set1_ps(scale);
+    __m512 m = neg_inf;
+    for (size_t i = 0; i < n; i += 16) {
+        __mmask16 tail = n - i >= 16 ? 0xFFFF : static_cast<__mmask16>((1u << (n - i)) - 1);
+        __mmask16 keep = allowed ? static_cast<__mmask16>(allowed[i / 64] >> (i % 64)) & tail : tail;
+        __m512 v = _mm512_mask_mul_ps(neg_inf, keep, _mm512_maskz_loadu_ps(keep, x + i), vscale);
+        _mm512_mask_storeu_ps(x + i, tail, v);
+        m = _mm512_max_ps(m, v);
+    }
+    return _mm512_reduce_max_ps(m);
+}
+
+#endif // SAMPLER_X86_DISPATCH
+
+} // namespace
+
+namespace sampler_kernels {
+
+std::vector<Kernels> supported_kernels() {
+    std::vector<Kernels> supported;
+#ifdef SAMPLER_X86_DISPATCH
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        supported.push_back({"avx512", max_value_avx512, argmax_avx512, exp_sum_avx512, bucketize_avx512,
+                             select_at_least_avx512, scale_mask_max_avx512});
+    }
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        supported.push_back({"avx2", max_value_avx2, argmax_avx2, exp_sum_avx2, bucketize_avx2,
+                             select_at_least_avx2, scale_mask_max_avx2});
+    }
+#endif
+    supported.push_back({"scalar", max_value_scalar, argmax_scalar, exp_sum_scalar, bucketize_scalar,
+                         select_at_least_scalar, scale_mask_max_scalar});
+    return supported;
+}
+
+namespace {
+
+const Kernels& kernels() {
+    static const Kernels selected = supported_kernels().front();
+    return selected;
+}
+
+} // namespace
+
+float max_value(const float* x, size_t n) {
+    return kernels().max_value(x, n);
+}
+
+size_t argmax(const float* x, size_t n) {
+    return kernels().argmax(x, n);
+}
+
+float exp_sum(const float* x, float* out, size_t n, float max, float scale) {
+    return kernels().exp_sum(x, out, n, max, scale);
+}
+
+void bucketize(const float* x, int32_t* out, size_t n, float lo, float scale, int num_buckets) {
+    kernels().bucketize(x, out, n, lo, scale, num_buckets);
+}
+
+size_t select_at_least(const float* x, size_t n, float threshold, int32_t* out) {
+    return kernels().select_at_least(x, n, threshold, out);
+}
+
+float prepare_logits(float* x, size_t n, float scale, const uint64_t* allowed, float* sum) {
+    const Kernels& k = kernels();
+    if (!sum) return k.scale_mask_max(x, n, scale, allowed);
+
+    // Both sweeps run over one L1-sized chunk at a time, so the row is read
+    // from memory once. The sum is kept relative to the running maximum and
+    // rescaled when a chunk raises it.
+    float scratch[kPrepareChunk];
+    float max = -std::numeric_limits<float>::infinity();
+    float total = 0.0f;
+    for (size_t i = 0; i < n; i += kPrepareChunk) {
+        size_t count = std::min(kPrepareChunk, n - i);
+        float chunk_max = k.scale_mask_max(x + i, count, scale, allowed ? allowed + i / 64 : nullptr);
+        if (chunk_max > max) {
+            total *= std::exp(max - chunk_max);
+            max = chunk_max;
+        }
+        if (chunk_max > -std::numeric_limits<float>::infinity()) {
+            total += k.exp_sum(x + i, scratch, count, max, 1.0f);
+        }
+    }
+    *sum = total;
+    return max;
+}
+
+const char* isa_name() {
+    return kernels().name;
+}
+
+} // namespace sampler_kernels
+
+Sampler::Sampler(uint64_t seed)
+    : rng_(static_cast<std::mt19937::result_type>(seed)),
+      bucket_counts_(kNumBuckets),
+      bucket_mass_(kNumBuckets) {}
+
+int Sampler::draw(const int* candidates, size_t count, float total) {
+    std::uniform_real_distribution<float> dist(0.0f, total);
+    float u = dist(rng_);
+
+    float cumsum = 0.0f;
+    int last = candidates ? candidates[0] : 0;
+    for (size_t i = 0; i < count; i++) {
+        int id = candidates ? candidates[i] : static_cast<int>(i);
+        float p = probs_[id];
+        if (p <= 0.0f) continue;
+        cumsum += p;
+        last = id;
+        if (u < cumsum) return id;
+    }
+    // u landed on the total through rounding
+    return last;
+}
+
+int Sampler::sample(const float* logits, size_t n, float temperature, int top_k, float top_p) {
+    if (temperature <= 0.0f) {
+        return sample_greedy(logits, n);
+    } else if (top_k > 0 && static_cast<size_t>(top_k) < n) {
+        return sample_top_k(logits, n, top_k, temperature);
+    } else if (top_p < 1.0f) {
+        return sample_top_p(logits, n, top_p, temperature);
+    }
+    return sample_with_temperature(logits, n, temperature);
+}
+
+int Sampler::sample_greedy(const float* logits, size_t n) {
+    return static_cast<int>(sampler_kernels::argmax(logits, n));
+}
+
+int Sampler::sample_with_temperature(const float* logits, size_t n, float temperature) {
+    if (n == 0) return -1;
+    probs_.resize(n);
+
+    float max = sampler_kernels::max_value(logits, n);
+    float total = sampler_kernels::exp_sum(logits, probs_.data(), n, max, 1.0f / temperature);
+    return draw(nullptr, n, total);
+}
+
+size_t Sampler::collect_top_k(const float* logits, size_t n, int k, float max, float temperature) {
+    // Estimate a threshold a little below the k-th largest logit from a
+    // strided sample, then take everything at or above it in one pass
+    size_t stride = n / (static_cast<size_t>(k) * kSamplesPerCandidate);
+    if (stride >= 2) {
+        sample_.clear();
+        for (size_t i = 0; i < n; i += stride) {
+            sample_.push_back(logits[i]);
+        }
+        size_t rank = std::min(sample_.size() - 1, 2 * static_cast<size_t>(k) * sample_.size() / n + 8);
+        std::nth_element(sample_.begin(), sample_.begin() + rank, sample_.end(), std::greater<float>());
+
+        size_t count = sampler_kernels::select_at_least(logits, n, sample_[rank], candidates_.data());
+        if (count >= static_cast<size_t>(k)) return count;
+    }
+
+    // The estimate was too high: histogram the logits that can have non-zero
+    // probability and walk the buckets down from the maximum until they hold
+    // at least k tokens
+    float range = kLogitRange * temperature;
+    sampler_kernels::bucketize(logits, buckets_.data(), n, max - range, kNumBuckets / range, kNumBuckets);
+
+    std::fill(bucket_counts_.begin(), bucket_counts_.end(), 0u);
+    for (size_t i = 0; i < n; i++) {
+        if (buckets_[i] >= 0) bucket_counts_[buckets_[i]]++;
+    }
+
+    int boundary = 0;
+    uint32_t seen = 0;
+    for (int b = kNumBuckets - 1; b >= 0; b--) {
+        seen += bucket_counts_[b];
+        if (seen >= static_cast<uint32_t>(k)) {
+            boundary = b;
+            break;
+        }
+    }
+
+    size_t count = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (buckets_[i] >= boundary) {
+            candidates_[count++] = static_cast<int>(i);
+        }
+    }
+    return count;
+}
+
+size_t Sampler::top_k_candidates(const float* logits, size_t n, int k, float temperature, float max,
+                                 float& total) {
+    probs_.resize(n);
+    candidates_.resize(n);
+    buckets_.resize(n);
+
+    size_t count = collect_top_k(logits, n, k, max, temperature);
+
+    // Only the few candidates past the threshold are ordered, to cut the set
+    // down to exactly k
+    if (count > static_cast<size_t>(k)) {
+        std::nth_element(candidates_.begin(), candidates_.begin() + k, candidates_.begin() + count,
+            [logits](int a, int b) { return logits[a] > logits[b]; });
+        count = k;
+    }
+
+    float scale = 1.0f / temperature;
+    total = 0.0f;
+    for (size_t i = 0; i < count; i++) {
+        int id = candidates_[i];
+        probs_[id] = std::exp((logits[id] - max) * scale);
+        total += probs_[id];
+    }
+    return count;
+}
+
+int Sampler::sample_top_k(const float* logits, size_t n, int k, float temperature) {
+    if (n == 0) return -1;
+    float total;
+    size_t count = top_k_candidates(logits, n, k, temperature, sampler_kernels::max_value(logits, n), total);
+    return draw(candidates_.data(), count, total);
+}
+
+size_t Sampler::top_p_candidates(const float* logits, size_t n, float p, float temperature, float max,
+                                 float& total) {
+    probs_.resize(n);
+    candidates_.resize(n);
+    buckets_.resize(n);
+
+    float full_total = sampler_kernels::exp_sum(logits, probs_.data(), n, max, 1.0f / temperature);
+    float target = p * full_total;
+
+    // Probability mass per logit bucket; walk down from the maximum until the
+    // buckets cover p of the total
+    float range = kLogitRange * temperature;
+    sampler_kernels::bucketize(logits, buckets_.data(), n, max - range, kNumBuckets / range, kNumBuckets);
+
+    std::fill(bucket_mass_.begin(), bucket_mass_.end(), 0.0f);
+    for (size_t i = 0; i < n; i++) {
+        if (buckets_[i] >= 0) bucket_mass_[buckets_[i]] += probs_[i];
+    }
+
+    int boundary = 0;
+    float mass = 0.0f;
+    for (int b = kNumBuckets - 1; b >= 0; b--) {
+        mass += bucket_mass_[b];
+        if (mass >= target) {
+            boundary = b;
+            break;
+        }
+    }
+
+    // Sort just the tokens in and above the boundary bucket to find the exact
+    // nucleus, as a full sort by probability would
+    size_t count = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (buckets_[i] >= boundary) {
+            candidates_[count++] = static_cast<int>(i);
+        }
+    }
+    std::sort(candidates_.begin(), candidates_.begin() + count,
+        [logits](int a, int b) { return logits[a] > logits[b]; });
+
+    float cumsum = 0.0f;
+    size_t nucleus_size = 0;
+    while (nucleus_size < count) {
+        cumsum += probs_[candidates_[nucleus_size++]];
+        if (cumsum >= target) break;
+    }
+    total = cumsum;
+    return nucleus_size;
+}
+
+int Sampler::sample_top_p(const float* logits, size_t n, float p, float temperature) {
+    if (n == 0) return -1;
+    float total;
+    size_t count = top_p_candidates(logits, n, p, temperature, sampler_kernels::max_value(logits, n), total);
+    return draw(candidates_.data(), count, total);
+}
+
+void Sampler::distribution(const float* logits, size_t n, float temperature, int top_k, float top_p,
+                           float* out) {
+    if (n == 0) return;
+
+    if (temperature <= 0.0f) {
+        std::fill(out, out + n, 0.0f);
+        out[sampler_kernels::argmax(logits, n)] = 1.0f;
+        return;
+    }
+
+    size_t count = 0;
+    float total = 0.0f;
+    if (top_k > 0 && static_cast<size_t>(top_k) < n) {
+        count = top_k_candidates(logits, n, top_k, temperature, sampler_kernels::max_value(logits, n), total);
+    } else if (top_p < 1.0f) {
+        count = top_p_candidates(logits, n, top_p, temperature, sampler_kernels::max_value(logits, n), total);
+    } else {
+        float max = sampler_kernels::max_value(logits, n);
+        float inv = 1.0f / sampler_kernels::exp_sum(logits, out, n, max, 1.0f / temperature);
+        for (size_t i = 0; i < n; i++) out[i] *= inv;
+        return;
+    }
+
+    std::fill(out, out + n, 0.0f);
+    float inv = 1.0f / total;
+    for (size_t i = 0; i < count; i++) {
+        int id = candidates_[i];
+        out[id] = probs_[id] * inv;
+    }
+}
+
+int Sampler::sample_prepared(const float* logits, size_t n, float max, float sum, bool greedy, int top_k,
+                             float top_p) {
+    if (n == 0) return -1;
+    if (!(max > -std::numeric_limits<float>::infinity())) return 0;  // Every token masked
+
+    if (greedy) {
+        // First index holding the maximum, as argmax() would pick
+        candidates_.resize(n);
+        if (sampler_kernels::select_at_least(logits, n, max, candidates_.data()) > 0) return candidates_[0];
+        return static_cast<int>(sampler_kernels::argmax(logits, n));  // NaN maximum
+    }
+
+    // The temperature is already applied
+    float total;
+    if (top_k > 0 && static_cast<size_t>(top_k) < n) {
+        size_t count = top_k_candidates(logits, n, top_k, 1.0f, max, total);
+        return draw(candidates_.data(), count, total);
+    }
+    if (top_p < 1.0f) {
+        size_t count = top_p_candidates(logits, n, top_p, 1.0f, max, total);
+        return draw(candidates_.data(), count, total);
+    }
+    return draw_softmax(logits, n, max, sum);
+}
+
+int Sampler::draw_softmax(const float* logits, size_t n, float max, float total) {
+    probs_.resize(std::min(n, kDrawBlock));
+    std::uniform_real_distribution<float> dist(0.0f, total);
+    float u = dist(rng_);
+
+    // Whole blocks before the one u falls in are only summed
+    float cumsum = 0.0f;
+    for (size_t i = 0; i < n; i += kDrawBlock) {
+        size_t count = std::min(kDrawBlock, n - i);
+        float block = sampler_kernels::exp_sum(logits + i, probs_.data(), count, max, 1.0f);
+        if (cumsum + block < u) {
+            cumsum += block;
+            continue;
+        }
+        int last = -1;
+        for (size_t j = 0; j < count; j++) {
+            if (probs_[j] <= 0.0f) continue;
+            cumsum += probs_[j];
+            last = static_cast<int>(i + j);
+            if (u < cumsum) return last;
+        }
+        if (last >= 0) return last;  // Rounding within the block
+    }
+    // u landed on the total through rounding
+    return static_cast<int>(sampler_kernels::argmax(logits, n));
+}
+
+int Sampler::sample_weights(const float* weights, size_t n) {
+    float total = 0.0f;
+    for (size_t i = 0; i < n; i++) total += weights[i];
+    if (!(total > 0.0f)) return -1;
+
+    std::uniform_real_distribution<float> dist(0.0f, total);
+    float u = dist(rng_);
+
+    float cumsum = 0.0f;
+    int last = -1;
+    for (size_t i = 0; i < n; i++) {
+        if (weights[i] <= 0.0f) continue;
+        cumsum += weights[i];
+        last = static_cast<int>(i);
+        if (u < cumsum) return last;
+    }
+    // u landed on the total through rounding
+    return last;
+}
+
+float Sampler::uniform() {
+    return std::uniform_real_distribution<float>(0.0f, 1.0f)(rng_);
+}
@@ -0,0 +1,469 @@
+#include "scheduler.h"
+#include <algorithm>
+#include <iostream>
+#include <limits>
+
+bool Scheduler::AdmissionOrder::operator()(const SequencePtr& a, const SequencePtr& b) const {
+    if (a->request.priority != b->request.priority) {
+        return a->request.priority > b->request.priority;
+    }
+    if (a->request.deadline != b->request.deadline) {
+        return a->request.deadline < b->request.deadline;
+    }
+    return a->arrival < b->arrival;
+}
+
+Scheduler::Scheduler(InferenceEngine& engine, Tokenizer& tokenizer, size_t max_batch_size, size_t step_tokens)
+    : engine_(engine),
+      tokenizer_(tokenizer),
+      generator_(engine, tokenizer),
+      max_batch_size_(std::max<size_t>(max_batch_size, 1)),
+      step_tokens_(step_tokens),
+      streamer_(tokenizer) {}
+
+Scheduler::~Scheduler() {
+    stop();
+}
+
+bool Scheduler::start() {
+    if (!engine_.supports_kv_cache()) {
+        std::cerr << "Scheduler requires a model with past_key_values inputs" << std::endl;
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (worker_.joinable()) return true;
+    stopping_ = false;
+    worker_ = std::thread(&Scheduler::run_loop, this);
+    return true;
+}
+
+void Scheduler::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    cv_.notify_all();
+    if (worker_.joinable()) {
+        worker_.join();
+        streamer_.drain();  // Every result is set once stop() returns
+    }
+}
+
+RequestHandle Scheduler::submit(GenerationRequest request) {
+    auto sequence = std::make_shared<Sequence>();
+    sequence->request = std::move(request);
+    RequestHandle handle;
+    handle.result = sequence->promise.get_future();
+
+    bool stopping;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        sequence->id = next_id_++;
+        sequence->arrival = sequence->id;
+        handle.id = sequence->id;
+        stopping = stopping_;
+        if (!stopping) {
+            active_[sequence->id] = sequence;
+            queue_.insert(sequence);
+        }
+    }
+    if (stopping) {
+        sequence->finished = true;
+        complete(*sequence, {RequestStatus::Cancelled, "", {}});
+        return handle;
+    }
+    Metrics::global().requests++;
+    Metrics::global().queue_depth++;
+    cv_.notify_one();
+    return handle;
+}
+
+bool Scheduler::cancel(uint64_t id) {
+    // A queued request holds no engine state, so it can finish right here
+    // instead of occupying its queue slot until it would have been admitted
+    SequencePtr queued;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = active_.find(id);
+        if (it == active_.end()) return false;
+        it->second->cancelled = true;
+        auto entry = queue_.find(it->second);
+        if (entry != queue_.end()) {
+            queued = *entry;
+            queue_.erase(entry);
+            active_.erase(it);
+        }
+    }
+    if (queued) {
+        Metrics::global().queue_depth--;
+        queued->finished = true;
+        complete(*queued, {RequestStatus::Cancelled, "", {}});
+    }
+    return true;
+}
+
+size_t Scheduler::queue_depth() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return queue_.size();
+}
+
+void Scheduler::run_loop() {
+    while (true) {
+        std::vector<SequencePtr> admitted;
+        std::vector<SequencePtr> expired;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cv_.wait(lock, [this] {
+                return stopping_ || !queue_.empty() || !running_.empty() || prefill_.rows() > 0;
+            });
+            if (stopping_) break;
+
+            expired = take_expired();
+
+            // Fill free batch slots at every step, not only when the batch
+            // drains; a new group starts prefilling once the last one has joined
+            while (prefill_.rows() == 0 && !queue_.empty() && running_.size() + admitted.size() < max_batch_size_) {
+                admitted.push_back(*queue_.begin());
+                queue_.erase(queue_.begin());
+            }
+        }
+        Metrics::global().queue_depth -= static_cast<int64_t>(admitted.size() + expired.size());
+
+        for (auto& sequence : expired) {
+            finish(*sequence, RequestStatus::DeadlineExceeded);
+        }
+
+        if (!admitted.empty()) {
+            admit(std::move(admitted));
+        }
+        size_t decoded = running_.size();
+        if (!running_.empty()) {
+            decode_step();
+        }
+        if (prefill_.rows() > 0) {
+            prefill_step(decoded);
+        }
+        size_t running = running_.size() + prefill_.rows();
+        Metrics::global().running += static_cast<int64_t>(running) - static_cast<int64_t>(running_count_);
+        running_count_ = running;
+    }
+
+    // Shut down: everything still queued or running ends as cancelled
+    for (auto& sequence : running_) {
+        finish(*sequence, RequestStatus::Cancelled);
+    }
+    for (auto& sequence : prefill_.sequences) {
+        finish(*sequence, RequestStatus::Cancelled);
+    }
+    running_.clear();
+    cache_.clear();
+    prefill_ = Prefill();
+    Metrics::global().running -= static_cast<int64_t>(running_count_);
+    running_count_ = 0;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    while (!queue_.empty()) {
+        auto sequence = *queue_.begin();
+        queue_.erase(queue_.begin());
+        Metrics::global().queue_depth--;
+        sequence->finished = true;
+        complete(*sequence, {RequestStatus::Cancelled, "", sequence->tokens});
+        active_.erase(sequence->id);
+    }
+}
+
+std::vector<Scheduler::SequencePtr> Scheduler::take_expired() {
+    std::vector<SequencePtr> expired;
+    auto now = std::chrono::steady_clock::now();
+    for (auto it = queue_.begin(); it != queue_.end();) {
+        if (now > (*it)->request.deadline) {
+            expired.push_back(*it);
+            it = queue_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    return expired;
+}
+
+void Scheduler::admit(std::vector<SequencePtr> admitted) {
+    auto now = std::chrono::steady_clock::now();
+
+    // Encode prompts; requests that are already over are finished right away
+    std::vector<SequencePtr> prefill;
+    std::vector<std::vector<int64_t>> prompts;
+    size_t prompt_len = 0;
+    for (auto& sequence : admitted) {
+        if (sequence->cancelled) {
+            finish(*sequence, RequestStatus::Cancelled);
+            continue;
+        }
+        if (now > sequence->request.deadline) {
+            finish(*sequence, RequestStatus::DeadlineExceeded);
+            continue;
+        }
+        if (sequence->request.config.max_length <= 0) {
+            finish(*sequence, RequestStatus::Completed);
+            continue;
+        }
+
+        std::vector<int> token_ids;
+        {
+            Span span(Metrics::global().tokenize);
+            token_ids = tokenizer_.encode(sequence->request.prompt);
+        }
+        Metrics::global().prompt_tokens += token_ids.size();
+        std::vector<int64_t> ids(token_ids.begin(), token_ids.end());
+        if (ids.empty()) {
+            ids.push_back(tokenizer_.bos_token_id());
+        }
+        std::vector<int64_t> fitted = TextGenerator::fit_prompt(ids, sequence->request.config);
+        Metrics::global().evicted_tokens += ids.size() - fitted.size();
+        ids = std::move(fitted);
+        prompt_len = std::max(prompt_len, ids.size());
+        prompts.push_back(std::move(ids));
+        prefill.push_back(sequence);
+    }
+    if (prefill.empty()) return;
+
+    // Left pad every prompt to the longest; padding is masked out
+    Prefill& group = prefill_;
+    size_t rows = prefill.size();
+    group.length = prompt_len;
+    group.fed = 0;
+    group.input_ids.assign(rows * prompt_len, 0);
+    group.attention_mask.assign(rows * prompt_len, 0);
+    for (size_t b = 0; b < rows; b++) {
+        size_t pad = prompt_len - prompts[b].size();
+        std::copy(prompts[b].begin(), prompts[b].end(), group.input_ids.begin() + b * prompt_len + pad);
+        std::fill_n(group.attention_mask.begin() + b * prompt_len + pad, prompts[b].size(), 1);
+    }
+    group.sequences = std::move(prefill);
+    group.prompts = std::move(prompts);
+    group.cache.clear();
+}
+
+void Scheduler::prefill_step(size_t decoded) {
+    retire_prefill();
+    Prefill& group = prefill_;
+    size_t rows = group.rows();
+    if (rows == 0) return;
+
+    // This step's chunk: what the decoded rows left of the budget, split
+    // between the prompts
+    size_t columns = group.length - group.fed;
+    if (step_tokens_ > 0) {
+        size_t left = step_tokens_ > decoded ? step_tokens_ - decoded : 0;
+        columns = std::min(columns, std::max<size_t>(left / rows, 1));
+    }
+    std::vector<int64_t> input_ids(rows * columns);
+    std::vector<int64_t> attention_mask(rows * columns);
+    for (size_t b = 0; b < rows; b++) {
+        size_t from = b * group.length + group.fed;
+        std::copy_n(group.input_ids.begin() + from, columns, input_ids.begin() + b * columns);
+        std::copy_n(group.attention_mask.begin() + from, columns, attention_mask.begin() + b * columns);
+    }
+
+    bool ok;
+    {
+        Span span(Metrics::global().prefill);
+        ok = engine_.forward(input_ids, attention_mask, rows, group.cache);
+    }
+    if (!ok) {
+        for (auto& sequence : group.sequences) {
+            finish(*sequence, RequestStatus::Failed);
+        }
+        prefill_ = Prefill();
+        return;
+    }
+    group.fed += columns;
+    if (group.fed < group.length) return;
+
+    for (size_t b = 0; b < rows; b++) {
+        Sequence& sequence = *group.sequences[b];
+        sequence.sampling = SamplingState(sequence.request.config, group.prompts[b]);
+        if (sequence.request.on_token) {
+            sequence.output = streamer_.open(sequence.request.on_token);
+        }
+        accept_token(sequence, sample(sequence, b));
+    }
+
+    // Join the running batch; rows that finished on their first token leave again
+    cache_.append_rows(std::move(group.cache));
+    running_.insert(running_.end(), group.sequences.begin(), group.sequences.end());
+    prefill_ = Prefill();
+    retire_finished();
+}
+
+void Scheduler::retire_prefill() {
+    Prefill& group = prefill_;
+    auto now = std::chrono::steady_clock::now();
+
+    std::vector<size_t> keep;
+    for (size_t b = 0; b < group.rows(); b++) {
+        Sequence& sequence = *group.sequences[b];
+        if (sequence.cancelled) {
+            finish(sequence, RequestStatus::Cancelled);
+        } else if (now > sequence.request.deadline) {
+            finish(sequence, RequestStatus::DeadlineExceeded);
+        } else {
+            keep.push_back(b);
+        }
+    }
+    if (keep.size() == group.rows()) return;
+    if (keep.empty()) {
+        prefill_ = Prefill();
+        return;
+    }
+
+    Prefill kept;
+    kept.length = group.length;
+    kept.fed = group.fed;
+    for (size_t b : keep) {
+        kept.sequences.push_back(group.sequences[b]);
+        kept.prompts.push_back(std::move(group.prompts[b]));
+        auto ids = group.input_ids.begin() + b * group.length;
+        auto mask = group.attention_mask.begin() + b * group.length;
+        kept.input_ids.insert(kept.input_ids.end(), ids, ids + group.length);
+        kept.attention_mask.insert(kept.attention_mask.end(), mask, mask + group.length);
+    }
+    kept.cache = std::move(group.cache);
+    if (!kept.cache.empty()) kept.cache.select_rows(keep);
+
+    // Columns that are now padding in every row need not be fed at all
+    size_t longest = 0;
+    for (const auto& prompt : kept.prompts) longest = std::max(longest, prompt.size());
+    kept.fed = std::max(kept.fed, kept.length - longest);
+    prefill_ = std::move(kept);
+}
+
+void Scheduler::decode_step() {
+    size_t batch_size = running_.size();
+    std::vector<int64_t> input_ids(batch_size);
+    std::vector<int64_t> attention_mask(batch_size, 1);
+    for (size_t b = 0; b < batch_size; b++) {
+        input_ids[b] = running_[b]->pending_token;
+    }
+
+    fit_context();
+
+    bool ok;
+    {
+        Span span(Metrics::global().decode);
+        ok = engine_.forward(input_ids, attention_mask, batch_size, cache_);
+    }
+    if (!ok) {
+        for (auto& sequence : running_) {
+            finish(*sequence, RequestStatus::Failed);
+        }
+        running_.clear();
+        cache_.clear();
+        return;
+    }
+
+    for (size_t b = 0; b < batch_size; b++) {
+        accept_token(*running_[b], sample(*running_[b], b));
+    }
+
+    retire_finished();
+}
+
+void Scheduler::fit_context() {
+    // Rows within their limit keep every position
+    std::vector<KVCache::Retain> retain(running_.size(), {std::numeric_limits<int64_t>::max(), 0});
+    bool evict = false;
+    for (size_t b = 0; b < running_.size(); b++) {
+        const GenerationConfig& config = running_[b]->request.config;
+        if (config.max_positions > 0 && cache_.next_position(b) >= config.max_positions) {
+            retain[b] = TextGenerator::context_retain(config, static_cast<size_t>(config.max_positions), 1);
+            evict = true;
+        }
+    }
+    if (evict) {
+        Metrics::global().evicted_tokens += cache_.evict(retain);
+    }
+}
+
+int Scheduler::sample(Sequence& sequence, size_t row) {
+    return generator_.sample_next(engine_.mutable_last_logits(row), engine_.get_vocab_size(), sequence.request.config,
+                                  sequence.sampling);
+}
+
+void Scheduler::accept_token(Sequence& sequence, int token) {
+    const GenerationConfig& config = sequence.request.config;
+    sequence.num_sampled++;
+
+    if (token == config.eos_token_id) {
+        finish(sequence, RequestStatus::Completed);
+        return;
+    }
+
+    sequence.timer.token();
+    sequence.tokens.push_back(token);
+    sequence.pending_token = token;
+    if (sequence.output) {
+        streamer_.push(sequence.output, token);
+    }
+
+    if (sequence.num_sampled >= config.max_length) {
+        finish(sequence, RequestStatus::Completed);
+    }
+}
+
+void Scheduler::retire_finished() {
+    auto now = std::chrono::steady_clock::now();
+
+    std::vector<size_t> keep;
+    std::vector<SequencePtr> still_running;
+    for (size_t b = 0; b < running_.size(); b++) {
+        Sequence& sequence = *running_[b];
+        if (!sequence.finished && sequence.cancelled) {
+            finish(sequence, RequestStatus::Cancelled);
+        } else if (!sequence.finished && now > sequence.request.deadline) {
+            finish(sequence, RequestStatus::DeadlineExceeded);
+        }
+
+        if (!sequence.finished) {
+            keep.push_back(b);
+            still_running.push_back(running_[b]);
+        }
+    }
+
+    if (still_running.size() != running_.size()) {
+        cache_.select_rows(keep);
+        running_ = std::move(still_running);
+    }
+}
+
+void Scheduler::finish(Sequence& sequence, RequestStatus status) {
+    if (sequence.finished) return;
+    sequence.finished = true;
+
+    // Complete after the sequence's last text is delivered
+    SequencePtr self = sequence.shared_from_this();
+    streamer_.close(std::move(sequence.output), [this, self, status] {
+        GenerationResult result;
+        result.status = status;
+        result.tokens = self->tokens;
+        result.text = tokenizer_.decode(self->tokens);
+        complete(*self, std::move(result));
+    });
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    active_.erase(sequence.id);
+}
+
+void Scheduler::complete(Sequence& sequence, GenerationResult result) {
+    // The future is set even if the callback throws, so no caller waits forever
+    if (sequence.request.on_complete) {
+        try {
+            sequence.request.on_complete(result);
+        } catch (const std::exception& e) {
+            std::cerr << "Request " << sequence.id << " on_complete: " << e.what() << std::endl;
+        } catch (...) {
+            std::cerr << "Request " << sequence.id << " on_complete: unknown exception" << std::endl;
+        }
+    }
+    sequence.promise.set_value(std::move(result));
+}
@@ -0,0 +1,573 @@
+#include "server.h"
+#include "metrics.h"
+#include <iostream>
+#include <nlohmann/json.hpp>
+#include <stdexcept>
+
+#ifdef __linux__
+#include <cerrno>
+#include <cstring>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+using json = nlohmann::json;
+
+#ifdef __linux__
+
+namespace {
+
+constexpr uint64_t kWakeKey = 0;
+constexpr size_t kMaxLineBytes = 1 << 20;
+constexpr size_t kReadChunk = 64 * 1024;
+
+// A client that does not read its replies stops being read from once this
+// much output is queued for it, and is disconnected (its requests
+// cancelled) if running requests push the queue past the hard limit
+constexpr size_t kMaxQueuedOutput = 1 << 20;
+constexpr size_t kMaxOutputBytes = 16 << 20;
+
+// Unfinished requests one connection may have
+constexpr size_t kMaxRequestsPerConnection = 64;
+
+const char* status_name(RequestStatus status) {
+    switch (status) {
+        case RequestStatus::Completed: return "completed";
+        case RequestStatus::Cancelled: return "cancelled";
+        case RequestStatus::DeadlineExceeded: return "deadline_exceeded";
+        case RequestStatus::Failed: return "failed";
+    }
+    return "unknown";
+}
+
+// Generated text can end in an incomplete UTF-8 character; replace it rather
+// than failing the whole reply
+std::string to_line(const json& reply) {
+    return reply.dump(-1, ' ', false, json::error_handler_t::replace) + "\n";
+}
+
+std::string error_line(const json& id, const std::string& message) {
+    return to_line({{"id", id}, {"error", message}});
+}
+
+// Regex constraints kept for reuse before the oldest are dropped
+constexpr size_t kMaxRegexConstraints = 64;
+
+// Fill request from a generation message over the server defaults; throws
+// json::exception on missing or mistyped fields, std::invalid_argument on a
+// bad logit_bias key
+void parse_request(const json& message, GenerationRequest& request) {
+    request.prompt = message.at("prompt").get<std::string>();
+
+    GenerationConfig& config = request.config;
+    config.max_length = message.value("max_length", config.max_length);
+    config.temperature = message.value("temperature", config.temperature);
+    config.top_k = message.value("top_k", config.top_k);
+    config.top_p = message.value("top_p", config.top_p);
+    config.eos_token_id = message.value("eos_token_id", config.eos_token_id);
+    config.repetition_penalty = message.value("repetition_penalty", config.repetition_penalty);
+    config.presence_penalty = message.value("presence_penalty", config.presence_penalty);
+    config.frequency_penalty = message.value("frequency_penalty", config.frequency_penalty);
+    config.min_length = message.value("min_length", config.min_length);
+    if (message.contains("logit_bias")) {
+        // {"<token id>": bias, ...}
+        config.logit_bias.clear();
+        for (const auto& [token, bias] : message.at("logit_bias").items()) {
+            char* end = nullptr;
+            long id = std::strtol(token.c_str(), &end, 10);
+            if (token.empty() || *end != '\0') {
+                throw std::invalid_argument("logit_bias keys must be token ids");
+            }
+            config.logit_bias.push_back({static_cast<int>(id), bias.get<float>()});
+        }
+    }
+    if (message.contains("bad_words")) {
+        config.bad_words = message.at("bad_words").get<std::vector<std::vector<int>>>();
+    }
+    request.priority = message.value("priority", 0);
+
+    int64_t timeout_ms = message.value("timeout_ms", int64_t{0});
+    if (timeout_ms > 0) {
+        request.deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    }
+}
+
+} // namespace
+
+Server::Server(Scheduler& scheduler, const GenerationConfig& defaults)
+    : scheduler_(scheduler), defaults_(defaults) {
+    epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+    wake_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (epoll_fd_ >= 0 && wake_fd_ >= 0) {
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.u64 = kWakeKey;
+        epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wake_fd_, &event);
+    }
+}
+
+Server::~Server() {
+    for (auto& [key, connection] : connections_) {
+        close(connection->fd);
+    }
+    for (auto& [key, fd] : listeners_) {
+        close(fd);
+    }
+    if (!unix_path_.empty()) {
+        unlink(unix_path_.c_str());
+    }
+    if (wake_fd_ >= 0) close(wake_fd_);
+    if (epoll_fd_ >= 0) close(epoll_fd_);
+}
+
+bool Server::listen_unix(const std::string& path) {
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(address.sun_path)) {
+        std::cerr << "Invalid socket path: " << path << std::endl;
+        return false;
+    }
+    std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+
+    // A socket file left behind by an earlier run would make bind() fail
+    struct stat st;
+    if (lstat(path.c_str(), &st) == 0) {
+        if (!S_ISSOCK(st.st_mode)) {
+            std::cerr << "Not a socket, refusing to replace: " << path << std::endl;
+            return false;
+        }
+        unlink(path.c_str());
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0 || bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+        std::cerr << "Failed to bind " << path << ": " << std::strerror(errno) << std::endl;
+        if (fd >= 0) close(fd);
+        return false;
+    }
+    if (!add_listener(fd, path)) return false;
+    unix_path_ = path;
+    return true;
+}
+
+bool Server::listen_tcp(const std::string& host, int port) {
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    addrinfo* addresses = nullptr;
+    std::string service = std::to_string(port);
+    int rc = getaddrinfo(host.c_str(), service.c_str(), &hints, &addresses);
+    if (rc != 0) {
+        std::cerr << "Failed to resolve " << host << ": " << gai_strerror(rc) << std::endl;
+        return false;
+    }
+
+    int fd = -1;
+    for (addrinfo* ai = addresses; ai; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, ai->ai_protocol);
+        if (fd < 0) continue;
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (bind(fd, ai->ai_addr, ai->ai_addrlen) == 0) break;
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(addresses);
+    if (fd < 0) {
+        std::cerr << "Failed to bind " << host << ":" << port << ": " << std::strerror(errno) << std::endl;
+        return false;
+    }
+    return add_listener(fd, host + ":" + service);
+}
+
+bool Server::add_listener(int fd, const std::string& description) {
+    if (epoll_fd_ < 0 || wake_fd_ < 0) {
+        std::cerr << "Failed to create epoll instance" << std::endl;
+        close(fd);
+        return false;
+    }
+    if (listen(fd, SOMAXCONN) != 0) {
+        std::cerr << "Failed to listen on " << description << ": " << std::strerror(errno) << std::endl;
+        close(fd);
+        return false;
+    }
+
+    uint64_t key = next_key_++;
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.u64 = key;
+    epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &event);
+    listeners_.push_back({key, fd});
+    std::cout << "Listening on " << description << std::endl;
+    return true;
+}
+
+bool Server::run() {
+    if (listeners_.empty()) {
+        std::cerr << "Server has nothing to listen on" << std::endl;
+        return false;
+    }
+
+    bool ok = true;
+    std::vector<epoll_event> events(256);
+    while (!stopping_) {
+        int n = epoll_wait(epoll_fd_, events.data(), static_cast<int>(events.size()), -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            std::cerr << "epoll_wait failed: " << std::strerror(errno) << std::endl;
+            ok = false;
+            break;
+        }
+
+        for (int i = 0; i < n; i++) {
+            uint64_t key = events[i].data.u64;
+            uint32_t flags = events[i].events;
+            if (key == kWakeKey) {
+                uint64_t count;
+                while (read(wake_fd_, &count, sizeof(count)) > 0) {}
+                drain_outbox();
+                continue;
+            }
+
+            bool is_listener = false;
+            for (auto& [listener_key, fd] : listeners_) {
+                if (listener_key == key) {
+                    accept_connections(fd);
+                    is_listener = true;
+                }
+            }
+            if (is_listener) continue;
+
+            auto it = connections_.find(key);
+            if (it == connections_.end()) continue;
+            Connection& connection = *it->second;
+            if (flags & (EPOLLERR | EPOLLHUP)) {
+                connection.broken = true;
+            } else if (flags & (EPOLLIN | EPOLLRDHUP)) {
+                read_connection(connection);
+                size_t start = 0;
+                size_t end;
+                while (!connection.broken && (end = connection.input.find('\n', start)) != std::string::npos) {
+                    std::string line = connection.input.substr(start, end - start);
+                    start = end + 1;
+                    if (!line.empty() && line.back() == '\r') line.pop_back();
+                    if (!line.empty()) handle_line(key, connection, line);
+                }
+                connection.input.erase(0, start);
+                if (connection.input.size() > kMaxLineBytes) {
+                    connection.output += error_line(nullptr, "request line too long");
+                    connection.input.clear();
+                    connection.read_closed = true;
+                }
+            }
+            service(key);
+        }
+    }
+
+    // Cancel whatever is still running; the scheduler's callbacks point at
+    // this server, so wait until every request has completed
+    for (auto& [key, connection] : connections_) {
+        for (auto& [reply_key, id] : connection->requests) {
+            scheduler_.cancel(id);
+        }
+    }
+    {
+        std::unique_lock<std::mutex> lock(outbox_mutex_);
+        idle_cv_.wait(lock, [this] { return in_flight_ == 0; });
+    }
+    drain_outbox();
+    return ok;
+}
+
+void Server::stop() {
+    stopping_ = true;
+    uint64_t one = 1;
+    if (wake_fd_ >= 0) {
+        ssize_t rc = write(wake_fd_, &one, sizeof(one));
+        (void)rc;
+    }
+}
+
+void Server::accept_connections(int listen_fd) {
+    while (true) {
+        int fd = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                std::cerr << "accept failed: " << std::strerror(errno) << std::endl;
+            }
+            return;
+        }
+
+        // Replies are small and latency-bound (one per token); fails
+        // harmlessly on Unix sockets
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        auto connection = std::make_unique<Connection>();
+        connection->fd = fd;
+        connection->events = EPOLLIN | EPOLLRDHUP;
+        uint64_t key = next_key_++;
+        epoll_event event{};
+        event.events = connection->events;
+        event.data.u64 = key;
+        if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &event) != 0) {
+            close(fd);
+            continue;
+        }
+        connections_[key] = std::move(connection);
+    }
+}
+
+void Server::read_connection(Connection& connection) {
+    char buffer[kReadChunk];
+    while (true) {
+        ssize_t n = recv(connection.fd, buffer, sizeof(buffer), 0);
+        if (n > 0) {
+            connection.input.append(buffer, static_cast<size_t>(n));
+            if (connection.input.size() > kMaxLineBytes) return;
+        } else if (n == 0) {
+            connection.read_closed = true;
+            return;
+        } else {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) connection.broken = true;
+            return;
+        }
+    }
+}
+
+void Server::handle_line(uint64_t key, Connection& connection, const std::string& line) {
+    json message = json::parse(line, nullptr, false);
+    if (message.is_discarded() || !message.is_object()) {
+        connection.output += error_line(nullptr, "invalid JSON");
+        return;
+    }
+
+    if (message.contains("metrics")) {
+        connection.output += to_line({{"metrics", json::parse(Metrics::global().to_json())}});
+        return;
+    }
+
+    if (message.contains("cancel")) {
+        const json& id = message["cancel"];
+        auto it = connection.requests.find(id.dump());
+        if (it == connection.requests.end()) {
+            connection.output += error_line(id, "no unfinished request with this id");
+        } else {
+            scheduler_.cancel(it->second);
+        }
+        return;
+    }
+
+    json id = message.value("id", json());
+    std::string reply_key = id.dump();
+    if (connection.requests.count(reply_key)) {
+        connection.output += error_line(id, "a request with this id is already running");
+        return;
+    }
+    if (connection.requests.size() >= kMaxRequestsPerConnection) {
+        connection.output += error_line(id, "too many unfinished requests on this connection");
+        return;
+    }
+
+    GenerationRequest request;
+    request.config = defaults_;
+    bool stream;
+    try {
+        parse_request(message, request);
+        stream = message.value("stream", true);
+        bool want_json = message.value("json", false);
+        std::string regex = message.value("regex", std::string());
+        if (want_json || !regex.empty()) {
+            request.config.constraint = constraint_for(want_json, regex);
+        }
+    } catch (const json::exception& e) {
+        connection.output += error_line(id, std::string("invalid request: ") + e.what());
+        return;
+    } catch (const std::invalid_argument& e) {
+        connection.output += error_line(id, e.what());
+        return;
+    }
+
+    if (stream) {
+        request.on_token = [this, key, reply_key, id](std::string_view text) {
+            post({key, reply_key, to_line({{"id", id}, {"token", std::string(text)}}), false});
+        };
+    }
+    request.on_complete = [this, key, reply_key, id](const GenerationResult& result) {
+        json reply = {
+            {"id", id},
+            {"done", true},
+            {"status", status_name(result.status)},
+            {"text", result.text},
+            {"tokens", result.tokens.size()},
+        };
+        post({key, reply_key, to_line(reply), true});
+    };
+
+    {
+        std::lock_guard<std::mutex> lock(outbox_mutex_);
+        in_flight_++;
+    }
+    // Replies are only delivered by this thread, after this returns, so the
+    // request is registered before its done reply can retire it
+    connection.requests[reply_key] = scheduler_.submit(std::move(request)).id;
+}
+
+void Server::post(Outgoing message) {
+    bool wake;
+    {
+        std::lock_guard<std::mutex> lock(outbox_mutex_);
+        wake = outbox_.empty();
+        if (message.done) in_flight_--;
+        outbox_.push_back(std::move(message));
+    }
+    idle_cv_.notify_all();
+    if (wake) {
+        uint64_t one = 1;
+        ssize_t rc = write(wake_fd_, &one, sizeof(one));
+        (void)rc;
+    }
+}
+
+std::shared_ptr<const TokenConstraint> Server::constraint_for(bool want_json, const std::string& regex) {
+    if (!token_trie_) {
+        throw std::invalid_argument("constrained generation is not enabled on this server");
+    }
+    if (want_json && !regex.empty()) {
+        throw std::invalid_argument("\"json\" and \"regex\" cannot be combined");
+    }
+    if (want_json) {
+        if (!json_constraint_) json_constraint_ = TokenConstraint::json(token_trie_);
+        return json_constraint_;
+    }
+
+    auto it = regex_constraints_.find(regex);
+    if (it != regex_constraints_.end()) return it->second;
+    if (regex_constraints_.size() >= kMaxRegexConstraints) {
+        regex_constraints_.clear();
+    }
+    std::shared_ptr<const TokenConstraint> constraint = TokenConstraint::regex(token_trie_, regex);
+    regex_constraints_.emplace(regex, constraint);
+    return constraint;
+}
+
+void Server::drain_outbox() {
+    std::vector<Outgoing> messages;
+    {
+        std::lock_guard<std::mutex> lock(outbox_mutex_);
+        messages.swap(outbox_);
+    }
+
+    // Replies for connections that have since closed are dropped
+    std::vector<uint64_t> touched;
+    for (auto& message : messages) {
+        auto it = connections_.find(message.connection);
+        if (it == connections_.end()) continue;
+        Connection& connection = *it->second;
+        if (message.done) connection.requests.erase(message.key);
+        if (connection.broken) continue;
+        connection.output += message.line;
+        if (connection.output.size() > kMaxOutputBytes) {
+            std::cerr << "Closing a connection that is not reading its replies" << std::endl;
+            connection.broken = true;
+        }
+        if (touched.empty() || touched.back() != message.connection) {
+            touched.push_back(message.connection);
+        }
+    }
+    for (uint64_t key : touched) {
+        service(key);
+    }
+}
+
+void Server::service(uint64_t key) {
+    auto it = connections_.find(key);
+    if (it == connections_.end()) return;
+    Connection& connection = *it->second;
+
+    if (!connection.broken && !connection.output.empty()) {
+        flush(connection);
+    }
+    if (connection.broken ||
+        (connection.read_closed && connection.requests.empty() && connection.output.empty())) {
+        close_connection(key);
+        return;
+    }
+
+    // No new requests are read while the client is behind on its replies
+    uint32_t events = 0;
+    if (!connection.read_closed && connection.output.size() < kMaxQueuedOutput) events |= EPOLLIN | EPOLLRDHUP;
+    if (!connection.output.empty()) events |= EPOLLOUT;
+    if (events != connection.events) {
+        epoll_event event{};
+        event.events = events;
+        event.data.u64 = key;
+        epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, connection.fd, &event);
+        connection.events = events;
+    }
+}
+
+void Server::flush(Connection& connection) {
+    size_t written = 0;
+    while (written < connection.output.size()) {
+        ssize_t n = send(connection.fd, connection.output.data() + written,
+                         connection.output.size() - written, MSG_NOSIGNAL);
+        if (n > 0) {
+            written += static_cast<size_t>(n);
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else {
+            if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) connection.broken = true;
+            break;
+        }
+    }
+    connection.output.erase(0, written);
+}
+
+void Server::close_connection(uint64_t key) {
+    auto it = connections_.find(key);
+    if (it == connections_.end()) return;
+    for (auto& [reply_key, id] : it->second->requests) {
+        scheduler_.cancel(id);
+    }
+    epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, it->second->fd, nullptr);
+    close(it->second->fd);
+    connections_.erase(it);
+}
+
+#else
+
+Server::Server(Scheduler& scheduler, const GenerationConfig& defaults)
+    : scheduler_(scheduler), defaults_(defaults) {}
+
+Server::~Server() {}
+
+bool Server::listen_unix(const std::string&) {
+    std::cerr << "Server mode requires Linux (epoll)" << std::endl;
+    return false;
+}
+
+bool Server::listen_tcp(const std::string&, int) {
+    std::cerr << "Server mode requires Linux (epoll)" << std::endl;
+    return false;
+}
+
+bool Server::run() {
+    return false;
+}
+
+void Server::stop() {
+    stopping_ = true;
+}
+
+#endif
@@ -0,0 +1,249 @@
+#include "shared_model.h"
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+
+namespace {
+
+// Just enough of the protobuf wire format to walk ModelProto.graph.initializer
+class ProtoReader {
+public:
+    ProtoReader(const unsigned char* data, size_t size) : p_(data), end_(data + size) {}
+
+    bool at_end() const { return p_ == end_; }
+
+    // Read the next field key; false at the end or on malformed input
+    bool next(uint32_t& field, uint32_t& wire_type) {
+        uint64_t key;
+        if (at_end() || !varint(key)) return false;
+        field = static_cast<uint32_t>(key >> 3);
+        wire_type = static_cast<uint32_t>(key & 7);
+        return true;
+    }
+
+    bool varint(uint64_t& value) {
+        value = 0;
+        for (int shift = 0; shift < 64 && p_ < end_; shift += 7) {
+            unsigned char byte = *p_++;
+            value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+            if (!(byte & 0x80)) return true;
+        }
+        return false;
+    }
+
+    bool bytes(const unsigned char*& data, size_t& size) {
+        uint64_t length;
+        if (!varint(length) || length > static_cast<uint64_t>(end_ - p_)) return false;
+        data = p_;
+        size = static_cast<size_t>(length);
+        p_ += size;
+        return true;
+    }
+
+    bool skip(uint32_t wire_type) {
+        uint64_t value;
+        const unsigned char* data;
+        size_t size;
+        switch (wire_type) {
+            case 0: return varint(value);
+            case 1: return advance(8);
+            case 2: return bytes(data, size);
+            case 5: return advance(4);
+            default: return false;  // Groups are not used by ONNX
+        }
+    }
+
+private:
+    const unsigned char* p_;
+    const unsigned char* end_;
+
+    bool advance(size_t n) {
+        if (static_cast<size_t>(end_ - p_) < n) return false;
+        p_ += n;
+        return true;
+    }
+};
+
+struct TensorRecord {
+    std::string name;
+    std::vector<int64_t> dims;
+    int32_t data_type = 0;
+    const unsigned char* raw_data = nullptr;
+    size_t raw_size = 0;
+    bool external = false;
+};
+
+// Element size of an ONNX TensorProto data type, 0 if not shareable
+// (ONNXTensorElementDataType uses the same numbering)
+size_t element_size(int32_t data_type) {
+    switch (data_type) {
+        case 1: return 4;   // float
+        case 2: return 1;   // uint8
+        case 3: return 1;   // int8
+        case 4: return 2;   // uint16
+        case 5: return 2;   // int16
+        case 6: return 4;   // int32
+        case 7: return 8;   // int64
+        case 9: return 1;   // bool
+        case 10: return 2;  // float16
+        case 11: return 8;  // double
+        case 12: return 4;  // uint32
+        case 13: return 8;  // uint64
+        case 16: return 2;  // bfloat16
+        default: return 0;
+    }
+}
+
+bool parse_tensor(const unsigned char* data, size_t size, TensorRecord& tensor) {
+    ProtoReader reader(data, size);
+    uint32_t field, wire_type;
+    while (reader.next(field, wire_type)) {
+        uint64_t value;
+        const unsigned char* bytes;
+        size_t length;
+        if (field == 1 && wire_type == 0) {          // dims, unpacked
+            if (!reader.varint(value)) return false;
+            tensor.dims.push_back(static_cast<int64_t>(value));
+        } else if (field == 1 && wire_type == 2) {   // dims, packed
+            if (!reader.bytes(bytes, length)) return false;
+            ProtoReader packed(bytes, length);
+            while (!packed.at_end()) {
+                if (!packed.varint(value)) return false;
+                tensor.dims.push_back(static_cast<int64_t>(value));
+            }
+        } else if (field == 2 && wire_type == 0) {   // data_type
+            if (!reader.varint(value)) return false;
+            tensor.data_type = static_cast<int32_t>(value);
+        } else if (field == 8 && wire_type == 2) {   // name
+            if (!reader.bytes(bytes, length)) return false;
+            tensor.name.assign(reinterpret_cast<const char*>(bytes), length);
+        } else if (field == 9 && wire_type == 2) {   // raw_data
+            if (!reader.bytes(tensor.raw_data, tensor.raw_size)) return false;
+        } else if (field == 14 && wire_type == 0) {  // data_location
+            if (!reader.varint(value)) return false;
+            tensor.external = value == 1;
+        } else if (!reader.skip(wire_type)) {
+            return false;
+        }
+    }
+    return reader.at_end();
+}
+
+// Collect ModelProto.graph (7) .initializer (5) records
+bool parse_initializers(const unsigned char* data, size_t size, std::vector<TensorRecord>& tensors) {
+    ProtoReader model(data, size);
+    uint32_t field, wire_type;
+    while (model.next(field, wire_type)) {
+        if (field != 7 || wire_type != 2) {
+            if (!model.skip(wire_type)) return false;
+            continue;
+        }
+
+        const unsigned char* graph_data;
+        size_t graph_size;
+        if (!model.bytes(graph_data, graph_size)) return false;
+
+        ProtoReader graph(graph_data, graph_size);
+        while (graph.next(field, wire_type)) {
+            if (field != 5 || wire_type != 2) {
+                if (!graph.skip(wire_type)) return false;
+                continue;
+            }
+            const unsigned char* tensor_data;
+            size_t tensor_size;
+            if (!graph.bytes(tensor_data, tensor_size)) return false;
+            TensorRecord tensor;
+            if (!parse_tensor(tensor_data, tensor_size, tensor)) return false;
+            tensors.push_back(std::move(tensor));
+        }
+        if (!graph.at_end()) return false;
+    }
+    return model.at_end();
+}
+
+size_t align_up(size_t value, size_t alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+} // namespace
+
+SharedModel::SharedModel()
+    : memory_info_(Ort::MemoryInfo::CreateCpu(OrtArenaAllocator, OrtMemTypeDefault)) {}
+
+bool SharedModel::open(const std::string& path) {
+    names_.clear();
+    values_.clear();
+    arena_.clear();
+    initializer_bytes_ = 0;
+    path_ = path;
+
+    if (!file_.open(path)) {
+        std::cerr << "Failed to map model file: " << path << std::endl;
+        return false;
+    }
+
+    std::vector<TensorRecord> tensors;
+    const auto* bytes = static_cast<const unsigned char*>(file_.data());
+    if (!parse_initializers(bytes, file_.size(), tensors)) {
+        std::cerr << "Failed to parse model file: " << path << std::endl;
+        file_.close();
+        return false;
+    }
+
+    // Keep large tensors whose raw bytes match their shape and type; data
+    // stored in external files or typed fields is left to each session
+    std::vector<const TensorRecord*> shared;
+    size_t arena_size = 0;
+    for (const auto& tensor : tensors) {
+        size_t elem = element_size(tensor.data_type);
+        if (tensor.external || !tensor.raw_data || elem == 0 || tensor.raw_size < kMinSharedBytes) continue;
+
+        size_t count = 1;
+        bool valid = true;
+        for (int64_t dim : tensor.dims) {
+            if (dim < 0) valid = false;
+            count *= static_cast<size_t>(dim);
+        }
+        if (!valid || count * elem != tensor.raw_size) continue;
+
+        shared.push_back(&tensor);
+        if (reinterpret_cast<uintptr_t>(tensor.raw_data) % kAlignment != 0) {
+            arena_size += align_up(tensor.raw_size, kAlignment);
+        }
+    }
+
+    // One aligned copy of the tensors the mapping leaves misaligned
+    arena_.resize(arena_size + kAlignment);
+    size_t arena_offset = align_up(reinterpret_cast<uintptr_t>(arena_.data()), kAlignment) -
+                          reinterpret_cast<uintptr_t>(arena_.data());
+
+    for (const TensorRecord* tensor : shared) {
+        void* data = const_cast<unsigned char*>(tensor->raw_data);
+        if (reinterpret_cast<uintptr_t>(tensor->raw_data) % kAlignment != 0) {
+            data = arena_.data() + arena_offset;
+            std::copy(tensor->raw_data, tensor->raw_data + tensor->raw_size, arena_.data() + arena_offset);
+            arena_offset += align_up(tensor->raw_size, kAlignment);
+        }
+
+        values_.push_back(Ort::Value::CreateTensor(
+            memory_info_,
+            data,
+            tensor->raw_size,
+            tensor->dims.data(),
+            tensor->dims.size(),
+            static_cast<ONNXTensorElementDataType>(tensor->data_type)
+        ));
+        names_.push_back(tensor->name);
+        initializer_bytes_ += tensor->raw_size;
+    }
+
+    std::cout << "Shared model: " << values_.size() << " initializers, "
+              << initializer_bytes_ / (1024 * 1024) << " MB shared between sessions" << std::endl;
+    return true;
+}
+
+void SharedModel::add_initializers(Ort::SessionOptions& options) const {
+    for (size_t i = 0; i < values_.size(); i++) {
+        options.AddInitializer(names_[i].c_str(), values_[i]);
+    }
+}
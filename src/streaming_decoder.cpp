@@ -0,0 +1,52 @@
+#include "streaming_decoder.h"
+
+namespace {
+
+// Expected length of the UTF-8 sequence starting with lead byte c, or 0 if c
+// cannot start a sequence
+size_t sequence_length(unsigned char c) {
+    if (c < 0x80) return 1;
+    if (c < 0xC0) return 0;
+    if (c < 0xE0) return 2;
+    if (c < 0xF0) return 3;
+    if (c < 0xF8) return 4;
+    return 0;
+}
+
+} // namespace
+
+StreamingDecoder::StreamingDecoder(const Tokenizer& tokenizer)
+    : tokenizer_(tokenizer), pending_size_(0) {
+    // Large enough for any GPT-2 token plus held bytes
+    buffer_.reserve(256);
+}
+
+std::string_view StreamingDecoder::push(int token_id) {
+    std::string_view bytes = tokenizer_.token_bytes(token_id);
+
+    buffer_.assign(pending_, pending_size_);
+    buffer_.append(bytes.data(), bytes.size());
+    pending_size_ = 0;
+
+    // Hold back a trailing lead byte whose continuation bytes have not arrived
+    size_t size = buffer_.size();
+    for (size_t back = 1; back <= 3 && back <= size; back++) {
+        unsigned char c = static_cast<unsigned char>(buffer_[size - back]);
+        if ((c & 0xC0) == 0x80) continue;  // Continuation byte, keep looking
+
+        size_t needed = sequence_length(c);
+        if (needed > back) {
+            pending_size_ = back;
+            buffer_.copy(pending_, back, size - back);
+        }
+        break;
+    }
+
+    return std::string_view(buffer_.data(), size - pending_size_);
+}
+
+std::string_view StreamingDecoder::flush() {
+    buffer_.assign(pending_, pending_size_);
+    pending_size_ = 0;
+    return buffer_;
+}
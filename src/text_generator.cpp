@@ -1,188 +1,766 @@
 #include "text_generator.h"
+#include "metrics.h"
 #include <iostream>
 #include <algorithm>
-#include <numeric>
-#include <cmath>
 #include <chrono>
+#include <cmath>
+#include <limits>
+
+namespace {
+
+// Fed at masked positions (left padding, finished rows), so any id in the
+// vocabulary will do; EOS may be disabled (-1)
+constexpr int64_t kPadTokenId = 0;
+
+// A beam continued by one token, scored by the beam's log-probability so far
+// plus the token's
+struct BeamCandidate {
+    float score;
+    size_t beam;
+    int token;
+};
+
+// Append the k most likely tokens of one row of logits to out
+void top_log_probs(const LogitsView& logits, size_t k, float base, size_t beam,
+                   std::vector<float>& scratch, std::vector<BeamCandidate>& out) {
+    size_t n = logits.size;
+    scratch.resize(n);
+    float max = sampler_kernels::max_value(logits.data, n);
+    float log_total = max + std::log(sampler_kernels::exp_sum(logits.data, scratch.data(), n, max, 1.0f));
+
+    // Min-heap of the k largest logits seen so far
+    using Entry = std::pair<float, int>;
+    auto greater = [](const Entry& a, const Entry& b) { return a.first > b.first; };
+    std::vector<Entry> heap;
+    heap.reserve(k + 1);
+    for (size_t i = 0; i < n; i++) {
+        if (heap.size() == k && logits.data[i] <= heap.front().first) continue;
+        heap.push_back({logits.data[i], static_cast<int>(i)});
+        std::push_heap(heap.begin(), heap.end(), greater);
+        if (heap.size() > k) {
+            std::pop_heap(heap.begin(), heap.end(), greater);
+            heap.pop_back();
+        }
+    }
+    for (const Entry& entry : heap) {
+        out.push_back({base + entry.first - log_total, beam, entry.second});
+    }
+}
 
-TextGenerator::TextGenerator(InferenceEngine& engine, Tokenizer& tokenizer)
-    : engine_(engine), tokenizer_(tokenizer) {
+void print_text(std::string_view text) {
+    std::cout << text << std::flush;
+}
 
-    // Seed random number generator
-    auto seed = std::chrono::system_clock::now().time_since_epoch().count();
-    rng_.seed(static_cast<unsigned int>(seed));
+// Ends a streamed generation's output line
+void end_output(bool reached_eos) {
+    if (reached_eos) std::cout << "\nReached EOS token";
+    std::cout << std::endl;
 }
 
-TextGenerator::~TextGenerator() {}
+// Left-pad every row to the longest one so the last column holds each row's
+// newest token; padding is masked out. Returns the padded width
+size_t pad_left(const std::vector<std::vector<int64_t>>& rows, std::vector<int64_t>& ids,
+                std::vector<int64_t>& mask) {
+    size_t width = 0;
+    for (const auto& row : rows) width = std::max(width, row.size());
+    ids.assign(rows.size() * width, kPadTokenId);
+    mask.assign(rows.size() * width, 0);
+    for (size_t b = 0; b < rows.size(); b++) {
+        size_t pad = width - rows[b].size();
+        std::copy(rows[b].begin(), rows[b].end(), ids.begin() + b * width + pad);
+        std::fill_n(mask.begin() + b * width + pad, rows[b].size(), 1);
+    }
+    return width;
+}
 
-std::vector<float> TextGenerator::get_last_token_logits(
-    const std::vector<float>& all_logits,
-    size_t seq_len,
-    int vocab_size) {
+} // namespace
 
-    // all_logits shape: [1, seq_len, vocab_size]
-    // We want the logits for the last token: [vocab_size]
-    size_t offset = (seq_len - 1) * vocab_size;
-    std::vector<float> last_logits(vocab_size);
+TextGenerator::TextGenerator(InferenceEngine& engine, Tokenizer& tokenizer)
+    : engine_(engine),
+      tokenizer_(tokenizer),
+      sampler_(static_cast<uint64_t>(std::chrono::system_clock::now().time_since_epoch().count())) {}
 
-    for (int i = 0; i < vocab_size; i++) {
-        last_logits[i] = all_logits[offset + i];
-    }
+TextGenerator::~TextGenerator() {}
 
-    return last_logits;
+int TextGenerator::sample_next(const LogitsView& logits, const GenerationConfig& config) {
+    Span span(Metrics::global().sample);
+    return sampler_.sample(logits.data, logits.size, config.temperature, config.top_k, config.top_p);
 }
 
-std::vector<float> TextGenerator::softmax(const std::vector<float>& logits, float temperature) {
-    std::vector<float> probs(logits.size());
+int TextGenerator::sample_next(float* logits, size_t n, const GenerationConfig& config, SamplingState& state) {
+    Span span(Metrics::global().sample);
+    const float neg_inf = -std::numeric_limits<float>::infinity();
+    state.processors.apply(logits, n, state.history);
+
+    bool greedy = config.temperature <= 0.0f;
+    bool full = !greedy && !(config.top_k > 0 && static_cast<size_t>(config.top_k) < n) && config.top_p >= 1.0f;
+    float scale = greedy ? 1.0f : 1.0f / config.temperature;
+    const TokenConstraint* constraint = config.constraint.get();
+    if (!constraint) {
+        float sum = 0.0f;
+        float max = sampler_kernels::prepare_logits(logits, n, scale, nullptr, full ? &sum : nullptr);
+        int token = sampler_.sample_prepared(logits, n, max, sum, greedy, config.top_k, config.top_p);
+        state.push_back(token);
+        return token;
+    }
 
-    // Apply temperature
-    float max_logit = *std::max_element(logits.begin(), logits.end());
+    // EOS is held out of the masked pass and allowed only once the text is
+    // complete; tokens past the constraint's vocabulary never are
+    size_t eos = static_cast<size_t>(config.eos_token_id);
+    float eos_logit = neg_inf;
+    if (eos < n) {
+        if (constraint->accepting(state.constraint_state)) eos_logit = logits[eos] * scale;
+        logits[eos] = neg_inf;
+    }
+    size_t masked = std::min(n, constraint->vocab_size());
+    std::fill(logits + masked, logits + n, neg_inf);
 
-    // Compute exp and sum
     float sum = 0.0f;
-    for (size_t i = 0; i < logits.size(); i++) {
-        probs[i] = std::exp((logits[i] - max_logit) / temperature);
-        sum += probs[i];
+    float max = sampler_kernels::prepare_logits(logits, masked, scale, constraint->allowed(state.constraint_state),
+                                                full ? &sum : nullptr);
+    if (eos_logit > neg_inf) {
+        logits[eos] = eos_logit;
+        if (full) {
+            sum = eos_logit > max ? sum * std::exp(max - eos_logit) + 1.0f : sum + std::exp(eos_logit - max);
+        }
+        max = std::max(max, eos_logit);
     }
 
-    // Normalize
-    for (size_t i = 0; i < probs.size(); i++) {
-        probs[i] /= sum;
+    int token = sampler_.sample_prepared(logits, n, max, sum, greedy, config.top_k, config.top_p);
+    if (token != config.eos_token_id) {
+        // Only a row with every token masked can yield one the constraint rejects
+        int next = constraint->advance(state.constraint_state, token);
+        if (next == ByteAutomaton::kReject) return config.eos_token_id;
+        state.constraint_state = next;
     }
-
-    return probs;
+    state.push_back(token);
+    return token;
 }
 
-int TextGenerator::sample_greedy(const std::vector<float>& logits) {
-    auto max_it = std::max_element(logits.begin(), logits.end());
-    return static_cast<int>(std::distance(logits.begin(), max_it));
+SamplingState::SamplingState(const GenerationConfig& config, const std::vector<int64_t>& prompt) {
+    if (config.repetition_penalty != 1.0f) {
+        processors.add(std::make_shared<RepetitionPenalty>(config.repetition_penalty));
+    }
+    if (config.presence_penalty != 0.0f || config.frequency_penalty != 0.0f) {
+        processors.add(std::make_shared<PresenceFrequencyPenalty>(config.presence_penalty, config.frequency_penalty));
+    }
+    if (!config.logit_bias.empty()) {
+        processors.add(std::make_shared<LogitBias>(config.logit_bias));
+    }
+    if (config.min_length > 0) {
+        processors.add(std::make_shared<MinLength>(static_cast<size_t>(config.min_length), config.eos_token_id));
+    }
+    if (!config.bad_words.empty()) {
+        processors.add(std::make_shared<BadWords>(config.bad_words));
+    }
+    for (const auto& processor : config.logits_processors) {
+        if (processor) processors.add(processor);
+    }
+    if (!processors.empty()) history = TokenHistory(prompt);
+    if (config.constraint) constraint_state = config.constraint->start();
 }
 
-int TextGenerator::sample_with_temperature(const std::vector<float>& logits, float temperature) {
-    auto probs = softmax(logits, temperature);
-
-    // Sample from categorical distribution
-    std::discrete_distribution<int> dist(probs.begin(), probs.end());
-    return dist(rng_);
+TokenStreamer& TextGenerator::streamer() {
+    if (!streamer_) streamer_ = std::make_unique<TokenStreamer>(tokenizer_);
+    return *streamer_;
 }
 
-int TextGenerator::sample_top_k(const std::vector<float>& logits, int k, float temperature) {
-    // Create indices sorted by logit value (descending)
-    std::vector<int> indices(logits.size());
-    std::iota(indices.begin(), indices.end(), 0);
+void TextGenerator::set_draft_engine(InferenceEngine* draft) {
+    draft_ = nullptr;
+    if (!draft) return;
 
-    std::partial_sort(indices.begin(), indices.begin() + k, indices.end(),
-        [&logits](int a, int b) { return logits[a] > logits[b]; });
-
-    // Filter to top-k
-    std::vector<float> top_k_logits(k);
-    for (int i = 0; i < k; i++) {
-        top_k_logits[i] = logits[indices[i]];
+    if (!draft->supports_kv_cache() || !engine_.supports_kv_cache()) {
+        std::cerr << "Speculative decoding needs KV cache support in both models; disabled" << std::endl;
+        return;
     }
-
-    // Sample from top-k
-    auto probs = softmax(top_k_logits, temperature);
-    std::discrete_distribution<int> dist(probs.begin(), probs.end());
-    int selected_idx = dist(rng_);
-
-    return indices[selected_idx];
+    if (draft->get_vocab_size() != engine_.get_vocab_size()) {
+        std::cerr << "Draft model vocabulary (" << draft->get_vocab_size() << ") differs from the model's ("
+                  << engine_.get_vocab_size() << "); speculative decoding disabled" << std::endl;
+        return;
+    }
+    draft_ = draft;
 }
 
-int TextGenerator::sample_top_p(const std::vector<float>& logits, float p, float temperature) {
-    // Convert to probabilities
-    auto probs = softmax(logits, temperature);
-
-    // Create indices sorted by probability (descending)
-    std::vector<int> indices(probs.size());
-    std::iota(indices.begin(), indices.end(), 0);
-    std::sort(indices.begin(), indices.end(),
-        [&probs](int a, int b) { return probs[a] > probs[b]; });
-
-    // Find nucleus (top-p)
-    float cumsum = 0.0f;
-    size_t nucleus_size = 0;
-
-    for (size_t i = 0; i < indices.size(); i++) {
-        cumsum += probs[indices[i]];
-        nucleus_size++;
-        if (cumsum >= p) break;
-    }
+size_t TextGenerator::reuse_prefix(const std::vector<int64_t>& prompt, KVCache& cache) {
+    if (!prefix_cache_ || prompt.size() < 2) return 0;
 
-    // Sample from nucleus
-    std::vector<float> nucleus_probs(nucleus_size);
-    float nucleus_sum = 0.0f;
+    std::vector<int64_t> prefix(prompt.begin(), prompt.end() - 1);
+    size_t reused = prefix_cache_->lookup(prefix, cache);
+    std::cout << "Prefix cache: reused " << reused << "/" << prompt.size() << " prompt tokens" << std::endl;
+    return reused;
+}
 
-    for (size_t i = 0; i < nucleus_size; i++) {
-        nucleus_probs[i] = probs[indices[i]];
-        nucleus_sum += nucleus_probs[i];
+std::vector<int64_t> TextGenerator::fit_prompt(const std::vector<int64_t>& prompt, const GenerationConfig& config) {
+    if (config.max_positions <= 0 || prompt.size() <= static_cast<size_t>(config.max_positions)) {
+        return prompt;
     }
+    KVCache::Retain retain = context_retain(config, static_cast<size_t>(config.max_positions), 0);
+    std::vector<int64_t> fitted(prompt.begin(), prompt.begin() + retain.sink);
+    fitted.insert(fitted.end(), prompt.end() - retain.recent, prompt.end());
+    return fitted;
+}
 
-    // Renormalize
-    for (size_t i = 0; i < nucleus_size; i++) {
-        nucleus_probs[i] /= nucleus_sum;
-    }
+KVCache::Retain TextGenerator::context_retain(const GenerationConfig& config, size_t limit, size_t new_tokens) {
+    int64_t room = limit > new_tokens ? static_cast<int64_t>(limit - new_tokens) : 0;
+    int64_t sink = std::min<int64_t>(std::max(config.sink_tokens, 0), room);
+    int64_t recent = std::min<int64_t>(std::max(config.window_tokens, 0), room - sink);
+    return {sink, recent};
+}
 
-    std::discrete_distribution<int> dist(nucleus_probs.begin(), nucleus_probs.end());
-    int selected_idx = dist(rng_);
+void TextGenerator::fit_context(KVCache& cache, size_t new_tokens, const GenerationConfig& config) {
+    if (config.max_positions <= 0) return;
+    size_t limit = static_cast<size_t>(config.max_positions);
+    if (static_cast<size_t>(cache.length()) + new_tokens <= limit) return;
 
-    return indices[selected_idx];
+    std::vector<KVCache::Retain> retain(cache.batch_size(), context_retain(config, limit, new_tokens));
+    Metrics::global().evicted_tokens += cache.evict(retain);
 }
 
 std::string TextGenerator::generate(const std::string& prompt, const GenerationConfig& config) {
     std::cout << "Encoding prompt..." << std::endl;
 
+    Metrics& metrics = Metrics::global();
+    RequestTimer timer;
+    metrics.requests++;
+
     // Encode the prompt
-    std::vector<int> token_ids = tokenizer_.encode(prompt);
+    std::vector<int> token_ids;
+    {
+        Span span(metrics.tokenize);
+        token_ids = tokenizer_.encode(prompt);
+    }
     std::vector<int64_t> input_ids(token_ids.begin(), token_ids.end());
+    metrics.prompt_tokens += input_ids.size();
 
     std::cout << "Prompt tokens: " << input_ids.size() << std::endl;
+
+    // An empty prompt starts from beginning-of-text
+    if (input_ids.empty()) {
+        input_ids.push_back(tokenizer_.bos_token_id());
+    }
+
+    // Beam search and the draft model keep every position; a sequence that
+    // could outgrow the context is sampled with the sliding window instead
+    size_t longest = input_ids.size() + std::max(config.max_length, 0) + std::max(config.draft_tokens, 0);
+    bool fits = config.max_positions <= 0 || longest <= static_cast<size_t>(config.max_positions);
+
+    SamplingState sampling(config, input_ids);
+    if (config.constraint && (config.num_beams > 1 || (draft_ && config.draft_tokens > 0))) {
+        std::cerr << "Constrained generation samples one token per step; beam search and draft model unused"
+                  << std::endl;
+    } else if (!fits && (config.num_beams > 1 || (draft_ && config.draft_tokens > 0))) {
+        std::cerr << "Sequence may exceed " << config.max_positions
+                  << " positions; sampling with a sliding context, beam search and draft model unused" << std::endl;
+    } else if (config.num_beams > 1) {
+        if (engine_.supports_kv_cache()) {
+            return generate_beam_search(std::move(input_ids), config, timer);
+        }
+        std::cerr << "Beam search needs a model with past_key_values inputs; sampling instead" << std::endl;
+    } else if (draft_ && config.draft_tokens > 0) {
+        // Verification compares whole distributions, which processors would
+        // have to rewrite for every drafted position
+        if (sampling.processors.empty()) {
+            return generate_speculative(std::move(input_ids), config, timer);
+        }
+        std::cerr << "Logits processors are applied one token per step; draft model unused" << std::endl;
+    }
+
     std::cout << "Generating..." << std::endl;
 
-    int vocab_size = engine_.get_vocab_size();
+    // With a KV cache the prompt is prefilled once and each later step feeds
+    // only the newest token; otherwise every step recomputes the full sequence.
+    // Either way the model sees at most config.max_positions tokens: an
+    // over-long prompt is cut to its sink and window, and the cache evicts
+    // the middle of the sequence as it grows.
+    bool use_cache = engine_.supports_kv_cache();
+    std::vector<int64_t> prompt_ids = fit_prompt(input_ids, config);
+    bool cut = prompt_ids.size() < input_ids.size();
+    if (cut) {
+        std::cout << "Prompt cut to " << prompt_ids.size() << " tokens" << std::endl;
+        metrics.evicted_tokens += input_ids.size() - prompt_ids.size();
+    }
+    KVCache cache;
+    size_t reused = use_cache && !cut ? reuse_prefix(prompt_ids, cache) : 0;
+    std::vector<int64_t> step_ids(prompt_ids.begin() + reused, prompt_ids.end());
+
+    // Tokens are detokenized and printed on the streamer thread, in complete
+    // UTF-8 characters, while the next forward pass runs
+    TokenStreamer& output = streamer();
+    auto stream = output.open(print_text);
+    bool reached_eos = false;
 
     // Generation loop
     for (int i = 0; i < config.max_length; i++) {
         // Run forward pass
-        auto logits = engine_.forward(input_ids);
+        bool ok;
+        {
+            Span span(i == 0 ? metrics.prefill : metrics.decode);
+            if (use_cache) {
+                fit_context(cache, step_ids.size(), config);
+                ok = engine_.forward(step_ids, cache);
+            } else {
+                ok = engine_.forward(fit_prompt(input_ids, config));
+            }
+        }
 
-        if (logits.empty()) {
-            std::cerr << "Error: empty logits returned" << std::endl;
+        if (!ok) {
+            std::cerr << "Error: forward pass failed" << std::endl;
             break;
         }
 
-        // Get logits for last token
-        auto last_logits = get_last_token_logits(logits, input_ids.size(), vocab_size);
-
-        // Sample next token
-        int next_token;
-        if (config.temperature == 0.0f) {
-            next_token = sample_greedy(last_logits);
-        } else if (config.top_k > 0 && config.top_k < vocab_size) {
-            next_token = sample_top_k(last_logits, config.top_k, config.temperature);
-        } else if (config.top_p < 1.0f) {
-            next_token = sample_top_p(last_logits, config.top_p, config.temperature);
-        } else {
-            next_token = sample_with_temperature(last_logits, config.temperature);
+        // The cache now holds exactly the prompt
+        if (i == 0 && use_cache && prefix_cache_ && !cut) {
+            prefix_cache_->insert(input_ids, cache);
         }
 
+        // Sample next token from the logits at the last position
+        int next_token = sample_next(engine_.mutable_last_logits(0), engine_.get_vocab_size(), config, sampling);
+
         // Check for EOS token
         if (next_token == config.eos_token_id) {
-            std::cout << "\nReached EOS token" << std::endl;
+            reached_eos = true;
             break;
         }
 
         // Append to sequence
+        timer.token();
         input_ids.push_back(next_token);
-
-        // Print token (optional, for debugging)
-        std::vector<int> single_token = {next_token};
-        std::string token_text = tokenizer_.decode(single_token);
-        std::cout << token_text << std::flush;
+        step_ids.assign(1, next_token);
+        output.push(stream, next_token);
     }
 
-    std::cout << std::endl;
+    output.close(std::move(stream), [reached_eos] { end_output(reached_eos); });
+    output.drain();
 
     // Decode all tokens
     std::vector<int> all_tokens(input_ids.begin(), input_ids.end());
     return tokenizer_.decode(all_tokens);
 }
+
+std::string TextGenerator::generate_speculative(std::vector<int64_t> input_ids, const GenerationConfig& config,
+                                                RequestTimer& timer) {
+    std::cout << "Generating (" << config.draft_tokens << " draft tokens per step)..." << std::endl;
+
+    auto start = std::chrono::steady_clock::now();
+    speculative_stats_ = SpeculativeStats();
+
+    size_t vocab_size = static_cast<size_t>(engine_.get_vocab_size());
+    size_t max_draft = static_cast<size_t>(config.draft_tokens);
+    draft_probs_.resize(max_draft * vocab_size);
+    target_probs_.resize(vocab_size);
+
+    // An empty prompt starts from beginning-of-text
+    if (input_ids.empty()) {
+        input_ids.push_back(tokenizer_.bos_token_id());
+    }
+    size_t prompt_len = input_ids.size();
+
+    // Each cache holds the sequence except its pending tokens, which are fed
+    // at the start of the next round; the first round prefills the prompt
+    KVCache target_cache;
+    KVCache draft_cache;
+    size_t reused = reuse_prefix(input_ids, target_cache);
+    std::vector<int64_t> target_pending(input_ids.begin() + reused, input_ids.end());
+    std::vector<int64_t> draft_pending = input_ids;
+
+    std::vector<int64_t> step_ids;
+    std::vector<int> drafts(max_draft);
+    TokenStreamer& output = streamer();
+    auto stream = output.open(print_text);
+    int generated = 0;
+    bool done = false;
+    bool reached_eos = false;
+
+    while (!done && generated < config.max_length) {
+        // Draft up to k tokens autoregressively, keeping the distribution
+        // each was drawn from; a drafted EOS ends the proposal
+        size_t k = std::min(max_draft, static_cast<size_t>(config.max_length - generated));
+        int64_t draft_base = draft_cache.length();
+        size_t draft_fed = draft_pending.size();
+        size_t proposed = 0;
+        bool ok = true;
+
+        step_ids = draft_pending;
+        while (proposed < k) {
+            if (!draft_->forward(step_ids, draft_cache)) {
+                ok = false;
+                break;
+            }
+            LogitsView logits = draft_->last_logits(0);
+            float* q = draft_probs_.data() + proposed * vocab_size;
+            sampler_.distribution(logits.data, logits.size, config.temperature, config.top_k, config.top_p, q);
+
+            int token = sampler_.sample_weights(q, vocab_size);
+            drafts[proposed++] = token;
+            if (token == config.eos_token_id) break;
+            step_ids.assign(1, token);
+        }
+
+        // Score the pending token and every draft in one target pass
+        int64_t target_base = target_cache.length();
+        step_ids = target_pending;
+        step_ids.insert(step_ids.end(), drafts.begin(), drafts.begin() + proposed);
+        if (ok) {
+            Span span(speculative_stats_.rounds == 0 ? Metrics::global().prefill : Metrics::global().decode);
+            ok = engine_.forward(step_ids, target_cache);
+        }
+        if (!ok) {
+            std::cerr << "Error: forward pass failed" << std::endl;
+            break;
+        }
+        if (speculative_stats_.rounds == 0 && prefix_cache_) {
+            prefix_cache_->insert(input_ids, target_cache);  // Uses the prompt positions only
+        }
+
+        // Accept draft i with probability min(1, p(x) / q(x)); on the first
+        // rejection resample from max(0, p - q) instead. Either way the token
+        // is distributed exactly as if the target model had sampled it.
+        size_t offset = target_pending.size() - 1;
+        size_t accepted = 0;
+        int next_token = -1;
+        for (; accepted < proposed; accepted++) {
+            LogitsView logits = engine_.logits(0, offset + accepted);
+            float* p = target_probs_.data();
+            sampler_.distribution(logits.data, logits.size, config.temperature, config.top_k, config.top_p, p);
+
+            int token = drafts[accepted];
+            const float* q = draft_probs_.data() + accepted * vocab_size;
+            if (sampler_.uniform() * q[token] < p[token]) continue;
+
+            for (size_t i = 0; i < vocab_size; i++) {
+                p[i] = std::max(0.0f, p[i] - q[i]);
+            }
+            next_token = sampler_.sample_weights(p, vocab_size);
+            if (next_token < 0) next_token = token;  // p == q up to rounding
+            break;
+        }
+
+        // Every draft accepted: the target's last position yields one more
+        // token for free, unless the drafts already ended at EOS
+        if (accepted == proposed && drafts[proposed - 1] != config.eos_token_id) {
+            LogitsView logits = engine_.last_logits(0);
+            sampler_.distribution(logits.data, logits.size, config.temperature, config.top_k, config.top_p,
+                                  target_probs_.data());
+            next_token = sampler_.sample_weights(target_probs_.data(), vocab_size);
+        }
+
+        speculative_stats_.rounds++;
+        speculative_stats_.proposed += proposed;
+        speculative_stats_.accepted += accepted;
+
+        // Emit the accepted drafts and the target's own token
+        std::vector<int> emitted(drafts.begin(), drafts.begin() + accepted);
+        if (next_token >= 0) emitted.push_back(next_token);
+        for (int token : emitted) {
+            if (token == config.eos_token_id) {
+                done = reached_eos = true;
+                break;
+            }
+            timer.token();
+            input_ids.push_back(token);
+            output.push(stream, token);
+            if (++generated >= config.max_length) break;
+        }
+        if (done || generated >= config.max_length) break;
+
+        // Roll both caches back to the accepted prefix. The draft model never
+        // fed its last proposal, so if that was accepted it is pending too.
+        target_cache.truncate(target_base + static_cast<int64_t>(target_pending.size() + accepted));
+        target_pending.assign(1, next_token);
+
+        draft_cache.truncate(draft_base + static_cast<int64_t>(draft_fed + std::min(accepted, proposed - 1)));
+        draft_pending.clear();
+        if (accepted == proposed) draft_pending.push_back(drafts[proposed - 1]);
+        draft_pending.push_back(next_token);
+    }
+
+    output.close(std::move(stream), [reached_eos] { end_output(reached_eos); });
+    output.drain();
+
+    auto end = std::chrono::steady_clock::now();
+    speculative_stats_.generated = input_ids.size() - prompt_len;
+    speculative_stats_.seconds = std::chrono::duration<double>(end - start).count();
+
+    const auto& stats = speculative_stats_;
+    std::cout << "Speculative decoding: " << stats.accepted << "/" << stats.proposed
+              << " draft tokens accepted (" << static_cast<int>(stats.acceptance_rate() * 100.0 + 0.5) << "%), "
+              << stats.rounds << " target passes, " << stats.tokens_per_second() << " tokens/s" << std::endl;
+
+    std::vector<int> all_tokens(input_ids.begin(), input_ids.end());
+    return tokenizer_.decode(all_tokens);
+}
+
+std::string TextGenerator::generate_beam_search(std::vector<int64_t> input_ids, const GenerationConfig& config,
+                                                RequestTimer& timer) {
+    size_t num_beams = static_cast<size_t>(config.num_beams);
+    std::cout << "Generating (beam search, " << num_beams << " beams)..." << std::endl;
+
+    Metrics& metrics = Metrics::global();
+
+    // An empty prompt starts from beginning-of-text
+    if (input_ids.empty()) {
+        input_ids.push_back(tokenizer_.bos_token_id());
+    }
+
+    // Prefill the prompt once; every beam starts from this single row
+    KVCache cache;
+    size_t reused = reuse_prefix(input_ids, cache);
+    std::vector<int64_t> step_ids(input_ids.begin() + reused, input_ids.end());
+    bool ok;
+    {
+        Span span(metrics.prefill);
+        ok = engine_.forward(step_ids, cache);
+    }
+    if (!ok) {
+        std::cerr << "Error: forward pass failed" << std::endl;
+        return tokenizer_.decode(std::vector<int>(input_ids.begin(), input_ids.end()));
+    }
+    if (prefix_cache_) {
+        prefix_cache_->insert(input_ids, cache);
+    }
+
+    // Running beams score the sum of their token log-probabilities; finished
+    // ones that sum divided by length^length_penalty
+    struct Hypothesis {
+        std::vector<int> tokens;
+        float score;
+    };
+    auto normalized = [&config](float score, size_t length) {
+        return score / std::pow(static_cast<float>(std::max<size_t>(length, 1)), config.length_penalty);
+    };
+    std::vector<Hypothesis> finished;  // Best num_beams, best first
+    auto add_finished = [&](const std::vector<int>& tokens, float score) {
+        finished.push_back({tokens, normalized(score, tokens.size())});
+        std::sort(finished.begin(), finished.end(),
+                  [](const Hypothesis& a, const Hypothesis& b) { return a.score > b.score; });
+        if (finished.size() > num_beams) finished.pop_back();
+    };
+
+    // Each running beam keeps its own history for the logits processors
+    SamplingState sampling(config, input_ids);
+    std::vector<TokenHistory> histories = {sampling.history};
+
+    BeamCache beam_cache;
+    std::vector<BeamCache::Beam> beams = {beam_cache.start(cache)};
+    std::vector<Hypothesis> running = {{{}, 0.0f}};
+    std::vector<BeamCandidate> candidates;
+    std::vector<size_t> parents;
+    size_t peak_bytes = 0;
+    size_t peak_dense_bytes = 0;
+    bool done = false;
+
+    for (int step = 0; step < config.max_length; step++) {
+        // The 2 * num_beams best tokens of every beam leave num_beams
+        // candidates even if each beam's list contains EOS
+        candidates.clear();
+        {
+            Span span(metrics.sample);
+            size_t vocab_size = static_cast<size_t>(engine_.get_vocab_size());
+            for (size_t b = 0; b < running.size(); b++) {
+                float* logits = engine_.mutable_last_logits(b);
+                sampling.processors.apply(logits, vocab_size, histories[b]);
+                top_log_probs({logits, vocab_size}, 2 * num_beams, running[b].score, b, beam_scratch_, candidates);
+            }
+            std::sort(candidates.begin(), candidates.end(),
+                      [](const BeamCandidate& a, const BeamCandidate& b) { return a.score > b.score; });
+        }
+
+        std::vector<Hypothesis> next;
+        parents.clear();
+        for (size_t c = 0; c < candidates.size() && next.size() < num_beams; c++) {
+            const BeamCandidate& candidate = candidates[c];
+            if (candidate.token == config.eos_token_id) {
+                // Only an EOS among the best num_beams candidates finishes a beam
+                if (c < num_beams) add_finished(running[candidate.beam].tokens, candidate.score);
+                continue;
+            }
+            std::vector<int> tokens = running[candidate.beam].tokens;
+            tokens.push_back(candidate.token);
+            next.push_back({std::move(tokens), candidate.score});
+            parents.push_back(candidate.beam);
+        }
+        running = std::move(next);
+        if (!sampling.processors.empty()) {
+            std::vector<TokenHistory> next_histories;
+            next_histories.reserve(running.size());
+            for (size_t b = 0; b < running.size(); b++) {
+                next_histories.push_back(histories[parents[b]]);
+                next_histories.back().push_back(running[b].tokens.back());
+            }
+            histories = std::move(next_histories);
+        }
+        timer.token();
+
+        // Done once num_beams beams have finished and, unless stopping early,
+        // the best running beam can no longer beat the worst of them
+        done = finished.size() >= num_beams &&
+               (config.early_stopping ||
+                normalized(running[0].score, running[0].tokens.size()) <= finished.back().score);
+        if (done || step + 1 == config.max_length) break;
+
+        // Release beams nobody continues first, so a beam continued by a
+        // single child is extended in place and shared segments are not
+        std::vector<size_t> children(beams.size(), 0);
+        for (size_t parent : parents) children[parent]++;
+        std::vector<BeamCache::Beam> extended(beams.size());
+        for (size_t b = 0; b < beams.size(); b++) {
+            if (children[b] == 0) beams[b].reset();
+        }
+        for (size_t b = 0; b < beams.size(); b++) {
+            if (children[b] == 0) continue;
+            // The prompt's positions are all in the first beam already; later
+            // steps add the token each beam was just fed
+            extended[b] = step == 0 ? std::move(beams[b]) : beam_cache.extend(std::move(beams[b]), cache, b);
+        }
+        beams.clear();
+        for (size_t parent : parents) {
+            beams.push_back(extended[parent]);
+        }
+        extended.clear();
+
+        size_t dense_bytes = beams.size() * BeamCache::length(beams[0]) * beam_cache.position_bytes();
+        peak_bytes = std::max(peak_bytes, beam_cache.bytes(beams));
+        peak_dense_bytes = std::max(peak_dense_bytes, dense_bytes);
+
+        // Feed every beam's newest token in one batch
+        cache = beam_cache.gather(beams);
+        step_ids.clear();
+        for (const Hypothesis& hypothesis : running) {
+            step_ids.push_back(hypothesis.tokens.back());
+        }
+        std::vector<int64_t> attention_mask(running.size(), 1);
+        {
+            Span span(metrics.decode);
+            ok = engine_.forward(step_ids, attention_mask, running.size(), cache);
+        }
+        if (!ok) {
+            std::cerr << "Error: forward pass failed" << std::endl;
+            break;
+        }
+    }
+
+    // Out of steps: beams still running compete with the finished ones
+    if (!done) {
+        for (const Hypothesis& hypothesis : running) {
+            add_finished(hypothesis.tokens, hypothesis.score);
+        }
+    }
+
+    const Hypothesis& best = finished.front();
+    std::cout << tokenizer_.decode(best.tokens) << std::endl;
+    std::cout << "Beam search: score " << best.score << ", " << best.tokens.size() << " tokens; beam KV peaked at "
+              << peak_bytes / (1024 * 1024) << " MB shared vs " << peak_dense_bytes / (1024 * 1024)
+              << " MB as separate copies" << std::endl;
+
+    std::vector<int> all_tokens(input_ids.begin(), input_ids.end());
+    all_tokens.insert(all_tokens.end(), best.tokens.begin(), best.tokens.end());
+    return tokenizer_.decode(all_tokens);
+}
+
+std::vector<std::string> TextGenerator::generate_batch(const std::vector<std::string>& prompts,
+                                                       const GenerationConfig& config) {
+    size_t batch_size = prompts.size();
+    if (batch_size == 0) return {};
+
+    std::cout << "Encoding " << batch_size << " prompts..." << std::endl;
+
+    Metrics& metrics = Metrics::global();
+    std::vector<RequestTimer> timers(batch_size);
+    metrics.requests += batch_size;
+
+    // Encode every prompt; an empty prompt starts from beginning-of-text
+    std::vector<std::vector<int64_t>> sequences(batch_size);
+    std::vector<std::vector<int64_t>> fed(batch_size);  // The part of each row the model sees
+    for (size_t b = 0; b < batch_size; b++) {
+        std::vector<int> token_ids;
+        {
+            Span span(metrics.tokenize);
+            token_ids = tokenizer_.encode(prompts[b]);
+        }
+        metrics.prompt_tokens += token_ids.size();
+        sequences[b].assign(token_ids.begin(), token_ids.end());
+        if (sequences[b].empty()) {
+            sequences[b].push_back(tokenizer_.bos_token_id());
+        }
+        fed[b] = fit_prompt(sequences[b], config);
+        metrics.evicted_tokens += sequences[b].size() - fed[b].size();
+    }
+
+    std::vector<int64_t> step_ids;
+    std::vector<int64_t> step_mask;
+    size_t prompt_len = pad_left(fed, step_ids, step_mask);
+
+    std::cout << "Padded prompt length: " << prompt_len << std::endl;
+    std::cout << "Generating..." << std::endl;
+
+    // With a cache the prompts are prefilled once and each later step feeds
+    // one token per row; otherwise every step re-feeds each row cut to its
+    // sink and window, as generate() does
+    bool use_cache = engine_.supports_kv_cache();
+    KVCache cache;
+
+    std::vector<bool> finished(batch_size, false);
+    size_t num_finished = 0;
+    std::vector<SamplingState> sampling;
+    sampling.reserve(batch_size);
+    for (size_t b = 0; b < batch_size; b++) {
+        sampling.emplace_back(config, sequences[b]);
+    }
+
+    for (int i = 0; i < config.max_length && num_finished < batch_size; i++) {
+        bool ok;
+        {
+            Span span(i == 0 ? metrics.prefill : metrics.decode);
+            if (use_cache) {
+                fit_context(cache, step_ids.size() / batch_size, config);
+                ok = engine_.forward(step_ids, step_mask, batch_size, cache);
+            } else {
+                if (i > 0) {
+                    for (size_t b = 0; b < batch_size; b++) {
+                        fed[b] = fit_prompt(sequences[b], config);
+                    }
+                    pad_left(fed, step_ids, step_mask);
+                }
+                KVCache scratch;
+                ok = engine_.forward(step_ids, step_mask, batch_size, scratch);
+            }
+        }
+
+        if (!ok) {
+            std::cerr << "Error: forward pass failed" << std::endl;
+            break;
+        }
+
+        // Sample one token per live row; finished rows are fed masked padding
+        step_ids.assign(batch_size, kPadTokenId);
+        step_mask.assign(batch_size, 0);
+        for (size_t b = 0; b < batch_size; b++) {
+            if (finished[b]) continue;
+
+            int next_token =
+                sample_next(engine_.mutable_last_logits(b), engine_.get_vocab_size(), config, sampling[b]);
+
+            if (next_token == config.eos_token_id) {
+                finished[b] = true;
+                num_finished++;
+                continue;
+            }
+
+            timers[b].token();
+            sequences[b].push_back(next_token);
+            step_ids[b] = next_token;
+            step_mask[b] = 1;
+        }
+    }
+
+    std::cout << "Finished " << num_finished << "/" << batch_size << " sequences at EOS" << std::endl;
+
+    // Decode all tokens of each row
+    std::vector<std::string> outputs;
+    outputs.reserve(batch_size);
+    for (const auto& sequence : sequences) {
+        std::vector<int> all_tokens(sequence.begin(), sequence.end());
+        outputs.push_back(tokenizer_.decode(all_tokens));
+    }
+    return outputs;
+}
@@ -0,0 +1,95 @@
+#include "thread_pool.h"
+#include <algorithm>
+
+ThreadPool::ThreadPool(size_t num_threads) {
+    if (num_threads == 0) {
+        num_threads = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+    }
+    for (size_t i = 1; i < num_threads; i++) {
+        workers_.emplace_back(&ThreadPool::worker_loop, this);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    work_cv_.notify_all();
+    for (auto& worker : workers_) {
+        worker.join();
+    }
+}
+
+ThreadPool& ThreadPool::shared() {
+    static ThreadPool pool;
+    return pool;
+}
+
+void ThreadPool::parallel_for(size_t n, size_t grain, const std::function<void(size_t, size_t)>& fn) {
+    if (n == 0) return;
+    grain = std::max<size_t>(grain, 1);
+
+    // Not worth waking anyone
+    if (workers_.empty() || n <= grain) {
+        for (size_t begin = 0; begin < n; begin += grain) {
+            fn(begin, std::min(begin + grain, n));
+        }
+        return;
+    }
+
+    std::lock_guard<std::mutex> job_lock(job_mutex_);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        fn_ = &fn;
+        n_ = n;
+        grain_ = grain;
+        next_ = 0;
+        error_ = nullptr;
+        busy_ = workers_.size();
+        generation_++;
+    }
+    work_cv_.notify_all();
+
+    work();
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_cv_.wait(lock, [this] { return busy_ == 0; });
+    fn_ = nullptr;
+    if (error_) {
+        std::exception_ptr error = error_;
+        error_ = nullptr;
+        std::rethrow_exception(error);
+    }
+}
+
+void ThreadPool::worker_loop() {
+    uint64_t seen = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            work_cv_.wait(lock, [&] { return stopping_ || generation_ != seen; });
+            if (stopping_) return;
+            seen = generation_;
+        }
+
+        work();
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (--busy_ == 0) done_cv_.notify_one();
+    }
+}
+
+void ThreadPool::work() {
+    try {
+        while (true) {
+            size_t begin = next_.fetch_add(grain_, std::memory_order_relaxed);
+            if (begin >= n_) break;
+            (*fn_)(begin, std::min(begin + grain_, n_));
+        }
+    } catch (...) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!error_) error_ = std::current_exception();
+        next_ = n_;  // Hand out no more ranges
+    }
+}
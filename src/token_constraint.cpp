@@ -0,0 +1,135 @@
+#include "token_constraint.h"
+#include <algorithm>
+#include <cstring>
+#include <string_view>
+#include <utility>
+
+TokenTrie::TokenTrie(const Tokenizer& tokenizer) : vocab_size_(tokenizer.vocab_size()) {
+    offsets_.reserve(vocab_size_ + 1);
+    offsets_.push_back(0);
+    for (size_t i = 0; i < vocab_size_; i++) {
+        bytes_ += tokenizer.token_bytes(static_cast<int>(i));
+        offsets_.push_back(static_cast<uint32_t>(bytes_.size()));
+    }
+    auto token = [this](int i) {
+        return std::string_view(bytes_).substr(offsets_[i], offsets_[i + 1] - offsets_[i]);
+    };
+
+    // Tokens in byte order; a node's subtree is then a contiguous range
+    std::vector<int> order;
+    order.reserve(vocab_size_);
+    for (size_t i = 0; i < vocab_size_; i++) {
+        if (!token(static_cast<int>(i)).empty()) order.push_back(static_cast<int>(i));
+    }
+    std::stable_sort(order.begin(), order.end(), [&](int a, int b) { return token(a) < token(b); });
+
+    // Breadth first, so the children of each node are adjacent
+    struct Pending {
+        uint32_t node;
+        size_t begin, end;  // Range of order below the node
+        size_t depth;
+    };
+    std::vector<Pending> queue = {{0, 0, order.size(), 0}};
+    nodes_.push_back({0, 0, -1, 0});
+    for (size_t q = 0; q < queue.size(); q++) {
+        Pending p = queue[q];
+
+        // The token equal to the node's path sorts first
+        size_t i = p.begin;
+        if (i < p.end && token(order[i]).size() == p.depth) {
+            nodes_[p.node].token = order[i];
+            while (i < p.end && token(order[i]).size() == p.depth) i++;  // Duplicates never match first
+        }
+
+        nodes_[p.node].first_child = static_cast<uint32_t>(nodes_.size());
+        while (i < p.end) {
+            uint8_t byte = static_cast<uint8_t>(token(order[i])[p.depth]);
+            size_t j = i;
+            while (j < p.end && static_cast<uint8_t>(token(order[j])[p.depth]) == byte) j++;
+            uint32_t child = static_cast<uint32_t>(nodes_.size());
+            nodes_.push_back({0, 0, -1, byte});
+            nodes_[p.node].num_children++;
+            queue.push_back({child, i, j, p.depth + 1});
+            i = j;
+        }
+    }
+}
+
+TokenConstraint::TokenConstraint(std::shared_ptr<const TokenTrie> trie, std::unique_ptr<ByteAutomaton> automaton)
+    : trie_(std::move(trie)),
+      start_(automaton->start()),
+      words_((trie_->vocab_size() + 63) / 64),
+      automaton_(std::move(automaton)) {}
+
+std::shared_ptr<TokenConstraint> TokenConstraint::json(std::shared_ptr<const TokenTrie> trie, bool object_only) {
+    return std::make_shared<TokenConstraint>(std::move(trie), std::make_unique<JsonAutomaton>(32, object_only));
+}
+
+std::shared_ptr<TokenConstraint> TokenConstraint::regex(std::shared_ptr<const TokenTrie> trie,
+                                                         const std::string& pattern) {
+    return std::make_shared<TokenConstraint>(std::move(trie), std::make_unique<RegexAutomaton>(pattern));
+}
+
+const uint64_t* TokenConstraint::allowed(int state) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    size_t index = static_cast<size_t>(state);
+    if (index >= masks_.size()) masks_.resize(automaton_->num_states());
+    if (!masks_[index]) {
+        masks_[index] = compute_mask(state);
+        num_masks_++;
+    }
+    return masks_[index].get();
+}
+
+bool TokenConstraint::accepting(int state) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return automaton_->accepting(state);
+}
+
+int TokenConstraint::advance(int state, int token) const {
+    if (state < 0 || token < 0 || static_cast<size_t>(token) >= trie_->vocab_size()) {
+        return ByteAutomaton::kReject;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    size_t index = static_cast<size_t>(state);
+    if (index < masks_.size() && masks_[index] && !((masks_[index][token >> 6] >> (token & 63)) & 1)) {
+        return ByteAutomaton::kReject;
+    }
+
+    uint32_t begin = trie_->offsets_[token];
+    uint32_t end = trie_->offsets_[token + 1];
+    if (begin == end) return ByteAutomaton::kReject;
+    for (uint32_t i = begin; i < end && state >= 0; i++) {
+        state = automaton_->step(state, static_cast<uint8_t>(trie_->bytes_[i]));
+    }
+    return state;
+}
+
+size_t TokenConstraint::num_masks() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return num_masks_;
+}
+
+std::unique_ptr<uint64_t[]> TokenConstraint::compute_mask(int state) const {
+    auto mask = std::make_unique<uint64_t[]>(words_);
+    std::memset(mask.get(), 0, words_ * sizeof(uint64_t));
+
+    // Depth first; a byte the automaton rejects prunes every token below it
+    const std::vector<TokenTrie::Node>& nodes = trie_->nodes_;
+    std::vector<std::pair<uint32_t, int>> stack = {{0, state}};
+    while (!stack.empty()) {
+        auto [node, from] = stack.back();
+        stack.pop_back();
+        const TokenTrie::Node& parent = nodes[node];
+        for (uint32_t c = parent.first_child; c < parent.first_child + parent.num_children; c++) {
+            int to = automaton_->step(from, nodes[c].byte);
+            if (to < 0) continue;
+            if (nodes[c].token >= 0) {
+                mask[nodes[c].token >> 6] |= 1ull << (nodes[c].token & 63);
+            }
+            if (nodes[c].num_children > 0) stack.push_back({c, to});
+        }
+    }
+    return mask;
+}
@@ -0,0 +1,100 @@
+#include "token_streamer.h"
+#include "metrics.h"
+#include <exception>
+#include <future>
+#include <iostream>
+
+TokenStreamer::TokenStreamer(const Tokenizer& tokenizer, size_t capacity)
+    : tokenizer_(tokenizer), queue_(capacity) {
+    thread_ = std::thread(&TokenStreamer::run, this);
+}
+
+TokenStreamer::~TokenStreamer() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    cv_.notify_one();
+    thread_.join();
+}
+
+std::shared_ptr<TokenStreamer::Stream> TokenStreamer::open(TextCallback on_text) {
+    return std::make_shared<Stream>(tokenizer_, std::move(on_text));
+}
+
+void TokenStreamer::push(const std::shared_ptr<Stream>& stream, int token) {
+    enqueue({stream, token, nullptr});
+}
+
+void TokenStreamer::close(std::shared_ptr<Stream> stream, std::function<void()> fn) {
+    enqueue({std::move(stream), kFlush, std::move(fn)});
+}
+
+void TokenStreamer::drain() {
+    std::promise<void> delivered;
+    std::future<void> done = delivered.get_future();
+    close(nullptr, [&delivered] { delivered.set_value(); });
+    done.wait();
+}
+
+void TokenStreamer::enqueue(Event event) {
+    while (!queue_.try_push(std::move(event))) {
+        std::this_thread::yield();
+    }
+
+    // Pairs with the fence in run(): either the consumer sees this event
+    // before sleeping, or this thread sees it asleep and wakes it
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (sleeping_.load(std::memory_order_relaxed)) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        cv_.notify_one();
+    }
+}
+
+void TokenStreamer::run() {
+    Event event;
+    while (true) {
+        if (queue_.try_pop(event)) {
+            deliver(event);
+            event = Event();
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        sleeping_.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        cv_.wait(lock, [this] { return stopping_ || !queue_.empty(); });
+        sleeping_.store(false, std::memory_order_relaxed);
+        if (stopping_ && queue_.empty()) break;
+    }
+}
+
+void TokenStreamer::deliver(Event& event) {
+    // A throwing callback would end the process on this thread; report it and
+    // keep delivering to the other streams. fn runs even if the text callback
+    // threw, since it may be what completes the request.
+    if (event.stream) {
+        try {
+            Stream& stream = *event.stream;
+            std::string_view text;
+            {
+                Span span(Metrics::global().detokenize);
+                text = event.token == kFlush ? stream.decoder_.flush() : stream.decoder_.push(event.token);
+            }
+            if (!text.empty() && stream.on_text_) stream.on_text_(text);
+        } catch (const std::exception& e) {
+            std::cerr << "Token streamer: " << e.what() << std::endl;
+        } catch (...) {
+            std::cerr << "Token streamer: unknown exception" << std::endl;
+        }
+    }
+    if (event.fn) {
+        try {
+            event.fn();
+        } catch (const std::exception& e) {
+            std::cerr << "Token streamer: " << e.what() << std::endl;
+        } catch (...) {
+            std::cerr << "Token streamer: unknown exception" << std::endl;
+        }
+    }
+}
@@ -1,14 +1,76 @@
 #include "tokenizer.h"
-#include <fstream>
-#include <sstream>
+#include "pre_tokenizer.h"
 #include <algorithm>
-#include <nlohmann/json.hpp>
+#include <atomic>
+#include <cstring>
+#include <deque>
 #include <iostream>
-#include <regex>
+#include <queue>
+#include <unordered_map>
+
+namespace {
+
+// Encode a unicode codepoint (< 0x800) as UTF-8, the encoding vocab.json uses
+std::string codepoint_to_utf8(int codepoint) {
+    std::string out;
+    if (codepoint < 0x80) {
+        out += static_cast<char>(codepoint);
+    } else {
+        out += static_cast<char>(0xC0 | (codepoint >> 6));
+        out += static_cast<char>(0x80 | (codepoint & 0x3F));
+    }
+    return out;
+}
+
+// Distinct words kept by the BPE cache unless set_cache_capacity() says otherwise
+constexpr size_t kDefaultCacheCapacity = 65536;
+
+// Batch work is handed out in about this many ranges per thread, so threads
+// that draw short texts pick up more
+constexpr size_t kRangesPerThread = 16;
 
-using json = nlohmann::json;
+size_t batch_grain(size_t count, const ThreadPool& pool) {
+    return std::max<size_t>(count / (pool.num_threads() * kRangesPerThread), 1);
+}
+
+} // namespace
+
+// Frequent words make up most of a corpus; finding them here skips the shard
+// lock and LRU update of the shared cache. Each thread keeps one for the
+// whole of an encode_batch call. Cleared when full.
+struct Tokenizer::LocalWordCache {
+    static constexpr size_t kMaxWords = 16384;
+
+    // Keys view the strings in words, which stay put as it grows, so a
+    // lookup hashes the word in place instead of copying it
+    std::unordered_map<std::string_view, std::pair<size_t, size_t>> index;  // Word -> range in ids
+    std::deque<std::string> words;
+    std::vector<int> ids;
+    uint64_t batch = 0;  // encode_batch call the entries were made for
+
+    bool lookup(std::string_view word, std::vector<int>& token_ids) const {
+        auto it = index.find(word);
+        if (it == index.end()) return false;
+        token_ids.insert(token_ids.end(), ids.begin() + it->second.first,
+                         ids.begin() + it->second.first + it->second.second);
+        return true;
+    }
 
-Tokenizer::Tokenizer() {
+    void insert(std::string_view word, const int* token_ids, size_t count) {
+        if (index.size() >= kMaxWords) clear();
+        index.emplace(words.emplace_back(word), std::make_pair(ids.size(), count));
+        ids.insert(ids.end(), token_ids, token_ids + count);
+    }
+
+    void clear() {
+        index.clear();
+        words.clear();
+        ids.clear();
+    }
+};
+
+Tokenizer::Tokenizer() : bpe_cache_(kDefaultCacheCapacity) {
+    byte_token_ids_.fill(-1);
     init_byte_encoder();
 }
 
@@ -39,200 +101,254 @@ void Tokenizer::init_byte_encoder() {
     // Create encoder/decoder mappings
     for (size_t i = 0; i < byte_list.size(); i++) {
         unsigned char byte = static_cast<unsigned char>(byte_list[i]);
-        std::string unicode_char(1, static_cast<char>(char_list[i]));
-        byte_encoder_[byte] = unicode_char;
-        byte_decoder_[unicode_char] = byte;
+        byte_encoder_[byte] = codepoint_to_utf8(char_list[i]);
     }
 }
 
 bool Tokenizer::load(const std::string& vocab_path, const std::string& merges_path) {
-    // Load vocabulary
-    std::ifstream vocab_file(vocab_path);
-    if (!vocab_file.is_open()) {
-        std::cerr << "Failed to open vocab file: " << vocab_path << std::endl;
+    if (!data_.build(vocab_path, merges_path, byte_encoder_)) {
         return false;
     }
 
-    json vocab_json;
-    vocab_file >> vocab_json;
-    vocab_file.close();
+    std::cout << "Loaded " << data_.vocab_size() << " tokens from vocabulary" << std::endl;
+    std::cout << "Loaded " << data_.num_merges() << " merge rules" << std::endl;
 
-    for (auto& [key, value] : vocab_json.items()) {
-        vocab_[key] = value.get<int>();
-        reverse_vocab_[value.get<int>()] = key;
-    }
-
-    std::cout << "Loaded " << vocab_.size() << " tokens from vocabulary" << std::endl;
+    init_byte_token_ids();
+    return true;
+}
 
-    // Load merges
-    std::ifstream merges_file(merges_path);
-    if (!merges_file.is_open()) {
-        std::cerr << "Failed to open merges file: " << merges_path << std::endl;
+bool Tokenizer::load_binary(const std::string& path) {
+    if (!data_.open(path)) {
         return false;
     }
 
-    std::string line;
-    std::getline(merges_file, line); // Skip first line (version)
+    std::cout << "Mapped tokenizer " << path << ": " << data_.vocab_size() << " tokens, "
+              << data_.num_merges() << " merge rules" << std::endl;
 
-    while (std::getline(merges_file, line)) {
-        if (line.empty()) continue;
+    init_byte_token_ids();
+    bpe_cache_.clear();
+    return true;
+}
 
-        std::istringstream iss(line);
-        std::string first, second;
-        iss >> first >> second;
+bool Tokenizer::save_binary(const std::string& path) const {
+    return data_.save(path);
+}
 
-        if (!first.empty() && !second.empty()) {
-            merges_.push_back({first, second});
-        }
+void Tokenizer::init_byte_token_ids() {
+    for (int b = 0; b < 256; b++) {
+        byte_token_ids_[b] = data_.find_token(byte_encoder_[b]);
     }
-    merges_file.close();
-
-    std::cout << "Loaded " << merges_.size() << " merge rules" << std::endl;
-
-    return true;
 }
 
-std::vector<std::string> Tokenizer::split_to_words(const std::string& text) {
-    // Split text into words using GPT-2's pattern
-    // Pattern: 's|'t|'re|'ve|'m|'ll|'d| ?\p{L}+| ?\p{N}+| ?[^\s\p{L}\p{N}]+|\s+(?!\S)|\s+
-    std::regex pattern(R"('s|'t|'re|'ve|'m|'ll|'d| ?[a-zA-Z]+| ?[0-9]+| ?[^\s\w]+|\s+)");
+void Tokenizer::byte_pair_encode(std::string_view token, std::vector<int>& token_ids) const {
+    // Doubly linked list of symbols, starting with one per byte. A merge keeps
+    // the left symbol and unlinks the right one.
+    struct Symbol {
+        int id;
+        int prev;
+        int next;
+    };
+    std::vector<Symbol> symbols;
+    symbols.reserve(token.size());
 
-    std::vector<std::string> words;
-    auto words_begin = std::sregex_iterator(text.begin(), text.end(), pattern);
-    auto words_end = std::sregex_iterator();
-
-    for (std::sregex_iterator i = words_begin; i != words_end; ++i) {
-        words.push_back((*i).str());
+    for (unsigned char c : token) {
+        int id = byte_token_ids_[c];
+        if (id < 0) {
+            std::cerr << "Warning: Unknown byte " << static_cast<int>(c) << std::endl;
+            continue;
+        }
+        int index = static_cast<int>(symbols.size());
+        symbols.push_back({id, index - 1, index + 1});
     }
+    if (symbols.empty()) return;
+    symbols.back().next = -1;
+
+    // Candidate merges, lowest rank first and leftmost first within a rank,
+    // which reproduces applying each merge to all its occurrences in turn
+    struct Candidate {
+        int rank;
+        int left;
+        int left_id;
+        int right_id;
+        int merged_id;
+    };
+    auto later = [](const Candidate& a, const Candidate& b) {
+        return a.rank != b.rank ? a.rank > b.rank : a.left > b.left;
+    };
+    std::vector<Candidate> storage;
+    storage.reserve(symbols.size());
+    std::priority_queue<Candidate, std::vector<Candidate>, decltype(later)> queue(later, std::move(storage));
+
+    auto push_pair = [&](int left) {
+        if (left < 0) return;
+        int right = symbols[left].next;
+        if (right < 0) return;
+        auto merge = data_.find_merge(TokenizerData::pair_key(symbols[left].id, symbols[right].id));
+        if (merge) {
+            queue.push({merge->rank, left, symbols[left].id, symbols[right].id, merge->merged_id});
+        }
+    };
 
-    return words;
-}
+    for (int i = 0; i + 1 < static_cast<int>(symbols.size()); i++) {
+        push_pair(i);
+    }
 
-std::vector<std::string> Tokenizer::get_pairs(const std::vector<std::string>& word) {
-    std::vector<std::string> pairs;
-    if (word.size() < 2) return pairs;
+    while (!queue.empty()) {
+        Candidate candidate = queue.top();
+        queue.pop();
 
-    for (size_t i = 0; i < word.size() - 1; i++) {
-        pairs.push_back(word[i] + " " + word[i + 1]);
-    }
-    return pairs;
-}
+        // Skip candidates made stale by an earlier merge of either symbol
+        Symbol& left = symbols[candidate.left];
+        if (left.id != candidate.left_id || left.next < 0) continue;
+        Symbol& right = symbols[left.next];
+        if (right.id != candidate.right_id) continue;
 
-std::vector<std::string> Tokenizer::byte_pair_encode(const std::string& token) {
-    // Convert token to byte-level representation
-    std::vector<std::string> word;
-    for (unsigned char c : token) {
-        word.push_back(byte_encoder_[c]);
-    }
-
-    if (word.size() == 1) return word;
-
-    // Apply BPE merges
-    while (true) {
-        auto pairs = get_pairs(word);
-        if (pairs.empty()) break;
-
-        // Find the highest priority merge
-        int best_merge_idx = -1;
-        size_t best_merge_rank = merges_.size();
-
-        for (size_t i = 0; i < pairs.size(); i++) {
-            std::istringstream iss(pairs[i]);
-            std::string first, second;
-            iss >> first >> second;
-
-            // Find this pair in merges
-            for (size_t j = 0; j < merges_.size(); j++) {
-                if (merges_[j].first == first && merges_[j].second == second) {
-                    if (j < best_merge_rank) {
-                        best_merge_rank = j;
-                        best_merge_idx = i;
-                    }
-                    break;
-                }
-            }
+        left.id = candidate.merged_id;
+        left.next = right.next;
+        if (right.next >= 0) {
+            symbols[right.next].prev = candidate.left;
         }
+        right.id = -1;
 
-        if (best_merge_idx == -1) break;
-
-        // Apply the merge
-        std::vector<std::string> new_word;
-        size_t i = 0;
-        while (i < word.size()) {
-            if (i == best_merge_idx && i + 1 < word.size()) {
-                new_word.push_back(word[i] + word[i + 1]);
-                i += 2;
-            } else {
-                new_word.push_back(word[i]);
-                i++;
-            }
-        }
-        word = new_word;
+        push_pair(left.prev);
+        push_pair(candidate.left);
+    }
 
-        if (word.size() == 1) break;
+    // The first symbol is never unlinked, so the list starts at index 0
+    for (int i = 0; i >= 0; i = symbols[i].next) {
+        token_ids.push_back(symbols[i].id);
     }
+}
 
-    return word;
+int Tokenizer::bos_token_id() const {
+    int id = data_.find_token("<|endoftext|>");
+    return id >= 0 ? id : 0;
 }
 
-std::vector<int> Tokenizer::encode(const std::string& text) {
+std::vector<int> Tokenizer::encode(const std::string& text) const {
     std::vector<int> token_ids;
+    encode_into(text, token_ids, nullptr);
+    return token_ids;
+}
 
-    // Split text into words
-    auto words = split_to_words(text);
+void Tokenizer::encode_into(std::string_view text, std::vector<int>& token_ids, LocalWordCache* local) const {
+    // Split text into words and apply BPE to each, reusing cached results
+    // for repeated words
+    PreTokenizer words(text);
+    std::string_view word;
+    while (words.next(word)) {
+        if (local && local->lookup(word, token_ids)) continue;
+
+        size_t first = token_ids.size();
+        if (!bpe_cache_.lookup(word, token_ids)) {
+            byte_pair_encode(word, token_ids);
+            bpe_cache_.insert(word, token_ids.data() + first, token_ids.size() - first);
+        }
+        if (local) local->insert(word, token_ids.data() + first, token_ids.size() - first);
+    }
+}
 
-    // Apply BPE to each word
-    for (const auto& word : words) {
-        auto bpe_tokens = byte_pair_encode(word);
+TokenBatch Tokenizer::encode_batch(const std::vector<std::string>& texts, ThreadPool& pool) const {
+    return encode_batch(std::vector<std::string_view>(texts.begin(), texts.end()), pool);
+}
 
-        for (const auto& token : bpe_tokens) {
-            auto it = vocab_.find(token);
-            if (it != vocab_.end()) {
-                token_ids.push_back(it->second);
-            } else {
-                std::cerr << "Warning: Unknown token '" << token << "'" << std::endl;
-            }
+TokenBatch Tokenizer::encode_batch(const std::vector<std::string_view>& texts, ThreadPool& pool) const {
+    // Each range of texts is encoded into its own buffer, then the buffers
+    // are copied into place once the offsets are known
+    struct Chunk {
+        std::vector<int> tokens;
+        std::vector<size_t> lengths;
+    };
+    size_t grain = batch_grain(texts.size(), pool);
+    std::vector<Chunk> chunks((texts.size() + grain - 1) / grain);
+    bool use_local = bpe_cache_.capacity() > 0;
+
+    // A thread draws many ranges of one batch; its cache carries over between
+    // them and is only reset when the thread starts on another batch (which
+    // may be another tokenizer's)
+    static std::atomic<uint64_t> batches{0};
+    uint64_t batch_id = ++batches;
+
+    pool.parallel_for(texts.size(), grain, [&](size_t begin, size_t end) {
+        thread_local LocalWordCache local;
+        if (local.batch != batch_id) {
+            local.clear();
+            local.batch = batch_id;
+        }
+        Chunk& chunk = chunks[begin / grain];
+        for (size_t i = begin; i < end; i++) {
+            size_t first = chunk.tokens.size();
+            encode_into(texts[i], chunk.tokens, use_local ? &local : nullptr);
+            chunk.lengths.push_back(chunk.tokens.size() - first);
+        }
+    });
+
+    TokenBatch batch;
+    batch.offsets.reserve(texts.size() + 1);
+    std::vector<size_t> chunk_offsets;
+    chunk_offsets.reserve(chunks.size());
+    for (const Chunk& chunk : chunks) {
+        chunk_offsets.push_back(batch.offsets.back());
+        for (size_t length : chunk.lengths) {
+            batch.offsets.push_back(batch.offsets.back() + length);
         }
     }
 
-    return token_ids;
+    batch.tokens.resize(batch.offsets.back());
+    pool.parallel_for(chunks.size(), 1, [&](size_t begin, size_t end) {
+        for (size_t c = begin; c < end; c++) {
+            std::copy(chunks[c].tokens.begin(), chunks[c].tokens.end(), batch.tokens.begin() + chunk_offsets[c]);
+            std::vector<int>().swap(chunks[c].tokens);
+        }
+    });
+    return batch;
 }
 
-std::string Tokenizer::decode(const std::vector<int>& tokens) {
-    std::string text;
-
-    for (int token_id : tokens) {
-        auto it = reverse_vocab_.find(token_id);
-        if (it != reverse_vocab_.end()) {
-            text += it->second;
+TextBatch Tokenizer::decode_batch(const TokenBatch& batch, ThreadPool& pool) const {
+    size_t count = batch.size();
+    size_t grain = batch_grain(count, pool);
+
+    // Sizes first, so every text is written straight into its final place
+    TextBatch result;
+    result.offsets.resize(count + 1, 0);
+    pool.parallel_for(count, grain, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            size_t size = 0;
+            for (size_t t = batch.offsets[i]; t < batch.offsets[i + 1]; t++) {
+                size += data_.raw_token(batch.tokens[t]).size();
+            }
+            result.offsets[i + 1] = size;
         }
+    });
+    for (size_t i = 0; i < count; i++) {
+        result.offsets[i + 1] += result.offsets[i];
     }
 
-    // Decode from byte-level representation
-    // Need to handle multi-byte unicode characters properly
-    std::string result;
-    size_t i = 0;
-    while (i < text.length()) {
-        // Try to find the longest matching sequence in byte_decoder
-        bool found = false;
-
-        // Check for multi-character sequences first (up to 4 bytes for UTF-8)
-        for (int len = std::min(static_cast<int>(text.length() - i), 4); len > 0; len--) {
-            std::string char_str = text.substr(i, len);
-            auto it = byte_decoder_.find(char_str);
-            if (it != byte_decoder_.end()) {
-                result += static_cast<char>(it->second);
-                i += len;
-                found = true;
-                break;
+    result.text.resize(result.offsets.back());
+    pool.parallel_for(count, grain, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            char* out = &result.text[0] + result.offsets[i];
+            for (size_t t = batch.offsets[i]; t < batch.offsets[i + 1]; t++) {
+                std::string_view bytes = data_.raw_token(batch.tokens[t]);
+                std::memcpy(out, bytes.data(), bytes.size());
+                out += bytes.size();
             }
         }
+    });
+    return result;
+}
 
-        if (!found) {
-            // If no match found, just copy the character as-is
-            result += text[i];
-            i++;
-        }
+std::string Tokenizer::decode(const std::vector<int>& tokens) const {
+    // Every token's decoded bytes are precomputed, so decoding is concatenation
+    size_t size = 0;
+    for (int token_id : tokens) {
+        size += data_.raw_token(token_id).size();
+    }
+
+    std::string result;
+    result.reserve(size);
+    for (int token_id : tokens) {
+        result += data_.raw_token(token_id);
     }
 
     return result;
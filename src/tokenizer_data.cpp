@@ -0,0 +1,357 @@
+#include "tokenizer_data.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <unordered_map>
+#include <nlohmann/json.hpp>
+
+using json = nlohmann::json;
+
+namespace {
+
+constexpr char kMagic[8] = {'G', 'P', 'T', '2', 'B', 'P', 'E', '\0'};
+constexpr uint32_t kVersion = 2;
+
+uint64_t hash_string(std::string_view s) {
+    // FNV-1a
+    uint64_t hash = 1469598103934665603ull;
+    for (unsigned char c : s) {
+        hash ^= c;
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+uint64_t hash_key(uint64_t key) {
+    // splitmix64 finalizer
+    key ^= key >> 30;
+    key *= 0xbf58476d1ce4e5b9ull;
+    key ^= key >> 27;
+    key *= 0x94d049bb133111ebull;
+    key ^= key >> 31;
+    return key;
+}
+
+// Decode the codepoint starting at pos, advancing pos past it
+uint32_t next_codepoint(const std::string& s, size_t& pos) {
+    unsigned char c = static_cast<unsigned char>(s[pos]);
+    size_t len = c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : c >= 0xC0 ? 2 : 1;
+    if (pos + len > s.size()) len = 1;
+    uint32_t cp = len == 1 ? c : c & (0x7F >> len);
+    for (size_t i = 1; i < len; i++) {
+        cp = (cp << 6) | (static_cast<unsigned char>(s[pos + i]) & 0x3F);
+    }
+    pos += len;
+    return cp;
+}
+
+// Smallest power of two with at most 50% load for count entries
+uint32_t bucket_count(size_t count) {
+    uint32_t buckets = 16;
+    while (buckets < count * 2) buckets *= 2;
+    return buckets;
+}
+
+uint64_t align8(uint64_t offset) {
+    return (offset + 7) & ~7ull;
+}
+
+} // namespace
+
+TokenizerData::~TokenizerData() {
+    release();
+}
+
+void TokenizerData::release() {
+    mapping_.close();
+    owned_.clear();
+    header_ = nullptr;
+}
+
+bool TokenizerData::build(const std::string& vocab_path, const std::string& merges_path,
+                          const std::array<std::string, 256>& byte_symbols) {
+    std::ifstream vocab_file(vocab_path);
+    if (!vocab_file.is_open()) {
+        std::cerr << "Failed to open vocab file: " << vocab_path << std::endl;
+        return false;
+    }
+
+    json vocab_json;
+    vocab_file >> vocab_json;
+    vocab_file.close();
+
+    std::unordered_map<std::string, int> vocab;
+    int max_id = -1;
+    for (auto& [key, value] : vocab_json.items()) {
+        int id = value.get<int>();
+        if (id < 0) continue;
+        vocab[key] = id;
+        max_id = std::max(max_id, id);
+    }
+
+    std::vector<const std::string*> strings(max_id + 1, nullptr);
+    uint64_t strings_size = 0;
+    for (const auto& [key, id] : vocab) {
+        strings[id] = &key;
+        strings_size += key.size();
+    }
+
+    // Map each byte symbol back to its byte to precompute the decoded bytes
+    // of every token; symbols outside that alphabet are kept as they are
+    std::unordered_map<uint32_t, char> symbol_bytes;
+    for (int b = 0; b < 256; b++) {
+        size_t pos = 0;
+        if (!byte_symbols[b].empty()) {
+            symbol_bytes[next_codepoint(byte_symbols[b], pos)] = static_cast<char>(b);
+        }
+    }
+    std::vector<std::string> raw_strings(strings.size());
+    uint64_t raw_strings_size = 0;
+    for (size_t id = 0; id < strings.size(); id++) {
+        if (!strings[id]) continue;
+        const std::string& token = *strings[id];
+        for (size_t pos = 0; pos < token.size();) {
+            size_t start = pos;
+            auto it = symbol_bytes.find(next_codepoint(token, pos));
+            if (it != symbol_bytes.end()) {
+                raw_strings[id] += it->second;
+            } else {
+                raw_strings[id].append(token, start, pos - start);
+            }
+        }
+        raw_strings_size += raw_strings[id].size();
+    }
+
+    std::ifstream merges_file(merges_path);
+    if (!merges_file.is_open()) {
+        std::cerr << "Failed to open merges file: " << merges_path << std::endl;
+        return false;
+    }
+
+    // Index merges by the token IDs of both halves; the rank is the line order
+    std::vector<MergeEntry> merges;
+    std::string line;
+    std::getline(merges_file, line); // Skip first line (version)
+    int rank = 0;
+    while (std::getline(merges_file, line)) {
+        if (line.empty()) continue;
+
+        std::istringstream iss(line);
+        std::string first, second;
+        iss >> first >> second;
+
+        if (first.empty() || second.empty()) continue;
+
+        auto left = vocab.find(first);
+        auto right = vocab.find(second);
+        auto merged = vocab.find(first + second);
+        if (left != vocab.end() && right != vocab.end() && merged != vocab.end()) {
+            merges.push_back({pair_key(left->second, right->second), rank, merged->second});
+        }
+        rank++;
+    }
+    merges_file.close();
+
+    // Lay out the sections
+    Header header{};
+    std::memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.version = kVersion;
+    header.vocab_size = static_cast<uint32_t>(strings.size());
+    header.vocab_buckets = bucket_count(vocab.size());
+    header.merge_buckets = bucket_count(merges.size());
+
+    uint64_t offset = align8(sizeof(Header));
+    header.strings_offset = offset;
+    header.strings_size = strings_size;
+    offset = align8(offset + strings_size);
+    header.string_offsets_offset = offset;
+    offset = align8(offset + sizeof(uint32_t) * (header.vocab_size + 1));
+    header.raw_strings_offset = offset;
+    header.raw_strings_size = raw_strings_size;
+    offset = align8(offset + raw_strings_size);
+    header.raw_offsets_offset = offset;
+    offset = align8(offset + sizeof(uint32_t) * (header.vocab_size + 1));
+    header.vocab_table_offset = offset;
+    offset = align8(offset + sizeof(uint32_t) * header.vocab_buckets);
+    header.merge_table_offset = offset;
+    offset += sizeof(MergeEntry) * header.merge_buckets;
+    header.file_size = offset;
+
+    std::vector<uint64_t> buffer((header.file_size + 7) / 8, 0);
+    char* base = reinterpret_cast<char*>(buffer.data());
+
+    char* string_data = base + header.strings_offset;
+    uint32_t* string_offsets = reinterpret_cast<uint32_t*>(base + header.string_offsets_offset);
+    uint32_t string_offset = 0;
+    for (size_t id = 0; id < strings.size(); id++) {
+        string_offsets[id] = string_offset;
+        if (strings[id]) {
+            std::memcpy(string_data + string_offset, strings[id]->data(), strings[id]->size());
+            string_offset += static_cast<uint32_t>(strings[id]->size());
+        }
+    }
+    string_offsets[strings.size()] = string_offset;
+
+    char* raw_data = base + header.raw_strings_offset;
+    uint32_t* raw_offsets = reinterpret_cast<uint32_t*>(base + header.raw_offsets_offset);
+    uint32_t raw_offset = 0;
+    for (size_t id = 0; id < raw_strings.size(); id++) {
+        raw_offsets[id] = raw_offset;
+        std::memcpy(raw_data + raw_offset, raw_strings[id].data(), raw_strings[id].size());
+        raw_offset += static_cast<uint32_t>(raw_strings[id].size());
+    }
+    raw_offsets[raw_strings.size()] = raw_offset;
+
+    uint32_t* vocab_table = reinterpret_cast<uint32_t*>(base + header.vocab_table_offset);
+    uint32_t vocab_mask = header.vocab_buckets - 1;
+    for (size_t id = 0; id < strings.size(); id++) {
+        if (!strings[id]) continue;
+        uint64_t slot = hash_string(*strings[id]) & vocab_mask;
+        while (vocab_table[slot] != 0) slot = (slot + 1) & vocab_mask;
+        vocab_table[slot] = static_cast<uint32_t>(id + 1);
+    }
+
+    MergeEntry* merge_table = reinterpret_cast<MergeEntry*>(base + header.merge_table_offset);
+    uint32_t merge_mask = header.merge_buckets - 1;
+    for (uint32_t i = 0; i < header.merge_buckets; i++) {
+        merge_table[i].key = kEmptyKey;
+    }
+    for (const auto& merge : merges) {
+        uint64_t slot = hash_key(merge.key) & merge_mask;
+        bool duplicate = false;
+        while (merge_table[slot].key != kEmptyKey) {
+            // A pair listed twice keeps its first (lowest) rank
+            if (merge_table[slot].key == merge.key) {
+                duplicate = true;
+                break;
+            }
+            slot = (slot + 1) & merge_mask;
+        }
+        if (duplicate) continue;
+        merge_table[slot] = merge;
+        header.num_merges++;
+    }
+
+    std::memcpy(base, &header, sizeof(Header));
+
+    release();
+    owned_ = std::move(buffer);
+    return attach(owned_.data(), header.file_size);
+}
+
+bool TokenizerData::open(const std::string& path) {
+    release();
+
+    if (!mapping_.open(path)) {
+        std::cerr << "Failed to map tokenizer file: " << path << std::endl;
+        return false;
+    }
+
+    if (!attach(mapping_.data(), mapping_.size())) {
+        std::cerr << "Invalid tokenizer file: " << path << std::endl;
+        release();
+        return false;
+    }
+    return true;
+}
+
+bool TokenizerData::attach(const void* data, size_t size) {
+    header_ = nullptr;
+    if (size < sizeof(Header)) return false;
+
+    const Header* header = static_cast<const Header*>(data);
+    if (std::memcmp(header->magic, kMagic, sizeof(kMagic)) != 0 || header->version != kVersion) {
+        return false;
+    }
+
+    // Every section must lie inside the file
+    auto fits = [&](uint64_t offset, uint64_t bytes) {
+        return offset % 8 == 0 && offset <= size && bytes <= size - offset;
+    };
+    if (header->file_size != size ||
+        (header->vocab_buckets & (header->vocab_buckets - 1)) != 0 || header->vocab_buckets == 0 ||
+        (header->merge_buckets & (header->merge_buckets - 1)) != 0 || header->merge_buckets == 0 ||
+        !fits(header->strings_offset, header->strings_size) ||
+        !fits(header->string_offsets_offset, sizeof(uint32_t) * (uint64_t(header->vocab_size) + 1)) ||
+        !fits(header->raw_strings_offset, header->raw_strings_size) ||
+        !fits(header->raw_offsets_offset, sizeof(uint32_t) * (uint64_t(header->vocab_size) + 1)) ||
+        !fits(header->vocab_table_offset, sizeof(uint32_t) * uint64_t(header->vocab_buckets)) ||
+        !fits(header->merge_table_offset, sizeof(MergeEntry) * uint64_t(header->merge_buckets))) {
+        return false;
+    }
+
+    const char* base = static_cast<const char*>(data);
+    const uint32_t* string_offsets = reinterpret_cast<const uint32_t*>(base + header->string_offsets_offset);
+    const uint32_t* raw_offsets = reinterpret_cast<const uint32_t*>(base + header->raw_offsets_offset);
+    if (string_offsets[header->vocab_size] > header->strings_size ||
+        raw_offsets[header->vocab_size] > header->raw_strings_size) {
+        return false;
+    }
+
+    header_ = header;
+    strings_ = base + header->strings_offset;
+    string_offsets_ = string_offsets;
+    raw_strings_ = base + header->raw_strings_offset;
+    raw_offsets_ = raw_offsets;
+    vocab_table_ = reinterpret_cast<const uint32_t*>(base + header->vocab_table_offset);
+    merge_table_ = reinterpret_cast<const MergeEntry*>(base + header->merge_table_offset);
+    return true;
+}
+
+bool TokenizerData::save(const std::string& path) const {
+    if (!header_) return false;
+
+    std::ofstream file(path, std::ios::binary);
+    if (!file.is_open()) {
+        std::cerr << "Failed to create tokenizer file: " << path << std::endl;
+        return false;
+    }
+    file.write(bytes(), static_cast<std::streamsize>(header_->file_size));
+    return static_cast<bool>(file);
+}
+
+int TokenizerData::find_token(std::string_view token) const {
+    if (!header_) return -1;
+
+    uint32_t mask = header_->vocab_buckets - 1;
+    uint64_t slot = hash_string(token) & mask;
+    for (uint32_t probe = 0; probe < header_->vocab_buckets; probe++, slot = (slot + 1) & mask) {
+        uint32_t entry = vocab_table_[slot];
+        if (entry == 0) return -1;
+        if (this->token(static_cast<int>(entry - 1)) == token) {
+            return static_cast<int>(entry - 1);
+        }
+    }
+    return -1;
+}
+
+std::string_view TokenizerData::token(int id) const {
+    if (!header_ || id < 0 || static_cast<uint32_t>(id) >= header_->vocab_size) return {};
+    uint32_t begin = string_offsets_[id];
+    uint32_t end = string_offsets_[id + 1];
+    if (begin > end || end > header_->strings_size) return {};
+    return std::string_view(strings_ + begin, end - begin);
+}
+
+std::string_view TokenizerData::raw_token(int id) const {
+    if (!header_ || id < 0 || static_cast<uint32_t>(id) >= header_->vocab_size) return {};
+    uint32_t begin = raw_offsets_[id];
+    uint32_t end = raw_offsets_[id + 1];
+    if (begin > end || end > header_->raw_strings_size) return {};
+    return std::string_view(raw_strings_ + begin, end - begin);
+}
+
+const TokenizerData::MergeEntry* TokenizerData::find_merge(uint64_t key) const {
+    if (!header_) return nullptr;
+
+    uint32_t mask = header_->merge_buckets - 1;
+    uint64_t slot = hash_key(key) & mask;
+    for (uint32_t probe = 0; probe < header_->merge_buckets; probe++, slot = (slot + 1) & mask) {
+        const MergeEntry& entry = merge_table_[slot];
+        if (entry.key == key) return &entry;
+        if (entry.key == kEmptyKey) return nullptr;
+    }
+    return nullptr;
+}
@@ -0,0 +1,70 @@
+// Checks that every SIMD sampler kernel this CPU supports gives exactly the
+// scalar kernel's results, for lengths that are not multiples of the vector
+// width or of the 64 tokens in a word of the constraint bitset.
+
+#include "sampler_kernels.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+
+namespace {
+
+using sampler_kernels::Kernels;
+
+int failures = 0;
+
+void expect(bool ok, const char* kernel, const char* isa, size_t n, const char* what) {
+    if (!ok) {
+        std::printf("FAIL %s/%s n=%zu: %s\n", kernel, isa, n, what);
+        failures++;
+    }
+}
+
+void check(const Kernels& simd, const Kernels& scalar, size_t n, std::mt19937& rng) {
+    std::normal_distribution<float> logit(0.0f, 4.0f);
+    std::vector<float> x(n);
+    for (float& v : x) v = logit(rng);
+    std::vector<uint64_t> allowed((n + 63) / 64);
+    for (uint64_t& word : allowed) word = (static_cast<uint64_t>(rng()) << 32) | rng();
+
+    expect(simd.max_value(x.data(), n) == scalar.max_value(x.data(), n), "max_value", simd.name, n, "maximum");
+    expect(simd.argmax(x.data(), n) == scalar.argmax(x.data(), n), "argmax", simd.name, n, "index");
+
+    std::vector<int32_t> want(n), got(n);
+    size_t want_count = scalar.select_at_least(x.data(), n, 1.0f, want.data());
+    size_t got_count = simd.select_at_least(x.data(), n, 1.0f, got.data());
+    expect(want_count == got_count && std::equal(want.begin(), want.begin() + want_count, got.begin()),
+           "select_at_least", simd.name, n, "indices");
+
+    const uint64_t* bitset = allowed.data();
+    for (const uint64_t* mask : {static_cast<const uint64_t*>(nullptr), bitset}) {
+        std::vector<float> a = x, b = x;
+        float want_max = scalar.scale_mask_max(a.data(), n, 0.7f, mask);
+        float got_max = simd.scale_mask_max(b.data(), n, 0.7f, mask);
+        const char* what = mask ? "masked logits" : "scaled logits";
+        expect(want_max == got_max && std::memcmp(a.data(), b.data(), n * sizeof(float)) == 0, "scale_mask_max",
+               simd.name, n, what);
+    }
+}
+
+} // namespace
+
+int main() {
+    std::vector<Kernels> kernels = sampler_kernels::supported_kernels();
+    Kernels scalar = kernels.back();
+    kernels.pop_back();
+    if (kernels.empty()) {
+        std::printf("No SIMD kernels on this CPU; nothing to compare\n");
+        return 0;
+    }
+
+    std::mt19937 rng(1234);
+    const size_t lengths[] = {1, 7, 8, 9, 15, 17, 63, 64, 65, 100, 127, 1005, 2047, 2049, 50257};
+    for (const Kernels& simd : kernels) {
+        for (size_t n : lengths) check(simd, scalar, n, rng);
+        std::printf("%s: %s\n", simd.name, failures ? "mismatches" : "matches scalar");
+    }
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,84 @@
+// Checks encode() against GPT-2's token IDs for ASCII text long enough for
+// the vectorized ASCII scan, contractions, whitespace runs and non-ASCII
+// letters, digits and symbols, and that encode_batch() and decode() agree
+// with it. Takes the directory of the cut-down GPT-2 vocabulary written by
+// tools/make_tokenizer_test_vocab.py.
+
+#include "tokenizer.h"
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct Case {
+    const char* text;
+    std::vector<int> ids;
+};
+
+// Keep the texts in sync with TEXTS in tools/make_tokenizer_test_vocab.py
+const Case kCases[] = {
+    {"Hello world", {15496, 995}},
+    {"The quick brown fox jumps over the lazy dog 1234567 times.",
+     {464, 2068, 7586, 21831, 18045, 625, 262, 16931, 3290, 17031, 2231, 3134, 1661, 13}},
+    {"I'm sure they'll say it's what we've done; you're right, I'd agree. DON'T",
+     {40, 1101, 1654, 484, 1183, 910, 340, 338, 644, 356, 1053, 1760, 26, 345, 821, 826, 11, 314, 1549, 4236, 13,
+      23917, 6, 51}},
+    {"a  b   c\n\n\tindented\n    four spaces  \r\ntrailing   ",
+     {64, 220, 275, 220, 220, 269, 628, 197, 521, 4714, 198, 220, 220, 220, 1440, 9029, 220, 220, 201, 198, 9535,
+      4386, 220, 220, 220}},
+    // "abcdefghijklmnopqrstuvwxyzé café naïve über 12€"
+    {u8"abcdefghijklmnopqrstuvwxyz\u00E9 caf\u00E9 na\u00EFve \u00FCber 12\u20AC",
+     {39305, 4299, 456, 2926, 41582, 10295, 404, 80, 81, 301, 14795, 86, 5431, 89, 2634, 40304, 41492, 6184, 120,
+      527, 1105, 26391}},
+    // "Привет, мир! 日本語のテキスト"
+    {u8"\u041F\u0440\u0438\u0432\u0435\u0442, \u043C\u0438\u0440! \u65E5\u672C\u8A9E\u306E\u30C6\u30AD\u30B9\u30C8",
+     {140, 253, 21169, 18849, 38857, 16843, 20375, 11, 12466, 120, 18849, 21169, 0, 10545, 245, 98, 17312, 105,
+      45739, 252, 5641, 24336, 25084, 43302}},
+    // e and a combining acute accent, Arabic-Indic digits, emoji
+    {u8"e\u0301 \u0663\u0664\u0665 emoji \U0001F44B\U0001F30D!",
+     {68, 136, 223, 18923, 96, 149, 97, 149, 98, 44805, 50169, 233, 8582, 234, 235, 0}},
+    {"", {}},
+};
+
+int failures = 0;
+
+void expect(bool ok, const char* what, const std::string& text) {
+    if (!ok) {
+        std::printf("FAIL %s: \"%s\"\n", what, text.c_str());
+        failures++;
+    }
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        std::printf("Usage: %s <vocab dir>\n", argv[0]);
+        return 2;
+    }
+    std::string dir = argv[1];
+    Tokenizer tokenizer;
+    if (!tokenizer.load(dir + "/vocab.json", dir + "/merges.txt")) return 2;
+    expect(tokenizer.bos_token_id() == 50256, "bos_token_id", "<|endoftext|>");
+
+    std::vector<std::string> texts;
+    for (const Case& c : kCases) {
+        std::vector<int> ids = tokenizer.encode(c.text);
+        expect(ids == c.ids, "encode", c.text);
+        expect(tokenizer.decode(ids) == c.text, "decode", c.text);
+        texts.push_back(c.text);
+    }
+
+    // Twice over, so later texts hit words cached from earlier ones
+    texts.insert(texts.end(), texts.begin(), texts.end());
+    TokenBatch batch = tokenizer.encode_batch(texts);
+    expect(batch.size() == texts.size(), "encode_batch size", "");
+    for (size_t i = 0; i < texts.size() && i < batch.size(); i++) {
+        std::vector<int> ids(batch.data(i), batch.data(i) + batch.length(i));
+        expect(ids == tokenizer.encode(texts[i]), "encode_batch", texts[i]);
+    }
+
+    std::printf("tokenizer: %s\n", failures ? "mismatches" : "matches GPT-2");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,47 @@
+#!/usr/bin/env python3
+"""Generate src/unicode_tables.inc: codepoint ranges for \\p{L} and \\p{N}.
+
+The pre-tokenizer classifies non-ASCII codepoints by binary search over these
+ranges. Regenerate when moving to a newer Unicode version:
+
+    python3 tools/gen_unicode_tables.py > src/unicode_tables.inc
+"""
+
+import sys
+import unicodedata
+
+
+def ranges(predicate):
+    out = []
+    start = None
+    for cp in range(0x110000):
+        inside = predicate(unicodedata.category(chr(cp)))
+        if inside and start is None:
+            start = cp
+        elif not inside and start is not None:
+            out.append((start, cp - 1))
+            start = None
+    if start is not None:
+        out.append((start, 0x10FFFF))
+    return out
+
+
+def emit(name, table):
+    print(f"const CodepointRange {name}[] = {{")
+    for i in range(0, len(table), 4):
+        row = ", ".join(f"{{0x{a:X}, 0x{b:X}}}" for a, b in table[i:i + 4])
+        print(f"    {row},")
+    print("};")
+    print()
+
+
+def main():
+    print(f"// Generated by tools/gen_unicode_tables.py from Unicode {unicodedata.unidata_version}. Do not edit.")
+    print()
+    emit("kLetterRanges", ranges(lambda c: c.startswith("L")))
+    emit("kNumberRanges", ranges(lambda c: c.startswith("N")))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,254 @@
+#!/usr/bin/env python3
+"""Generate a small random-weights GPT-2 model and tokenizer for benchmarks.
+
+Writes <output>/vocab.json, <output>/merges.txt and
+<output>/onnx/decoder_model_merged.onnx. The model has the same inputs and
+outputs as GPT-2 exported by optimum's merged decoder (input_ids,
+attention_mask, position_ids, past_key_values.{i}.key/value,
+use_cache_branch -> logits, present.{i}.key/value), so the engine runs it the
+same way, KV cache included. The tokenizer is byte-level BPE trained on a
+built-in text. Everything is seeded, so every run writes the same files and
+benchmarks need no downloads:
+
+    python3 tools/make_bench_model.py --output bench_model
+
+Requires numpy and onnx.
+"""
+
+import argparse
+import collections
+import json
+import os
+import re
+
+import numpy as np
+import onnx
+from onnx import TensorProto, helper, numpy_helper
+
+TRAINING_TEXT = """\
+The quick brown fox jumps over the lazy dog. It's 3:45pm and we've already
+processed 1,234,567 requests today -- that's roughly 89% of yesterday's load.
+Tokenizers split text like this into words, numbers and punctuation before
+applying byte-pair merges to each piece. Language models read those pieces
+one at a time, and each new token depends on every token before it. During
+generation the model keeps the keys and values it computed for earlier
+positions, so a step only has to process the newest token. Batching several
+requests together keeps the matrix units busy; sampling then picks the next
+token from the probabilities the model assigns to the whole vocabulary.
+Once upon a time, in a land far away, there lived a curious engineer who
+measured everything twice and optimized only what the profiler pointed at.
+"""
+
+# GPT-2's pre-tokenizer pattern, with \\p{L} / \\p{N} spelled for Python's re
+PATTERN = re.compile(r"""'s|'t|'re|'ve|'m|'ll|'d| ?[^\W\d_]+| ?\d+| ?[^\s\w]+|\s+(?!\S)|\s+""")
+
+
+def bytes_to_unicode():
+    """GPT-2's reversible mapping from bytes to printable characters."""
+    bs = list(range(ord("!"), ord("~") + 1)) + list(range(ord("¡"), ord("¬") + 1)) + list(range(ord("®"), ord("ÿ") + 1))
+    cs = bs[:]
+    n = 0
+    for b in range(256):
+        if b not in bs:
+            bs.append(b)
+            cs.append(256 + n)
+            n += 1
+    return dict(zip(bs, (chr(c) for c in cs)))
+
+
+def train_bpe(text, num_merges):
+    byte_map = bytes_to_unicode()
+    words = collections.Counter(
+        tuple(byte_map[b] for b in word.encode("utf-8")) for word in PATTERN.findall(text)
+    )
+
+    vocab = [byte_map[b] for b in range(256)]
+    merges = []
+    for _ in range(num_merges):
+        pairs = collections.Counter()
+        for word, count in words.items():
+            for pair in zip(word, word[1:]):
+                pairs[pair] += count
+        if not pairs:
+            break
+        # Most frequent pair, ties broken by the pair itself for determinism
+        best = max(pairs.items(), key=lambda item: (item[1], item[0]))[0]
+        merged = best[0] + best[1]
+        merges.append(best)
+        vocab.append(merged)
+
+        new_words = collections.Counter()
+        for word, count in words.items():
+            out = []
+            i = 0
+            while i < len(word):
+                if i + 1 < len(word) and (word[i], word[i + 1]) == best:
+                    out.append(merged)
+                    i += 2
+                else:
+                    out.append(word[i])
+                    i += 1
+            new_words[tuple(out)] += count
+        words = new_words
+
+    vocab.append("<|endoftext|>")
+    return vocab, merges
+
+
+class GraphBuilder:
+    def __init__(self, rng):
+        self.rng = rng
+        self.nodes = []
+        self.initializers = []
+        self.counter = 0
+
+    def name(self, prefix):
+        self.counter += 1
+        return f"{prefix}_{self.counter}"
+
+    def weight(self, name, shape, scale=0.02):
+        data = (self.rng.standard_normal(shape) * scale).astype(np.float32)
+        self.initializers.append(numpy_helper.from_array(data, name))
+        return name
+
+    def const(self, name, value, dtype=np.float32):
+        self.initializers.append(numpy_helper.from_array(np.array(value, dtype=dtype), name))
+        return name
+
+    def op(self, op_type, inputs, outputs=None, **attrs):
+        if outputs is None:
+            outputs = [self.name(op_type.lower())]
+        self.nodes.append(helper.make_node(op_type, inputs, outputs, **attrs))
+        return outputs[0] if len(outputs) == 1 else outputs
+
+    def layer_norm(self, x, prefix, hidden):
+        gamma = self.const(f"{prefix}.weight", np.ones(hidden))
+        beta = self.const(f"{prefix}.bias", np.zeros(hidden))
+        return self.op("LayerNormalization", [x, gamma, beta], axis=-1, epsilon=1e-5)
+
+    def linear(self, x, prefix, fan_in, fan_out):
+        w = self.weight(f"{prefix}.weight", (fan_in, fan_out))
+        b = self.const(f"{prefix}.bias", np.zeros(fan_out))
+        return self.op("Add", [self.op("MatMul", [x, w]), b])
+
+
+def build_model(vocab_size, layers, heads, hidden, max_positions, seed):
+    rng = np.random.default_rng(seed)
+    g = GraphBuilder(rng)
+    head_dim = hidden // heads
+
+    batch, seq, past, total = "batch_size", "sequence_length", "past_sequence_length", "total_sequence_length"
+    inputs = [
+        helper.make_tensor_value_info("input_ids", TensorProto.INT64, [batch, seq]),
+        helper.make_tensor_value_info("attention_mask", TensorProto.INT64, [batch, total]),
+        helper.make_tensor_value_info("position_ids", TensorProto.INT64, [batch, seq]),
+    ]
+    outputs = [helper.make_tensor_value_info("logits", TensorProto.FLOAT, [batch, seq, vocab_size])]
+    for i in range(layers):
+        for kind in ("key", "value"):
+            inputs.append(helper.make_tensor_value_info(
+                f"past_key_values.{i}.{kind}", TensorProto.FLOAT, [batch, heads, past, head_dim]))
+            outputs.append(helper.make_tensor_value_info(
+                f"present.{i}.{kind}", TensorProto.FLOAT, [batch, heads, total, head_dim]))
+    # Accepted for compatibility with the merged decoder; past is always
+    # concatenated, and an empty past on the first step is a no-op
+    inputs.append(helper.make_tensor_value_info("use_cache_branch", TensorProto.BOOL, [1]))
+
+    # Embeddings
+    wte = g.weight("transformer.wte.weight", (vocab_size, hidden))
+    wpe = g.weight("transformer.wpe.weight", (max_positions, hidden), scale=0.01)
+    x = g.op("Add", [g.op("Gather", [wte, "input_ids"]), g.op("Gather", [wpe, "position_ids"])])
+
+    # Additive attention bias [batch, 1, seq, total]: causal over absolute
+    # positions and masked where attention_mask is 0
+    zero = g.const("const.zero", 0, np.int64)
+    one = g.const("const.one", 1, np.int64)
+    axis0 = g.const("const.axis0", [0], np.int64)
+    axis1 = g.const("const.axis1", [1], np.int64)
+    axes01 = g.const("const.axes01", [0, 1], np.int64)
+    axes12 = g.const("const.axes12", [1, 2], np.int64)
+
+    def dim1(tensor):
+        return g.op("Squeeze", [g.op("Gather", [g.op("Shape", [tensor]), axis1]), axis0])
+
+    total_len = dim1("attention_mask")
+    seq_len = dim1("input_ids")
+    key_pos = g.op("Range", [zero, total_len, one])
+    query_pos = g.op("Range", [g.op("Sub", [total_len, seq_len]), total_len, one])
+    causal = g.op("LessOrEqual", [g.op("Unsqueeze", [key_pos, axis0]), g.op("Unsqueeze", [query_pos, axis1])])
+    padding = g.op("Unsqueeze", [g.op("Cast", ["attention_mask"], to=TensorProto.BOOL), axes12])
+    allowed = g.op("And", [g.op("Unsqueeze", [causal, axes01]), padding])
+    bias = g.op("Where", [allowed, g.const("const.open", 0.0), g.const("const.closed", -1e4)])
+
+    split_sizes = g.const("const.split", [hidden] * 3, np.int64)
+    heads_shape = g.const("const.heads_shape", [0, 0, heads, head_dim], np.int64)
+    hidden_shape = g.const("const.hidden_shape", [0, 0, hidden], np.int64)
+    scale = g.const("const.scale", 1.0 / np.sqrt(head_dim))
+    half = g.const("const.half", 0.5)
+    inv_sqrt2 = g.const("const.inv_sqrt2", 1.0 / np.sqrt(2.0))
+    one_f = g.const("const.one_f", 1.0)
+
+    for i in range(layers):
+        prefix = f"transformer.h.{i}"
+
+        # Attention
+        h = g.layer_norm(x, f"{prefix}.ln_1", hidden)
+        qkv = g.linear(h, f"{prefix}.attn.c_attn", hidden, 3 * hidden)
+        q, k, v = g.op("Split", [qkv, split_sizes], outputs=[g.name("q"), g.name("k"), g.name("v")], axis=-1)
+        q, k, v = (g.op("Transpose", [g.op("Reshape", [t, heads_shape])], perm=[0, 2, 1, 3]) for t in (q, k, v))
+        k = g.op("Concat", [f"past_key_values.{i}.key", k], outputs=[f"present.{i}.key"], axis=2)
+        v = g.op("Concat", [f"past_key_values.{i}.value", v], outputs=[f"present.{i}.value"], axis=2)
+
+        scores = g.op("Mul", [g.op("MatMul", [q, g.op("Transpose", [k], perm=[0, 1, 3, 2])]), scale])
+        probs = g.op("Softmax", [g.op("Add", [scores, bias])], axis=-1)
+        attn = g.op("Transpose", [g.op("MatMul", [probs, v])], perm=[0, 2, 1, 3])
+        attn = g.linear(g.op("Reshape", [attn, hidden_shape]), f"{prefix}.attn.c_proj", hidden, hidden)
+        x = g.op("Add", [x, attn])
+
+        # MLP with exact GELU
+        h = g.layer_norm(x, f"{prefix}.ln_2", hidden)
+        h = g.linear(h, f"{prefix}.mlp.c_fc", hidden, 4 * hidden)
+        gelu = g.op("Mul", [g.op("Mul", [h, half]),
+                            g.op("Add", [g.op("Erf", [g.op("Mul", [h, inv_sqrt2])]), one_f])])
+        x = g.op("Add", [x, g.linear(gelu, f"{prefix}.mlp.c_proj", 4 * hidden, hidden)])
+
+    x = g.layer_norm(x, "transformer.ln_f", hidden)
+    lm_head = g.weight("lm_head.weight", (hidden, vocab_size))
+    g.op("MatMul", [x, lm_head], outputs=["logits"])
+
+    graph = helper.make_graph(g.nodes, "bench_gpt2", inputs, outputs, g.initializers)
+    model = helper.make_model(graph, opset_imports=[helper.make_opsetid("", 17)], producer_name="make_bench_model")
+    model.ir_version = 8
+    onnx.checker.check_model(model)
+    return model
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--output", default="bench_model")
+    parser.add_argument("--merges", type=int, default=1000, help="BPE merges to learn (at most)")
+    parser.add_argument("--layers", type=int, default=2)
+    parser.add_argument("--heads", type=int, default=4)
+    parser.add_argument("--hidden", type=int, default=128)
+    parser.add_argument("--max-positions", type=int, default=1024)
+    parser.add_argument("--seed", type=int, default=0)
+    args = parser.parse_args()
+
+    vocab, merges = train_bpe(TRAINING_TEXT, args.merges)
+    model = build_model(len(vocab), args.layers, args.heads, args.hidden, args.max_positions, args.seed)
+
+    os.makedirs(os.path.join(args.output, "onnx"), exist_ok=True)
+    with open(os.path.join(args.output, "vocab.json"), "w", encoding="utf-8") as f:
+        json.dump({token: i for i, token in enumerate(vocab)}, f, ensure_ascii=False)
+    with open(os.path.join(args.output, "merges.txt"), "w", encoding="utf-8") as f:
+        f.write("#version: 0.2\n")
+        for left, right in merges:
+            f.write(f"{left} {right}\n")
+    onnx.save(model, os.path.join(args.output, "onnx", "decoder_model_merged.onnx"))
+
+    print(f"Wrote {args.output}: vocab {len(vocab)} ({len(merges)} merges), "
+          f"{args.layers} layers, {args.heads} heads, hidden {args.hidden}")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,78 @@
+#!/usr/bin/env python3
+"""Generate tests/data/gpt2: the GPT-2 vocabulary cut down for tokenizer_test.
+
+Keeps the 256 byte tokens, <|endoftext|>, and every merge whose result occurs
+in one of TEXTS, with GPT-2's token IDs and merge order. A merge can only
+apply inside a word that contains its result, so the cut-down files encode
+TEXTS exactly as the full vocabulary does, in a few kilobytes:
+
+    python3 tools/make_tokenizer_test_vocab.py --model-dir models/gpt2 --output tests/data/gpt2
+
+Rerun after adding an input to tests/tokenizer_test.cpp, with the input added
+to TEXTS.
+"""
+
+import argparse
+import json
+import os
+
+# The inputs of tests/tokenizer_test.cpp
+TEXTS = [
+    "Hello world",
+    "The quick brown fox jumps over the lazy dog 1234567 times.",
+    "I'm sure they'll say it's what we've done; you're right, I'd agree. DON'T",
+    "a  b   c\n\n\tindented\n    four spaces  \r\ntrailing   ",
+    "abcdefghijklmnopqrstuvwxyzé café naïve über 12€",
+    "Привет, мир! 日本語のテキスト",
+    "é ٣٤٥ emoji \U0001F44B\U0001F30D!",
+]
+
+
+def bytes_to_unicode():
+    """GPT-2's printable symbol for each byte."""
+    bs = list(range(ord("!"), ord("~") + 1)) + list(range(ord("¡"), ord("¬") + 1))
+    bs += list(range(ord("®"), ord("ÿ") + 1))
+    cs = bs[:]
+    n = 0
+    for b in range(256):
+        if b not in bs:
+            bs.append(b)
+            cs.append(256 + n)
+            n += 1
+    return dict(zip(bs, map(chr, cs)))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--model-dir", default="models/gpt2", help="directory with GPT-2's vocab.json and merges.txt")
+    parser.add_argument("--output", default="tests/data/gpt2")
+    args = parser.parse_args()
+
+    with open(os.path.join(args.model_dir, "vocab.json"), encoding="utf-8") as f:
+        vocab = json.load(f)
+    with open(os.path.join(args.model_dir, "merges.txt"), encoding="utf-8") as f:
+        lines = f.read().split("\n")
+    header, merges = lines[0], [line.split(" ") for line in lines[1:] if line]
+
+    symbols = bytes_to_unicode()
+    texts = ["".join(symbols[b] for b in text.encode("utf-8")) for text in TEXTS]
+
+    kept_merges = [(a, b) for a, b in merges if any(a + b in text for text in texts)]
+    kept = set(symbols.values()) | {"<|endoftext|>"}
+    kept.update(a + b for a, b in kept_merges)
+
+    os.makedirs(args.output, exist_ok=True)
+    with open(os.path.join(args.output, "vocab.json"), "w", encoding="utf-8") as f:
+        entries = sorted((vocab[token], token) for token in kept)
+        f.write("{\n")
+        f.write(",\n".join(f"  {json.dumps(token, ensure_ascii=False)}: {id}" for id, token in entries))
+        f.write("\n}\n")
+    with open(os.path.join(args.output, "merges.txt"), "w", encoding="utf-8") as f:
+        f.write(header + "\n")
+        for a, b in kept_merges:
+            f.write(f"{a} {b}\n")
+    print(f"Kept {len(kept)} tokens and {len(kept_merges)} merges")
+
+
+if __name__ == "__main__":
+    main()